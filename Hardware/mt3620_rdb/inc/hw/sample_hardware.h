@@ -51,3 +51,6 @@
 // MT3620 RDB: Connect external NRF52 UART using header 2, pin 1 (RX), pin 3 (TX), pin 5 (CTS), pin 7 (RTS)
 #define SAMPLE_NRF52_UART MT3620_RDB_HEADER2_ISU0_UART
 
+// MT3620 RDB: Connect external MCP23017 INTA using header 1, pin 4
+#define SAMPLE_MCP23017_INTA MT3620_RDB_HEADER1_PIN4_GPIO
+
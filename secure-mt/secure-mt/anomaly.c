@@ -0,0 +1,290 @@
+/***************************************************************************************************
+   Name: anomaly.c
+
+   Learns what a normal hour looks like for each hour of the week and flags hours that are far
+   off it.  Every cell holds an EWMA mean and variance of the hour's votes, PIR events and mean
+   mood, so memory is fixed and closing an hour touches three cells.  Counts are scored against at
+   least Poisson noise and mood against a quarter of a point, which keeps quiet cells, whose
+   learnt variance is near zero, from alerting on every odd visitor.
+
+   The baselines take weeks to learn, so they are kept in the mutable storage file: one record per
+   hour of week with that cell of every stream and a CRC, rewritten when its hour is observed.  A
+   record that does not check out only costs its hour of week its history.
+****************************************************************************************************/
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "anomaly.h"
+
+typedef enum {
+	STREAM_VOTES = 0,
+	STREAM_MOTION,
+	STREAM_MOOD,
+	STREAM_COUNT
+} stream_t;
+
+typedef struct {
+	float mean;
+	float variance;
+	uint16_t count;				// observations learnt, saturating
+} baseline_t;
+
+// Smallest standard deviation a mood baseline is scored with
+#define MOOD_MIN_DEVIATION 0.25f
+
+// An hour of week's cells as stored, packed tighter than baseline_t.  Counts only matter up to
+// 1 / ANOMALY_ALPHA, so they are kept saturated at a byte.
+typedef struct {
+	float mean[STREAM_COUNT];
+	float variance[STREAM_COUNT];
+	uint8_t count[STREAM_COUNT];
+	uint8_t cell;				// hour of week, so a record read from the wrong place is refused
+	uint32_t crc;				// over the fields above
+} cell_record_t;
+
+_Static_assert(sizeof(cell_record_t) * ANOMALY_HOURS_OF_WEEK <= ANOMALY_STORAGE_SIZE,
+	"anomaly baselines must fit ANOMALY_STORAGE_SIZE");
+_Static_assert(ANOMALY_HOURS_OF_WEEK <= UINT8_MAX && 1.0f / ANOMALY_ALPHA < UINT8_MAX,
+	"cell_record_t fields are a byte");
+
+static baseline_t baselines[STREAM_COUNT][ANOMALY_HOURS_OF_WEEK];
+static anomaly_stats_t stats;
+static int storageFd = -1;
+
+static const char* kindNames[ANOMALY_KIND_COUNT] = {
+	[ANOMALY_NO_TRAFFIC] = "noTraffic",
+	[ANOMALY_MOTION_HIGH] = "motionHigh",
+	[ANOMALY_PIR_SILENT] = "pirSilent",
+	[ANOMALY_MOOD_LOW] = "moodLow",
+	[ANOMALY_MOOD_HIGH] = "moodHigh",
+};
+
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFFU;
+
+	while (length--) {
+		crc ^= *data++;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+		}
+	}
+	return ~crc;
+}
+
+static off_t RecordOffset(uint16_t cell)
+{
+	return ANOMALY_STORAGE_START + (off_t)cell * (off_t)sizeof(cell_record_t);
+}
+
+static void SaveCell(uint16_t cell)
+{
+	cell_record_t record;
+
+	if (storageFd < 0) {
+		return;
+	}
+
+	memset(&record, 0, sizeof(record));
+	for (int stream = 0; stream < STREAM_COUNT; stream++) {
+		record.mean[stream] = baselines[stream][cell].mean;
+		record.variance[stream] = baselines[stream][cell].variance;
+		record.count[stream] = (baselines[stream][cell].count < UINT8_MAX) ? (uint8_t)baselines[stream][cell].count : UINT8_MAX;
+	}
+	record.cell = (uint8_t)cell;
+	record.crc = Crc32((const uint8_t*)&record, offsetof(cell_record_t, crc));
+
+	if (lseek(storageFd, RecordOffset(cell), SEEK_SET) < 0 ||
+		write(storageFd, &record, sizeof(record)) != (ssize_t)sizeof(record)) {
+		Log_Debug("ERROR: anomaly baseline write failed: %s (%d).\n", strerror(errno), errno);
+		stats.writeErrors++;
+	}
+}
+
+static bool LoadCell(uint16_t cell)
+{
+	cell_record_t record;
+
+	if (lseek(storageFd, RecordOffset(cell), SEEK_SET) < 0 ||
+		read(storageFd, &record, sizeof(record)) != (ssize_t)sizeof(record) ||
+		record.cell != cell || record.crc != Crc32((const uint8_t*)&record, offsetof(cell_record_t, crc))) {
+		return false;
+	}
+
+	for (int stream = 0; stream < STREAM_COUNT; stream++) {
+		baselines[stream][cell].mean = record.mean[stream];
+		baselines[stream][cell].variance = record.variance[stream];
+		baselines[stream][cell].count = record.count[stream];
+	}
+	return true;
+}
+
+static bool IsReady(const baseline_t* baseline)
+{
+	return baseline->count >= ANOMALY_WARMUP;
+}
+
+static float Deviation(const baseline_t* baseline, stream_t stream)
+{
+	float floor = (stream == STREAM_MOOD) ? MOOD_MIN_DEVIATION * MOOD_MIN_DEVIATION
+		: fmaxf(baseline->mean, 1.0f);
+
+	return sqrtf(fmaxf(baseline->variance, floor));
+}
+
+static float Score(const baseline_t* baseline, stream_t stream, float value)
+{
+	return (value - baseline->mean) / Deviation(baseline, stream);
+}
+
+/// <summary>
+///     Folds a value into the cell: a plain average until there are 1 / ANOMALY_ALPHA
+///     observations, an EWMA after that.
+/// </summary>
+static void Learn(baseline_t* baseline, stream_t stream, float value)
+{
+	if (IsReady(baseline)) {
+		float limit = ANOMALY_THRESHOLD * Deviation(baseline, stream);
+		value = fminf(fmaxf(value, baseline->mean - limit), baseline->mean + limit);
+	}
+
+	float alpha = ((float)baseline->count < 1.0f / ANOMALY_ALPHA) ? 1.0f / (float)(baseline->count + 1) : ANOMALY_ALPHA;
+	float difference = value - baseline->mean;
+	float increment = alpha * difference;
+
+	baseline->mean += increment;
+	baseline->variance = (1.0f - alpha) * (baseline->variance + difference * increment);
+	if (baseline->count < UINT16_MAX) {
+		baseline->count++;
+	}
+}
+
+static void Emit(anomaly_alert_t* alerts, uint8_t maxAlerts, uint8_t* count, anomaly_kind_t kind,
+	uint32_t hour, float observed, const baseline_t* baseline, float score)
+{
+	stats.alerts[kind]++;
+	if (*count >= maxAlerts) {
+		return;
+	}
+
+	anomaly_alert_t* alert = &alerts[(*count)++];
+
+	alert->kind = kind;
+	alert->hour = hour;
+	alert->observed = observed;
+	alert->expected = baseline->mean;
+	alert->score = score;
+}
+
+void anomaly_init(void)
+{
+	memset(baselines, 0, sizeof(baselines));
+	memset(&stats, 0, sizeof(stats));
+}
+
+uint16_t anomaly_open(void)
+{
+	uint16_t loaded = 0;
+
+	anomaly_init();
+
+	storageFd = Storage_OpenMutableFile();
+	if (storageFd < 0) {
+		Log_Debug("ERROR: anomaly baselines could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+		return 0;
+	}
+
+	for (uint16_t cell = 0; cell < ANOMALY_HOURS_OF_WEEK; cell++) {
+		if (LoadCell(cell)) {
+			loaded++;
+		}
+	}
+
+	Log_Debug("anomaly: %u hours of week loaded from storage\n", loaded);
+	return loaded;
+}
+
+void anomaly_close(void)
+{
+	if (storageFd >= 0) {
+		close(storageFd);
+		storageFd = -1;
+	}
+}
+
+uint8_t anomaly_observe(uint32_t hour, const anomaly_sample_t* sample, anomaly_alert_t* alerts,
+	uint8_t maxAlerts)
+{
+	uint16_t cell = (uint16_t)((hour + EPOCH_HOUR_OF_WEEK) % ANOMALY_HOURS_OF_WEEK);
+	baseline_t* votes = &baselines[STREAM_VOTES][cell];
+	baseline_t* motion = &baselines[STREAM_MOTION][cell];
+	baseline_t* mood = &baselines[STREAM_MOOD][cell];
+	bool moodCounts = (sample->votes >= ANOMALY_MIN_MOOD_VOTES);
+	uint8_t count = 0;
+
+	stats.hoursObserved++;
+
+	if (alerts != NULL && (IsReady(votes) || IsReady(motion))) {
+		float votesScore = Score(votes, STREAM_VOTES, (float)sample->votes);
+		float motionScore = Score(motion, STREAM_MOTION, (float)sample->motion);
+
+		stats.hoursScored++;
+
+		if (sample->votes == 0 && sample->motion == 0) {
+			if (IsReady(motion) && motionScore <= -ANOMALY_THRESHOLD) {
+				Emit(alerts, maxAlerts, &count, ANOMALY_NO_TRAFFIC, hour, 0.0f, motion, motionScore);
+			}
+			else if (IsReady(votes) && votesScore <= -ANOMALY_THRESHOLD) {
+				Emit(alerts, maxAlerts, &count, ANOMALY_NO_TRAFFIC, hour, 0.0f, votes, votesScore);
+			}
+		}
+		else if (IsReady(motion) && motionScore >= ANOMALY_THRESHOLD &&
+			(float)sample->motion >= ANOMALY_MOTION_HIGH_FACTOR * motion->mean) {
+			Emit(alerts, maxAlerts, &count, ANOMALY_MOTION_HIGH, hour, (float)sample->motion, motion, motionScore);
+		}
+
+		// Only where the PIR normally sees people, so panels without one stay quiet
+		if (sample->motion == 0 && sample->votes >= ANOMALY_PIR_SILENT_VOTES && IsReady(motion) &&
+			motion->mean >= 1.0f) {
+			Emit(alerts, maxAlerts, &count, ANOMALY_PIR_SILENT, hour, 0.0f, motion, motionScore);
+		}
+	}
+
+	if (alerts != NULL && moodCounts && IsReady(mood)) {
+		float moodScore = Score(mood, STREAM_MOOD, sample->mood);
+
+		if (moodScore <= -ANOMALY_THRESHOLD) {
+			Emit(alerts, maxAlerts, &count, ANOMALY_MOOD_LOW, hour, sample->mood, mood, moodScore);
+		}
+		else if (moodScore >= ANOMALY_THRESHOLD) {
+			Emit(alerts, maxAlerts, &count, ANOMALY_MOOD_HIGH, hour, sample->mood, mood, moodScore);
+		}
+	}
+
+	Learn(votes, STREAM_VOTES, (float)sample->votes);
+	Learn(motion, STREAM_MOTION, (float)sample->motion);
+	if (moodCounts) {
+		Learn(mood, STREAM_MOOD, sample->mood);
+	}
+	SaveCell(cell);
+
+	return count;
+}
+
+const char* anomaly_kind_name(anomaly_kind_t kind)
+{
+	return (kind < ANOMALY_KIND_COUNT) ? kindNames[kind] : "unknown";
+}
+
+void anomaly_get_stats(anomaly_stats_t* anomalyStats)
+{
+	*anomalyStats = stats;
+}
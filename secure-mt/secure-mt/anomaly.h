@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hour_of_week.h"
+#include "storage_layout.h"
+
+// Seasonal baseline cells: one per hour of the week
+#define ANOMALY_HOURS_OF_WEEK HOURS_OF_WEEK
+
+// Weight of a new observation in its cell's mean and variance, so about the last 8 weeks count
+#define ANOMALY_ALPHA 0.125f
+
+// Observations a cell needs before it can raise an alert
+#define ANOMALY_WARMUP 3
+
+// Deviation, in baseline standard deviations, that counts as an anomaly
+#define ANOMALY_THRESHOLD 3.5f
+
+// PIR events an hour needs, as a multiple of the baseline mean, to be reported as too many.  The
+// count's upper tail is long in quiet hours; a chattering PIR is far past this.
+#define ANOMALY_MOTION_HIGH_FACTOR 3.0f
+
+// Votes an hour needs before its mean mood is scored or learnt
+#define ANOMALY_MIN_MOOD_VOTES 5
+
+// Votes in an hour without a single PIR event, where PIR events are expected, that mean the PIR
+// is stuck or dead
+#define ANOMALY_PIR_SILENT_VOTES 3
+
+typedef enum {
+	ANOMALY_NO_TRAFFIC = 0,		// no motion and no votes in an hour that is normally busy
+	ANOMALY_MOTION_HIGH,		// far more PIR events than usual: a crowd, or a chattering PIR
+	ANOMALY_PIR_SILENT,			// votes but no PIR events
+	ANOMALY_MOOD_LOW,
+	ANOMALY_MOOD_HIGH,
+	ANOMALY_KIND_COUNT
+} anomaly_kind_t;
+
+typedef struct {
+	uint32_t votes;
+	uint32_t motion;
+	float mood;					// mean on the vote scale, only used with ANOMALY_MIN_MOOD_VOTES votes
+} anomaly_sample_t;
+
+typedef struct {
+	anomaly_kind_t kind;
+	uint32_t hour;				// time / 3600 of the hour that closed
+	float observed;
+	float expected;				// baseline mean of the hour of week
+	float score;				// (observed - expected) / baseline standard deviation
+} anomaly_alert_t;
+
+typedef struct {
+	uint32_t hoursObserved;
+	uint32_t hoursScored;		// with at least one cell past its warmup
+	uint32_t alerts[ANOMALY_KIND_COUNT];
+	uint32_t writeErrors;
+} anomaly_stats_t;
+
+/// <summary>
+///     Clears the baselines, in RAM only.
+/// </summary>
+void anomaly_init(void);
+
+/// <summary>
+///     Loads the baselines kept in the mutable storage file, from ANOMALY_STORAGE_START.  From then
+///     on every hour observed writes its hour of week's record back, so the detector is as warm
+///     after a reboot as before it.
+/// </summary>
+/// <returns>the hours of week loaded, 0 if none were (or storage could not be opened)</returns>
+uint16_t anomaly_open(void);
+
+void anomaly_close(void);
+
+/// <summary>
+///     Scores a closed hour against the baselines of its hour of week, then folds it into them.
+///     Values outside the threshold are clamped to it before they are learnt, so an outage does not
+///     drag the baseline along.  O(1) whatever the history.
+/// </summary>
+/// <param name="alerts">receives up to maxAlerts alerts; may be NULL to only learn</param>
+/// <returns>the number of alerts written</returns>
+uint8_t anomaly_observe(uint32_t hour, const anomaly_sample_t* sample, anomaly_alert_t* alerts,
+	uint8_t maxAlerts);
+
+const char* anomaly_kind_name(anomaly_kind_t kind);
+
+void anomaly_get_stats(anomaly_stats_t* stats);
@@ -3,6 +3,10 @@
 // Enables I2C read/write debug
 #define ENABLE_READ_WRITE_DEBUG
 
+// Logs the vote, storage, telemetry and input statistics every Azure tick.  The same counters are
+// returned by the getDiagnostics direct method.
+//#define ENABLE_STATS_DEBUG
+
 // Defines how quickly the accelerator data is read and reported
 #define ACCEL_READ_PERIOD_SECONDS 10
 #define ACCEL_READ_PERIOD_NANO_SECONDS 0
@@ -0,0 +1,142 @@
+/***************************************************************************************************
+   Name: debounce.c
+
+   Vertical counter debouncer.  Each pin has a counter of how many consecutive polls its raw input
+   has disagreed with the debounced state; the state flips when the counter reaches that pin's
+   threshold.  The counters are kept as bitplanes, so incrementing, clearing and comparing them
+   against the per-pin thresholds is a handful of 16-bit operations per plane for all pins at once.
+****************************************************************************************************/
+
+#include "debounce.h"
+
+/// <summary>
+///     Adds one to the counters of the pins in mask (ripple carry through the planes).
+/// </summary>
+static void IncrementPlanes(uint16_t* planes, int bits, uint16_t mask)
+{
+	uint16_t carry = mask;
+
+	for (int k = 0; k < bits; k++) {
+		uint16_t nextCarry = planes[k] & carry;
+		planes[k] ^= carry;
+		carry = nextCarry;
+	}
+}
+
+/// <summary>
+///     Loads value into the counters of the pins in mask.
+/// </summary>
+static void SetPlanes(uint16_t* planes, int bits, uint16_t mask, uint16_t value)
+{
+	for (int k = 0; k < bits; k++) {
+		planes[k] = (planes[k] & (uint16_t)~mask) | (((value >> k) & 1U) ? mask : 0U);
+	}
+}
+
+/// <summary>
+///     Pins whose counter equals value.
+/// </summary>
+static uint16_t EqualsConstant(const uint16_t* planes, int bits, uint16_t value)
+{
+	uint16_t equal = 0xFFFFU;
+
+	for (int k = 0; k < bits; k++) {
+		equal &= (uint16_t)~(planes[k] ^ (((value >> k) & 1U) ? 0xFFFFU : 0U));
+	}
+
+	return equal;
+}
+
+/// <summary>
+///     Pins whose counter equals their own threshold.
+/// </summary>
+static uint16_t EqualsPlanes(const uint16_t* planes, const uint16_t* other, int bits)
+{
+	uint16_t equal = 0xFFFFU;
+
+	for (int k = 0; k < bits; k++) {
+		equal &= (uint16_t)~(planes[k] ^ other[k]);
+	}
+
+	return equal;
+}
+
+void debounce_init(debounce_t* db, uint16_t defaultThreshold)
+{
+	db->state = 0;
+	SetPlanes(db->count, DEBOUNCE_COUNTER_BITS, 0xFFFFU, 0);
+	SetPlanes(db->hold, DEBOUNCE_HOLD_BITS, 0xFFFFU, 0);
+	debounce_set_threshold(db, 0xFFFFU, defaultThreshold);
+	debounce_set_hold(db, 0, 0, 0);
+}
+
+void debounce_set_threshold(debounce_t* db, uint16_t pinMask, uint16_t polls)
+{
+	// A count of zero is never compared, so one poll is the fastest a pin can follow its input
+	if (polls < 1) {
+		polls = 1;
+	}
+	else if (polls > DEBOUNCE_MAX_THRESHOLD) {
+		polls = DEBOUNCE_MAX_THRESHOLD;
+	}
+
+	SetPlanes(db->threshold, DEBOUNCE_COUNTER_BITS, pinMask, polls);
+}
+
+void debounce_set_hold(debounce_t* db, uint16_t longPressPolls, uint16_t repeatPolls, uint16_t repeatMask)
+{
+	if (longPressPolls > DEBOUNCE_MAX_HOLD) {
+		longPressPolls = DEBOUNCE_MAX_HOLD;
+	}
+	if (repeatPolls > DEBOUNCE_MAX_HOLD - longPressPolls) {
+		repeatPolls = DEBOUNCE_MAX_HOLD - longPressPolls;
+	}
+
+	db->longPressPolls = longPressPolls;
+	db->repeatPolls = repeatPolls;
+	db->repeatMask = repeatMask;
+}
+
+uint16_t debounce_update(debounce_t* db, uint16_t raw, debounce_events_t* events)
+{
+	uint16_t delta = raw ^ db->state;
+
+	// Pins that agree with the debounced state start over, the others count one more poll
+	for (int k = 0; k < DEBOUNCE_COUNTER_BITS; k++) {
+		db->count[k] &= delta;
+	}
+	IncrementPlanes(db->count, DEBOUNCE_COUNTER_BITS, delta);
+
+	// Flip the pins that have been stable long enough
+	uint16_t flipped = delta & EqualsPlanes(db->count, db->threshold, DEBOUNCE_COUNTER_BITS);
+	db->state ^= flipped;
+	SetPlanes(db->count, DEBOUNCE_COUNTER_BITS, flipped, 0);
+
+	events->pressed = flipped & db->state;
+	events->released = flipped & (uint16_t)~db->state;
+	events->longPress = 0;
+	events->repeat = 0;
+
+	// Hold time of the active pins, saturating at DEBOUNCE_MAX_HOLD
+	for (int k = 0; k < DEBOUNCE_HOLD_BITS; k++) {
+		db->hold[k] &= db->state;
+	}
+
+	if (db->longPressPolls == 0) {
+		return db->state;
+	}
+
+	uint16_t saturated = EqualsConstant(db->hold, DEBOUNCE_HOLD_BITS, DEBOUNCE_MAX_HOLD);
+	IncrementPlanes(db->hold, DEBOUNCE_HOLD_BITS, db->state & (uint16_t)~saturated);
+
+	events->longPress = db->state & EqualsConstant(db->hold, DEBOUNCE_HOLD_BITS, db->longPressPolls);
+
+	if (db->repeatPolls != 0) {
+		// Each repeat winds the hold time back to the long press, so the next one is repeatPolls away
+		events->repeat = db->state & db->repeatMask &
+			EqualsConstant(db->hold, DEBOUNCE_HOLD_BITS, db->longPressPolls + db->repeatPolls);
+		SetPlanes(db->hold, DEBOUNCE_HOLD_BITS, events->repeat, db->longPressPolls);
+	}
+
+	return db->state;
+}
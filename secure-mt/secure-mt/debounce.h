@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+// Bitplanes in the stable-time counters; thresholds go up to 2^bits - 1 polls
+#define DEBOUNCE_COUNTER_BITS 5
+#define DEBOUNCE_MAX_THRESHOLD ((1U << DEBOUNCE_COUNTER_BITS) - 1U)
+
+// Bitplanes in the hold counters; long-press and repeat times go up to 2^bits - 1 polls
+#define DEBOUNCE_HOLD_BITS 11
+#define DEBOUNCE_MAX_HOLD ((1U << DEBOUNCE_HOLD_BITS) - 1U)
+
+/// <summary>
+///     Debouncer for a 16-bit port word, one bit per pin, active high.  Every counter is held as
+///     bitplanes (bit k of every pin's count lives in plane[k]), so an update handles all 16 pins
+///     with a fixed number of word operations regardless of how many are bouncing.
+/// </summary>
+typedef struct {
+	uint16_t state;								// debounced pin state
+	uint16_t count[DEBOUNCE_COUNTER_BITS];		// polls the raw input has disagreed with state
+	uint16_t threshold[DEBOUNCE_COUNTER_BITS];	// per-pin stable time, in polls
+	uint16_t hold[DEBOUNCE_HOLD_BITS];			// polls a pin has been debounced active
+	uint16_t repeatMask;						// pins that auto-repeat while held
+	uint16_t longPressPolls;
+	uint16_t repeatPolls;
+} debounce_t;
+
+/// <summary>
+///     Edges reported by one update, as pin masks.
+/// </summary>
+typedef struct {
+	uint16_t pressed;		// debounced inactive -> active
+	uint16_t released;		// debounced active -> inactive
+	uint16_t longPress;		// held active for longPressPolls
+	uint16_t repeat;		// held past the long press, every repeatPolls after it
+} debounce_events_t;
+
+/// <summary>
+///     Clears the debouncer, with every pin inactive and every threshold set to defaultThreshold.
+/// </summary>
+void debounce_init(debounce_t* db, uint16_t defaultThreshold);
+
+/// <summary>
+///     Sets the stable time, in polls (1..DEBOUNCE_MAX_THRESHOLD), of the pins in pinMask.
+/// </summary>
+void debounce_set_threshold(debounce_t* db, uint16_t pinMask, uint16_t polls);
+
+/// <summary>
+///     Sets the long-press time and the repeat period, in polls (up to DEBOUNCE_MAX_HOLD), and the
+///     pins that repeat.  A long-press time of 0 disables long-press and repeat.
+/// </summary>
+void debounce_set_hold(debounce_t* db, uint16_t longPressPolls, uint16_t repeatPolls, uint16_t repeatMask);
+
+/// <summary>
+///     Feeds one sample of the raw (active high) port word.  Call once per poll period.
+/// </summary>
+/// <returns>The debounced state</returns>
+uint16_t debounce_update(debounce_t* db, uint16_t raw, debounce_events_t* events);
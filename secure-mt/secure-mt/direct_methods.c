@@ -0,0 +1,379 @@
+/***************************************************************************************************
+   Name: direct_methods.c
+
+   Lets the cloud ask the device what it remembers instead of having it stream everything.  Each
+   method reads the local aggregates (the compressed minute history, the mood store, the visit
+   funnel and the modules' counters) and writes its JSON answer into one fixed size buffer, so the
+   work done inside the SDK's DoWork is bounded by DIRECT_METHOD_MAX_POINTS per series and the
+   response by DIRECT_METHOD_RESPONSE_MAX, however wide the range asked for.
+****************************************************************************************************/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "direct_methods.h"
+#include "parson.h"
+#include "tsdb.h"
+#include "mood_store.h"
+#include "vote_log.h"
+#include "visit_funnel.h"
+#include "rate_limit.h"
+#include "input_capture.h"
+#include "led_animation.h"
+#include "mcp23x17.h"
+
+// Kept free while writing content so the document can always be closed after a cut
+#define RESPONSE_CLOSE_RESERVE 32
+
+typedef struct {
+	char* text;
+	size_t length;
+	bool truncated;
+} response_t;
+
+typedef struct {
+	time_t from;
+	time_t to;
+	uint32_t step;				// after widening to DIRECT_METHOD_MAX_POINTS
+} query_t;
+
+typedef enum {
+	SERIES_SUM,					// [time, total of the samples]
+	SERIES_RANGE				// [time, mean, min, max]
+} series_format_t;
+
+static tsdb_point_t points[DIRECT_METHOD_MAX_POINTS];
+
+/// <summary>
+///     Appends to the response unless that would eat into the closing reserve, in which case the
+///     response is marked truncated and nothing more is appended.
+/// </summary>
+static bool Append(response_t* response, const char* format, ...)
+{
+	if (response->truncated) {
+		return false;
+	}
+
+	size_t room = DIRECT_METHOD_RESPONSE_MAX - RESPONSE_CLOSE_RESERVE - response->length;
+	va_list args;
+
+	va_start(args, format);
+	int written = vsnprintf(response->text + response->length, room, format, args);
+	va_end(args);
+
+	if (written < 0 || (size_t)written >= room) {
+		response->text[response->length] = '\0';
+		response->truncated = true;
+		return false;
+	}
+
+	response->length += (size_t)written;
+	return true;
+}
+
+/// <summary>
+///     Appends closing text into the reserve; only for the few characters that end a document.
+/// </summary>
+static void Close(response_t* response, const char* text)
+{
+	int written = snprintf(response->text + response->length,
+		DIRECT_METHOD_RESPONSE_MAX - response->length, "%s", text);
+
+	if (written > 0) {
+		response->length += (size_t)written;
+	}
+}
+
+static void Finish(response_t* response)
+{
+	Close(response, response->truncated ? ",\"truncated\":true}" : ",\"truncated\":false}");
+}
+
+/// <summary>
+///     Reads the range arguments.  A missing payload, or missing members, take the defaults: the
+///     last DIRECT_METHOD_DEFAULT_SECONDS up to now at DIRECT_METHOD_DEFAULT_RESOLUTION.
+/// </summary>
+/// <returns>false if the payload is not JSON or the range is empty</returns>
+static bool ParseQuery(const unsigned char* payload, size_t size, query_t* query)
+{
+	uint32_t resolution = DIRECT_METHOD_DEFAULT_RESOLUTION;
+	bool hasFrom = false;
+
+	query->to = time(NULL);
+	query->from = query->to - DIRECT_METHOD_DEFAULT_SECONDS;
+
+	if (payload != NULL && size > 0) {
+		char* text = malloc(size + 1);
+		if (text == NULL) {
+			return false;
+		}
+		memcpy(text, payload, size);
+		text[size] = '\0';
+
+		JSON_Value* root = json_parse_string(text);
+		free(text);
+		if (root == NULL) {
+			return false;
+		}
+
+		JSON_Object* args = json_value_get_object(root);
+		if (args != NULL) {
+			if (json_object_has_value_of_type(args, "to", JSONNumber)) {
+				query->to = (time_t)json_object_get_number(args, "to");
+			}
+			if (json_object_has_value_of_type(args, "from", JSONNumber)) {
+				query->from = (time_t)json_object_get_number(args, "from");
+				hasFrom = true;
+			}
+			if (json_object_has_value_of_type(args, "resolution", JSONNumber)) {
+				double seconds = json_object_get_number(args, "resolution");
+				resolution = (seconds > 0 && seconds < UINT32_MAX) ? (uint32_t)seconds : 0;
+			}
+		}
+		else if (json_value_get_type(root) != JSONNull) {
+			json_value_free(root);
+			return false;
+		}
+		json_value_free(root);
+	}
+
+	if (!hasFrom) {
+		query->from = query->to - DIRECT_METHOD_DEFAULT_SECONDS;
+	}
+	if (query->to <= query->from) {
+		return false;
+	}
+
+	// Nothing finer than the sampling interval is stored; widen as tsdb_query() will
+	uint32_t span = (uint32_t)(query->to - query->from);
+
+	query->step = (resolution < TSDB_INTERVAL_SECONDS) ? TSDB_INTERVAL_SECONDS : resolution;
+	if ((span + query->step - 1) / query->step > DIRECT_METHOD_MAX_POINTS) {
+		query->step = (span + DIRECT_METHOD_MAX_POINTS - 1) / DIRECT_METHOD_MAX_POINTS;
+	}
+	return true;
+}
+
+static void AppendQuery(response_t* response, const query_t* query)
+{
+	Append(response, "{\"from\":%lu,\"to\":%lu,\"step\":%lu",
+		(unsigned long)query->from, (unsigned long)query->to, (unsigned long)query->step);
+}
+
+/// <summary>
+///     Appends a channel's downsampled points as "name":[...].  Values are divided by scale to
+///     undo the channel's fixed point.
+/// </summary>
+static void AppendSeries(response_t* response, const char* name, tsdb_channel_t channel,
+	const query_t* query, float scale, series_format_t format)
+{
+	uint16_t count = tsdb_query(channel, query->from, query->to, query->step,
+		points, DIRECT_METHOD_MAX_POINTS);
+
+	if (!Append(response, ",\"%s\":[", name)) {
+		return;
+	}
+
+	for (uint16_t i = 0; i < count; i++) {
+		const tsdb_point_t* point = &points[i];
+		const char* separator = (i == 0) ? "" : ",";
+		bool appended;
+
+		if (format == SERIES_SUM) {
+			appended = Append(response, "%s[%lu,%lu]", separator, (unsigned long)point->time,
+				(unsigned long)(point->mean * (float)point->count + 0.5f));
+		}
+		else {
+			appended = Append(response, "%s[%lu,%.2f,%.2f,%.2f]", separator,
+				(unsigned long)point->time, point->mean / scale,
+				(float)point->min / scale, (float)point->max / scale);
+		}
+		if (!appended) {
+			break;
+		}
+	}
+	Close(response, "]");
+}
+
+static void MoodHistory(response_t* response, const query_t* query)
+{
+	const mood_totals_t* lifetime = mood_store_lifetime();
+
+	AppendQuery(response, query);
+	Append(response, ",\"lifetime\":{\"happy\":%lu,\"meh\":%lu,\"mad\":%lu,\"motion\":%lu}",
+		(unsigned long)lifetime->count[MOOD_COUNTER_HAPPY],
+		(unsigned long)lifetime->count[MOOD_COUNTER_MEH],
+		(unsigned long)lifetime->count[MOOD_COUNTER_MAD],
+		(unsigned long)lifetime->count[MOOD_COUNTER_MOTION]);
+	AppendSeries(response, "mood", TSDB_CHANNEL_MOOD, query, 100.0f, SERIES_RANGE);
+	AppendSeries(response, "votes", TSDB_CHANNEL_VOTES, query, 1.0f, SERIES_SUM);
+	AppendSeries(response, "motion", TSDB_CHANNEL_MOTION, query, 1.0f, SERIES_SUM);
+	Finish(response);
+}
+
+static void SensorSummary(response_t* response, const query_t* query)
+{
+	AppendQuery(response, query);
+	AppendSeries(response, "temperature", TSDB_CHANNEL_TEMPERATURE, query, 10.0f, SERIES_RANGE);
+	AppendSeries(response, "pressure", TSDB_CHANNEL_PRESSURE, query, 10.0f, SERIES_RANGE);
+	AppendSeries(response, "rssi", TSDB_CHANNEL_RSSI, query, 1.0f, SERIES_RANGE);
+
+	// Visit funnel hours in range, oldest first: [hour start, visits, converted, dwell p50, time to vote p50]
+	if (Append(response, ",\"visits\":[")) {
+		visit_funnel_summary_t summary;
+		bool first = true;
+
+		for (int hoursAgo = VISIT_FUNNEL_HOURS - 1; hoursAgo >= 0; hoursAgo--) {
+			if (!visit_funnel_get_hour((uint8_t)hoursAgo, &summary)) {
+				continue;
+			}
+
+			time_t start = (time_t)summary.hour * 3600;
+			if (start < query->from || start >= query->to) {
+				continue;
+			}
+			if (!Append(response, "%s[%lu,%lu,%lu,%lu,%lu]", first ? "" : ",",
+				(unsigned long)start, (unsigned long)summary.visits,
+				(unsigned long)summary.converted, (unsigned long)summary.dwellP50Ms,
+				(unsigned long)summary.responseP50Ms)) {
+				break;
+			}
+			first = false;
+		}
+		Close(response, "]");
+	}
+	Finish(response);
+}
+
+static void Diagnostics(response_t* response)
+{
+	input_capture_stats_t inputStats;
+	rate_limit_stats_t rateStats;
+	vote_log_stats_t logStats;
+	tsdb_stats_t tsdbStats;
+	led_animation_stats_t ledStats;
+	visit_funnel_totals_t funnel;
+
+	input_capture_get_stats(&inputStats);
+	rate_limit_get_stats(&rateStats);
+	vote_log_get_stats(&logStats);
+	tsdb_get_stats(&tsdbStats);
+	led_animation_get_stats(&ledStats);
+	visit_funnel_get_totals(&funnel);
+
+	Append(response, "{\"uptime\":%lu,\"time\":%lu",
+		(unsigned long)(input_capture_now_ns() / 1000000000ULL), (unsigned long)time(NULL));
+
+	Append(response, ",\"input\":{\"captured\":%lu,\"overflows\":%lu,\"consumed\":%lu,"
+		"\"latencyMeanUs\":%lu,\"latencyMaxUs\":%lu}",
+		(unsigned long)inputStats.captured, (unsigned long)inputStats.overflows,
+		(unsigned long)inputStats.consumed,
+		(unsigned long)(inputStats.latencyCount > 0
+			? inputStats.latencySumNs / inputStats.latencyCount / 1000 : 0),
+		(unsigned long)(inputStats.latencyMaxNs / 1000));
+
+	Append(response, ",\"rateLimit\":{\"allowed\":%lu,\"visit\":%lu,\"button\":%lu,\"global\":%lu}",
+		(unsigned long)rateStats.allowed,
+		(unsigned long)rateStats.suppressed[RATE_LIMIT_VISIT],
+		(unsigned long)rateStats.suppressed[RATE_LIMIT_BUTTON],
+		(unsigned long)rateStats.suppressed[RATE_LIMIT_GLOBAL]);
+
+	Append(response, ",\"voteLog\":{\"records\":%lu,\"blocks\":%lu,\"checkpoints\":%lu,"
+		"\"flashBytes\":%lu,\"writeErrors\":%lu,\"recoveredRecords\":%lu,\"recoveryUs\":%lu}",
+		(unsigned long)logStats.recordsLogged, (unsigned long)logStats.blocksWritten,
+		(unsigned long)logStats.checkpoints, (unsigned long)logStats.flashBytes,
+		(unsigned long)logStats.writeErrors, (unsigned long)logStats.recoveredRecords,
+		(unsigned long)(logStats.recoveryNs / 1000));
+
+	Append(response, ",\"tsdb\":{\"samples\":%lu,\"sealedBlocks\":%lu,\"droppedBlocks\":%lu,"
+		"\"spilledBlocks\":%lu,\"loadedBlocks\":%lu,\"bitsPerSample\":%.2f,\"writeErrors\":%lu}",
+		(unsigned long)tsdbStats.samples, (unsigned long)tsdbStats.sealedBlocks,
+		(unsigned long)tsdbStats.droppedBlocks, (unsigned long)tsdbStats.spilledBlocks,
+		(unsigned long)tsdbStats.loadedBlocks,
+		tsdbStats.samples > 0 ? (float)tsdbStats.encodedBits / (float)tsdbStats.samples : 0.0f,
+		(unsigned long)tsdbStats.writeErrors);
+
+	Append(response, ",\"leds\":{\"frames\":%lu,\"busWrites\":%lu,\"handlerUs\":%lu}",
+		(unsigned long)ledStats.framesPlayed, (unsigned long)ledStats.busWrites,
+		(unsigned long)(ledStats.handlerNs / 1000));
+
+	Append(response, ",\"funnel\":{\"visits\":%lu,\"converted\":%lu,\"votes\":%lu,\"orphanVotes\":%lu,"
+		"\"capped\":%lu}",
+		(unsigned long)funnel.visits, (unsigned long)funnel.converted,
+		(unsigned long)funnel.votes, (unsigned long)funnel.orphanVotes, (unsigned long)funnel.capped);
+
+	// One entry per expander found: [address, OLAT writes issued, writes suppressed]
+	if (Append(response, ",\"panels\":[")) {
+		for (uint8_t i = 0; i < mcp23x17_device_count; i++) {
+			const mcp23x17_ctx_t* device = &mcp23x17_devices[i];
+
+			if (!Append(response, "%s[%u,%lu,%lu]", (i == 0) ? "" : ",", device->addr,
+				(unsigned long)device->olatWritesIssued,
+				(unsigned long)device->olatWritesSuppressed)) {
+				break;
+			}
+		}
+		Close(response, "]");
+	}
+	Finish(response);
+}
+
+static int Respond(const char* text, int status, unsigned char** response, size_t* responseSize)
+{
+	size_t length = strlen(text);
+
+	*response = malloc(length);
+	if (*response == NULL) {
+		*responseSize = 0;
+		return 500;
+	}
+	memcpy(*response, text, length);
+	*responseSize = length;
+	return status;
+}
+
+int direct_methods_callback(const char* methodName, const unsigned char* payload, size_t size,
+	unsigned char** response, size_t* responseSize, void* context)
+{
+	(void)context;
+
+	bool history = (strcmp(methodName, "getMoodHistory") == 0);
+	bool sensors = (strcmp(methodName, "getSensorSummary") == 0);
+	bool diagnostics = (strcmp(methodName, "getDiagnostics") == 0);
+	query_t query;
+
+	if (!history && !sensors && !diagnostics) {
+		return Respond("\"No method found\"", 404, response, responseSize);
+	}
+	if (!diagnostics && !ParseQuery(payload, size, &query)) {
+		return Respond("{\"error\":\"expected {\\\"from\\\":s,\\\"to\\\":s,\\\"resolution\\\":s} with from < to\"}",
+			400, response, responseSize);
+	}
+
+	response_t answer = { .text = malloc(DIRECT_METHOD_RESPONSE_MAX), .length = 0, .truncated = false };
+	if (answer.text == NULL) {
+		*response = NULL;
+		*responseSize = 0;
+		return 500;
+	}
+	answer.text[0] = '\0';
+
+	if (history) {
+		MoodHistory(&answer, &query);
+	}
+	else if (sensors) {
+		SensorSummary(&answer, &query);
+	}
+	else {
+		Diagnostics(&answer);
+	}
+
+	// The SDK frees the response, and does not want the terminator
+	*response = (unsigned char*)answer.text;
+	*responseSize = answer.length;
+	return 200;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+// Largest response built.  IoT Hub allows 128KB, this keeps the buffer small; an answer that would
+// not fit is cut short and flagged "truncated".
+#define DIRECT_METHOD_RESPONSE_MAX (16 * 1024)
+
+// Most points returned per series; a range needing more gets a coarser step
+#define DIRECT_METHOD_MAX_POINTS 96
+
+// Query defaults when the payload does not say: the last day in hours
+#define DIRECT_METHOD_DEFAULT_SECONDS (24 * 3600)
+#define DIRECT_METHOD_DEFAULT_RESOLUTION 3600
+
+/// <summary>
+///     Answers the device's direct methods from what is kept on the device, without touching the
+///     network or the peripherals.  getMoodHistory and getSensorSummary take an optional payload of
+///     { "from": epoch s, "to": epoch s, "resolution": s }; getDiagnostics takes none.
+///     Matches IOTHUB_CLIENT_DEVICE_METHOD_CALLBACK_ASYNC; the response is malloc'd and freed by
+///     the SDK.
+/// </summary>
+/// <returns>the method status: 200, 400 for a bad payload, 404 for an unknown method, 500 out of memory</returns>
+int direct_methods_callback(const char* methodName, const unsigned char* payload, size_t size,
+	unsigned char** response, size_t* responseSize, void* context);
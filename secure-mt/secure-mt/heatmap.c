@@ -0,0 +1,290 @@
+/***************************************************************************************************
+   Name: heatmap.c
+
+   Hour-of-week traffic heatmap: motion and votes counted into 168 cells per series, 16 bits each
+   and saturating.  A cell is decayed when its hour comes round, so the map rolls over the weeks
+   without a second buffer, and the whole thing is 672 bytes.  The encoder turns a series into a
+   short string for a reported property, in place of the hourly events it summarises.
+
+   The decay makes the map weeks of history, more than the mood store's week can rebuild, so it is
+   kept in the mutable storage file: the cells, their hour and what the hour has counted so far,
+   written once an hour into two slots in turn with a sequence number and a CRC.
+****************************************************************************************************/
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "heatmap.h"
+
+#define IMAGE_MAGIC 0x50414D48U		// "HMAP"
+#define SLOT_SIZE (HEATMAP_STORAGE_SIZE / 2)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;			// the newer slot wins
+	uint32_t hour;				// currentHour when written
+	uint32_t hourAdded[HEATMAP_SERIES_COUNT];
+	uint16_t cells[HEATMAP_SERIES_COUNT][HEATMAP_HOURS_OF_WEEK];
+	uint32_t crc;				// over the fields above
+} heatmap_image_t;
+
+_Static_assert(sizeof(heatmap_image_t) <= SLOT_SIZE, "heatmap image must fit a storage slot");
+
+static uint16_t cells[HEATMAP_SERIES_COUNT][HEATMAP_HOURS_OF_WEEK];
+static uint32_t currentHour = 0;
+static uint32_t hourAdded[HEATMAP_SERIES_COUNT];	// events counted since currentHour started
+static heatmap_stats_t stats;
+
+static int storageFd = -1;
+static uint32_t imageSequence = 0;
+static uint32_t savedHour = 0;
+
+static const char Base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFFU;
+
+	while (length--) {
+		crc ^= *data++;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+		}
+	}
+	return ~crc;
+}
+
+static void Save(void)
+{
+	static heatmap_image_t image;
+
+	if (storageFd < 0) {
+		return;
+	}
+
+	image.magic = IMAGE_MAGIC;
+	image.sequence = imageSequence + 1;
+	image.hour = currentHour;
+	memcpy(image.hourAdded, hourAdded, sizeof(hourAdded));
+	memcpy(image.cells, cells, sizeof(cells));
+	image.crc = Crc32((const uint8_t*)&image, offsetof(heatmap_image_t, crc));
+
+	off_t offset = HEATMAP_STORAGE_START + (off_t)(image.sequence & 1U) * SLOT_SIZE;
+	if (lseek(storageFd, offset, SEEK_SET) < 0 || write(storageFd, &image, sizeof(image)) != (ssize_t)sizeof(image)) {
+		Log_Debug("ERROR: heatmap write failed: %s (%d).\n", strerror(errno), errno);
+		stats.writeErrors++;
+		return;
+	}
+	imageSequence = image.sequence;
+	savedHour = currentHour;
+}
+
+static bool LoadSlot(uint32_t slot, heatmap_image_t* image)
+{
+	off_t offset = HEATMAP_STORAGE_START + (off_t)slot * SLOT_SIZE;
+
+	return lseek(storageFd, offset, SEEK_SET) >= 0 &&
+		read(storageFd, image, sizeof(*image)) == (ssize_t)sizeof(*image) &&
+		image->magic == IMAGE_MAGIC && (image->sequence & 1U) == slot &&
+		image->crc == Crc32((const uint8_t*)image, offsetof(heatmap_image_t, crc));
+}
+
+static uint8_t HourOfWeek(uint32_t hour)
+{
+	return (uint8_t)((hour + EPOCH_HOUR_OF_WEEK) % HEATMAP_HOURS_OF_WEEK);
+}
+
+static void Roll(time_t now)
+{
+	uint32_t hour = (uint32_t)(now / 3600);
+
+	// First call, or the clock went back: nothing to decay
+	if (currentHour == 0 || hour <= currentHour) {
+		if (currentHour == 0) {
+			currentHour = hour;
+		}
+		return;
+	}
+
+	uint32_t steps = hour - currentHour;
+	if (steps > HEATMAP_HOURS_OF_WEEK) {
+		steps = HEATMAP_HOURS_OF_WEEK;
+	}
+
+	for (uint32_t step = 0; step < steps; step++) {
+		uint8_t cell = HourOfWeek(hour - step);
+
+		for (int series = 0; series < HEATMAP_SERIES_COUNT; series++) {
+			uint16_t* value = &cells[series][cell];
+			*value -= (uint16_t)((*value + (1U << HEATMAP_DECAY_SHIFT) - 1) >> HEATMAP_DECAY_SHIFT);
+		}
+		stats.hoursRolled++;
+	}
+	currentHour = hour;
+	memset(hourAdded, 0, sizeof(hourAdded));
+}
+
+void heatmap_init(void)
+{
+	memset(cells, 0, sizeof(cells));
+	memset(hourAdded, 0, sizeof(hourAdded));
+	memset(&stats, 0, sizeof(stats));
+	currentHour = 0;
+}
+
+bool heatmap_open(void)
+{
+	static heatmap_image_t images[2];
+	int newest = -1;
+
+	heatmap_init();
+
+	storageFd = Storage_OpenMutableFile();
+	if (storageFd < 0) {
+		Log_Debug("ERROR: heatmap could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+		return false;
+	}
+
+	for (uint32_t slot = 0; slot < 2; slot++) {
+		if (LoadSlot(slot, &images[slot]) &&
+			(newest < 0 || (int32_t)(images[slot].sequence - images[newest].sequence) > 0)) {
+			newest = (int)slot;
+		}
+	}
+	if (newest < 0) {
+		return false;
+	}
+
+	memcpy(cells, images[newest].cells, sizeof(cells));
+	memcpy(hourAdded, images[newest].hourAdded, sizeof(hourAdded));
+	currentHour = images[newest].hour;
+	imageSequence = images[newest].sequence;
+	savedHour = currentHour;
+
+	Log_Debug("heatmap: loaded from storage, written in hour %u\n", currentHour);
+	return true;
+}
+
+void heatmap_close(void)
+{
+	if (storageFd >= 0) {
+		Save();
+		close(storageFd);
+		storageFd = -1;
+	}
+}
+
+void heatmap_add(heatmap_series_t series, time_t now, uint16_t count)
+{
+	if (series >= HEATMAP_SERIES_COUNT) {
+		return;
+	}
+
+	Roll(now);
+
+	uint16_t* value = &cells[series][HourOfWeek((uint32_t)(now / 3600))];
+
+	if (count > UINT16_MAX - *value) {
+		*value = UINT16_MAX;
+		stats.saturated++;
+	}
+	else {
+		*value += count;
+	}
+	hourAdded[series] += count;
+	stats.added += count;
+}
+
+void heatmap_restore(heatmap_series_t series, time_t start, uint32_t total)
+{
+	uint32_t hour = (uint32_t)(start / 3600);
+
+	if (series >= HEATMAP_SERIES_COUNT || (currentHour != 0 && hour < currentHour)) {
+		return;
+	}
+
+	Roll(start);
+
+	uint32_t counted = (hour == currentHour) ? hourAdded[series] : 0;
+	if (total > counted) {
+		uint32_t missing = total - counted;
+		heatmap_add(series, start, (uint16_t)(missing > UINT16_MAX ? UINT16_MAX : missing));
+	}
+}
+
+void heatmap_tick(time_t now)
+{
+	Roll(now);
+
+	if (currentHour != savedHour) {
+		Save();
+	}
+}
+
+uint16_t heatmap_get(heatmap_series_t series, uint8_t hourOfWeek)
+{
+	if (series >= HEATMAP_SERIES_COUNT || hourOfWeek >= HEATMAP_HOURS_OF_WEEK) {
+		return 0;
+	}
+	return cells[series][hourOfWeek];
+}
+
+size_t heatmap_encode(heatmap_series_t series, char* buffer, size_t size)
+{
+	uint8_t packed[HEATMAP_HOURS_OF_WEEK * 3];
+	size_t packedLength = 0;
+	int32_t previous = 0;
+
+	if (series >= HEATMAP_SERIES_COUNT) {
+		return 0;
+	}
+
+	for (int cell = 0; cell < HEATMAP_HOURS_OF_WEEK; cell++) {
+		int32_t delta = (int32_t)cells[series][cell] - previous;
+		uint32_t zigzag = (delta >= 0) ? ((uint32_t)delta << 1) : (((uint32_t)(-delta) << 1) - 1);
+
+		previous = cells[series][cell];
+		while (zigzag >= 0x80) {
+			packed[packedLength++] = (uint8_t)(zigzag | 0x80);
+			zigzag >>= 7;
+		}
+		packed[packedLength++] = (uint8_t)zigzag;
+	}
+
+	size_t textLength = ((packedLength + 2) / 3) * 4;
+	if (textLength + 1 > size) {
+		return 0;
+	}
+
+	char* out = buffer;
+	for (size_t i = 0; i < packedLength; i += 3) {
+		uint32_t group = (uint32_t)packed[i] << 16;
+		size_t remaining = packedLength - i;
+
+		if (remaining > 1) {
+			group |= (uint32_t)packed[i + 1] << 8;
+		}
+		if (remaining > 2) {
+			group |= packed[i + 2];
+		}
+
+		*out++ = Base64Alphabet[(group >> 18) & 0x3f];
+		*out++ = Base64Alphabet[(group >> 12) & 0x3f];
+		*out++ = (remaining > 1) ? Base64Alphabet[(group >> 6) & 0x3f] : '=';
+		*out++ = (remaining > 2) ? Base64Alphabet[group & 0x3f] : '=';
+	}
+	*out = '\0';
+
+	return textLength;
+}
+
+void heatmap_get_stats(heatmap_stats_t* heatmapStats)
+{
+	*heatmapStats = stats;
+}
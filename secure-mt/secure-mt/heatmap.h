@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "hour_of_week.h"
+#include "storage_layout.h"
+
+// One cell per hour of the week
+#define HEATMAP_HOURS_OF_WEEK HOURS_OF_WEEK
+
+// Weekly decay: as a cell's hour comes round again it loses 1 / 2^HEATMAP_DECAY_SHIFT of its
+// count (rounded up, so old traffic reaches zero), about the last month weighing in
+#define HEATMAP_DECAY_SHIFT 2
+
+// Longest text heatmap_encode() writes: base64 of a varint per cell, 3 bytes at most each
+#define HEATMAP_ENCODED_MAX (((HEATMAP_HOURS_OF_WEEK * 3 + 2) / 3) * 4 + 1)
+
+typedef enum {
+	HEATMAP_MOTION = 0,
+	HEATMAP_VOTES,
+	HEATMAP_SERIES_COUNT
+} heatmap_series_t;
+
+typedef struct {
+	uint32_t added;
+	uint32_t saturated;			// adds clipped at UINT16_MAX
+	uint32_t hoursRolled;		// cells decayed as their hour started
+	uint32_t writeErrors;
+} heatmap_stats_t;
+
+/// <summary>
+///     Clears the map, in RAM only.
+/// </summary>
+void heatmap_init(void);
+
+/// <summary>
+///     Loads the map kept in the mutable storage file, from HEATMAP_STORAGE_START.  From then on
+///     heatmap_tick() writes it back once an hour, so its decayed history survives a reboot; the
+///     events since the last write are put back with heatmap_restore().
+/// </summary>
+/// <returns>true if a map was loaded</returns>
+bool heatmap_open(void);
+
+/// <summary>
+///     Writes the map out a last time and closes the file.
+/// </summary>
+void heatmap_close(void);
+
+/// <summary>
+///     Counts events in the cell of the hour of week `now` falls in, saturating at UINT16_MAX.
+/// </summary>
+void heatmap_add(heatmap_series_t series, time_t now, uint16_t count);
+
+/// <summary>
+///     Brings the cell of the hour `start` falls in up to `total` events of the series, for events
+///     counted elsewhere (the mood store) while the map was not running.  Hours before the map's
+///     current hour are taken as already in it; in the current hour only the events heatmap_add()
+///     has not counted are added.
+/// </summary>
+void heatmap_restore(heatmap_series_t series, time_t start, uint32_t total);
+
+/// <summary>
+///     Decays the cells whose hour has started since the last call, including those passed while
+///     the device was off (a whole week at most), and writes the map out once its hour has moved.
+/// </summary>
+void heatmap_tick(time_t now);
+
+uint16_t heatmap_get(heatmap_series_t series, uint8_t hourOfWeek);
+
+/// <summary>
+///     Encodes a series for a reported property: each cell as the difference from the previous
+///     one (the first from 0), zigzagged to unsigned, as a little endian base 128 varint, the whole
+///     run then base64.  Quiet nights cost a byte per hour.
+/// </summary>
+/// <returns>the text length, or 0 if it does not fit (HEATMAP_ENCODED_MAX always does)</returns>
+size_t heatmap_encode(heatmap_series_t series, char* buffer, size_t size);
+
+void heatmap_get_stats(heatmap_stats_t* stats);
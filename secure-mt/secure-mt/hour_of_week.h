@@ -0,0 +1,8 @@
+#pragma once
+
+// Cells of the hour-of-week tables, Monday 00:00 UTC first.  The cell of an hour counted as
+// time / 3600 is (hour + EPOCH_HOUR_OF_WEEK) % HOURS_OF_WEEK.
+#define HOURS_OF_WEEK 168
+
+// 1970-01-01 was a Thursday
+#define EPOCH_HOUR_OF_WEEK (3 * 24)
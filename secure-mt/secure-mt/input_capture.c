@@ -0,0 +1,77 @@
+/***************************************************************************************************
+   Name: input_capture.c
+
+   Queue of expander interrupts between the code that reads INTF/INTCAP off the bus and the vote
+   logic.  It is a single producer / single consumer ring: the producer only writes the head and
+   the consumer only writes the tail, so neither side takes a lock and the producer can later move
+   to its own thread without changing the consumer.
+****************************************************************************************************/
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "input_capture.h"
+
+#define QUEUE_MASK (INPUT_CAPTURE_QUEUE_SIZE - 1U)
+
+static input_capture_event_t queue[INPUT_CAPTURE_QUEUE_SIZE];
+static atomic_uint queueHead = 0;		// next slot to write, producer owned
+static atomic_uint queueTail = 0;		// next slot to read, consumer owned
+
+static input_capture_stats_t captureStats;
+
+uint64_t input_capture_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+bool input_capture_push(const input_capture_event_t* event)
+{
+	unsigned int head = atomic_load_explicit(&queueHead, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&queueTail, memory_order_acquire);
+
+	if (head - tail >= INPUT_CAPTURE_QUEUE_SIZE) {
+		captureStats.overflows++;
+		return false;
+	}
+
+	queue[head & QUEUE_MASK] = *event;
+	atomic_store_explicit(&queueHead, head + 1, memory_order_release);
+	captureStats.captured++;
+
+	return true;
+}
+
+bool input_capture_pop(input_capture_event_t* event)
+{
+	unsigned int tail = atomic_load_explicit(&queueTail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&queueHead, memory_order_acquire);
+
+	if (tail == head) {
+		return false;
+	}
+
+	*event = queue[tail & QUEUE_MASK];
+	atomic_store_explicit(&queueTail, tail + 1, memory_order_release);
+	captureStats.consumed++;
+
+	return true;
+}
+
+void input_capture_record_latency(uint64_t arrivalNs)
+{
+	uint64_t latency = input_capture_now_ns() - arrivalNs;
+
+	captureStats.latencyCount++;
+	captureStats.latencySumNs += latency;
+	if (latency > captureStats.latencyMaxNs) {
+		captureStats.latencyMaxNs = latency;
+	}
+}
+
+void input_capture_get_stats(input_capture_stats_t* stats)
+{
+	*stats = captureStats;
+}
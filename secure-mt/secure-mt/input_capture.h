@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Queue depth, must be a power of two
+#define INPUT_CAPTURE_QUEUE_SIZE 64
+
+/// <summary>
+///     One interrupt from one expander: which pins changed (INTF), the port as it was latched at
+///     the first edge (INTCAP) and as it was when read (GPIO), stamped when INTA was seen asserted.
+/// </summary>
+typedef struct {
+	uint64_t arrivalNs;			// CLOCK_MONOTONIC
+	uint8_t panel;
+	uint8_t intf;
+	uint8_t intcap;
+	uint8_t gpio;
+	uint8_t stalled;			// INTA went unwatched for longer than a debounce time before this
+} input_capture_event_t;
+
+typedef struct {
+	uint32_t captured;
+	uint32_t overflows;			// events dropped because the queue was full
+	uint32_t consumed;
+	uint32_t latencyCount;		// edge-to-vote latencies recorded
+	uint64_t latencySumNs;
+	uint64_t latencyMaxNs;
+} input_capture_stats_t;
+
+uint64_t input_capture_now_ns(void);
+
+/// <summary>
+///     Producer side.  Never blocks; when the queue is full the event is dropped and counted.
+/// </summary>
+/// <returns>true if queued</returns>
+bool input_capture_push(const input_capture_event_t* event);
+
+/// <summary>
+///     Consumer side.
+/// </summary>
+/// <returns>true if an event was returned</returns>
+bool input_capture_pop(input_capture_event_t* event);
+
+/// <summary>
+///     Records the time from an edge arriving to the vote logic acting on it.
+/// </summary>
+void input_capture_record_latency(uint64_t arrivalNs);
+
+void input_capture_get_stats(input_capture_stats_t* stats);
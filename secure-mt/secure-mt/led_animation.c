@@ -0,0 +1,216 @@
+/***************************************************************************************************
+   Name: led_animation.c
+
+   Attract animation for the arcade button LEDs.  Patterns are compiled once into a table of
+   (mask, duration) frames and played from a single one-shot timer that is re-armed with the
+   length of each frame, so the expander is written only on frame boundaries and the event loop
+   wakes once per frame.  Any vote or PIR edge stops the animation until the kiosk has been idle
+   again for LED_ANIMATION_IDLE_SECONDS.
+****************************************************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "led_animation.h"
+
+extern int epollFd;
+extern volatile sig_atomic_t terminationRequired;
+
+static led_frame_t playlist[LED_ANIMATION_MAX_FRAMES];
+static uint16_t playlistCount = 0;
+static uint16_t frameIndex = 0;
+
+static mcp23x17_ctx_t* animationDevices = NULL;
+static uint8_t animationDeviceCount = 0;
+static uint16_t animationMask = 0;
+static bool playing = false;
+static int animationTimerFd = -1;
+
+static led_animation_stats_t animationStats;
+
+/// <summary>
+///     Appends one frame, or stretches the last one when the mask is the same.
+/// </summary>
+static uint16_t AppendFrame(led_frame_t* frames, uint16_t count, uint16_t maxFrames, uint16_t mask, uint16_t durationMs)
+{
+	// A zero length frame would disarm the timer
+	if (durationMs == 0) {
+		return count;
+	}
+
+	if ((count > 0) && (frames[count - 1].mask == mask) &&
+		((uint32_t)frames[count - 1].durationMs + durationMs <= UINT16_MAX)) {
+		frames[count - 1].durationMs += durationMs;
+		return count;
+	}
+
+	if (count >= maxFrames) {
+		return count;
+	}
+
+	frames[count].mask = mask;
+	frames[count].durationMs = durationMs;
+	return count + 1;
+}
+
+uint16_t led_animation_compile_chase(led_frame_t* frames, uint16_t count, uint16_t maxFrames,
+	uint16_t ledMask, uint16_t stepMs, uint8_t cycles)
+{
+	for (uint8_t c = 0; c < cycles; c++) {
+		for (int bit = 0; bit < 16; bit++) {
+			if (ledMask & (1U << bit)) {
+				count = AppendFrame(frames, count, maxFrames, (uint16_t)(1U << bit), stepMs);
+			}
+		}
+	}
+
+	return count;
+}
+
+uint16_t led_animation_compile_blink(led_frame_t* frames, uint16_t count, uint16_t maxFrames,
+	uint16_t ledMask, uint16_t onMs, uint16_t offMs, uint8_t cycles)
+{
+	for (uint8_t c = 0; c < cycles; c++) {
+		count = AppendFrame(frames, count, maxFrames, ledMask, onMs);
+		count = AppendFrame(frames, count, maxFrames, 0, offMs);
+	}
+
+	return count;
+}
+
+uint16_t led_animation_compile_random(led_frame_t* frames, uint16_t count, uint16_t maxFrames,
+	uint16_t ledMask, uint16_t minMs, uint16_t maxMs, uint8_t steps, uint32_t seed)
+{
+	// xorshift32; the sequence is fixed at compile time, so playback costs nothing extra
+	uint32_t x = (seed != 0) ? seed : 0x2545F491U;
+	uint16_t span = (maxMs > minMs) ? (uint16_t)(maxMs - minMs) : 0;
+
+	for (uint8_t s = 0; s < steps; s++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+
+		uint16_t mask = (uint16_t)x & ledMask;
+		uint16_t durationMs = minMs + (span ? (uint16_t)((x >> 16) % (span + 1U)) : 0);
+		count = AppendFrame(frames, count, maxFrames, mask, durationMs);
+	}
+
+	return count;
+}
+
+static void ArmTimerMs(uint32_t ms)
+{
+	struct timespec expiry = { .tv_sec = ms / 1000,.tv_nsec = (long)(ms % 1000) * 1000 * 1000 };
+	SetTimerFdToSingleExpiry(animationTimerFd, &expiry);
+}
+
+/// <summary>
+///     Shows the next frame and arms the timer for its length.
+/// </summary>
+static void AnimationTimerEventHandler(EventData* eventData)
+{
+	struct timespec start, end;
+
+	if (ConsumeTimerFdEvent(animationTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!playing) {
+		// Idle period is over, start from the top of the playlist
+		playing = true;
+		frameIndex = 0;
+	}
+
+	const led_frame_t* frame = &playlist[frameIndex];
+
+	for (uint8_t i = 0; i < animationDeviceCount; i++) {
+		mcp23x17_ctx_t* ctx = &animationDevices[i];
+		uint32_t issuedBefore = ctx->olatWritesIssued;
+
+		mcp23x17_olat_write(ctx, animationMask, frame->mask);
+		mcp23x17_olat_flush(ctx);
+
+		animationStats.busWrites += ctx->olatWritesIssued - issuedBefore;
+	}
+	animationStats.framesPlayed++;
+	animationStats.playedMs += frame->durationMs;
+
+	ArmTimerMs(frame->durationMs);
+	frameIndex = (uint16_t)((frameIndex + 1) % playlistCount);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	animationStats.handlerNs += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + (uint64_t)(end.tv_nsec - start.tv_nsec);
+}
+
+static EventData animationEventData = { .eventHandler = &AnimationTimerEventHandler };
+
+int led_animation_init(mcp23x17_ctx_t* devices, uint8_t deviceCount, uint16_t ledMask)
+{
+	animationDevices = devices;
+	animationDeviceCount = deviceCount;
+	animationMask = ledMask;
+	memset(&animationStats, 0, sizeof(animationStats));
+
+	// Attract playlist: chase, flash all, then a random sparkle, then a rest with everything lit
+	playlistCount = 0;
+	playlistCount = led_animation_compile_chase(playlist, playlistCount, LED_ANIMATION_MAX_FRAMES, ledMask, 150, 4);
+	playlistCount = led_animation_compile_blink(playlist, playlistCount, LED_ANIMATION_MAX_FRAMES, ledMask, 300, 300, 3);
+	playlistCount = led_animation_compile_random(playlist, playlistCount, LED_ANIMATION_MAX_FRAMES, ledMask, 100, 400, 16,
+		(uint32_t)time(NULL));
+	playlistCount = led_animation_compile_blink(playlist, playlistCount, LED_ANIMATION_MAX_FRAMES, ledMask, 2000, 0, 1);
+
+	Log_Debug("LED animation: %d frames compiled\n", playlistCount);
+	if (playlistCount == 0) {
+		return -1;
+	}
+
+	// Disarmed timer, armed below for the first idle period
+	struct timespec disarmed = { 0, 0 };
+	animationTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &animationEventData, EPOLLIN);
+	if (animationTimerFd < 0) {
+		return -1;
+	}
+
+	playing = false;
+	ArmTimerMs(LED_ANIMATION_IDLE_SECONDS * 1000);
+
+	return 0;
+}
+
+void led_animation_close(void)
+{
+	CloseFdAndPrintError(animationTimerFd, "LedAnimationTimer");
+}
+
+bool led_animation_activity(void)
+{
+	bool wasPlaying = playing;
+
+	if (animationTimerFd < 0) {
+		return false;
+	}
+
+	playing = false;
+	ArmTimerMs(LED_ANIMATION_IDLE_SECONDS * 1000);
+
+	return wasPlaying;
+}
+
+bool led_animation_is_playing(void)
+{
+	return playing;
+}
+
+void led_animation_get_stats(led_animation_stats_t* stats)
+{
+	*stats = animationStats;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mcp23x17.h"
+
+// Seconds without a vote or PIR edge before the attract animation starts
+#define LED_ANIMATION_IDLE_SECONDS 30
+
+// Room for the whole compiled playlist
+#define LED_ANIMATION_MAX_FRAMES 64
+
+/// <summary>
+///     One step of an animation: the LED pins to light (OLAT word, port A in the low byte) and how
+///     long to hold them.  Patterns are compiled into tables of these once, at init.
+/// </summary>
+typedef struct {
+	uint16_t mask;
+	uint16_t durationMs;
+} led_frame_t;
+
+typedef struct {
+	uint32_t framesPlayed;
+	uint32_t busWrites;			// OLAT transactions issued by the animation
+	uint64_t playedMs;			// animation time shown
+	uint64_t handlerNs;			// time spent in the frame handler
+} led_animation_stats_t;
+
+/// <summary>
+///     Compiles the attract playlist for the LEDs in ledMask and arms the scheduler timer for the
+///     first idle period.  Every expander in devices shows the same frames.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int led_animation_init(mcp23x17_ctx_t* devices, uint8_t deviceCount, uint16_t ledMask);
+void led_animation_close(void);
+
+/// <summary>
+///     A vote or the PIR fired: stop the animation (the caller owns the LEDs again) and restart the
+///     idle period.
+/// </summary>
+/// <returns>true if the animation was playing, so every expander still shows its last frame</returns>
+bool led_animation_activity(void);
+
+bool led_animation_is_playing(void);
+void led_animation_get_stats(led_animation_stats_t* stats);
+
+// Pattern compilers.  Each appends to frames (merging runs of the same mask) and returns the new
+// frame count, or stops early when maxFrames is reached.
+uint16_t led_animation_compile_chase(led_frame_t* frames, uint16_t count, uint16_t maxFrames,
+	uint16_t ledMask, uint16_t stepMs, uint8_t cycles);
+uint16_t led_animation_compile_blink(led_frame_t* frames, uint16_t count, uint16_t maxFrames,
+	uint16_t ledMask, uint16_t onMs, uint16_t offMs, uint8_t cycles);
+uint16_t led_animation_compile_random(led_frame_t* frames, uint16_t count, uint16_t maxFrames,
+	uint16_t ledMask, uint16_t minMs, uint16_t maxMs, uint8_t steps, uint32_t seed);
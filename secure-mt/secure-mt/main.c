@@ -5,12 +5,15 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <stddef.h>
 
 #include "applibs_versions.h"
 #include <applibs/gpio.h>
 #include <applibs/log.h>
 #include <applibs/networking.h>
 #include <applibs/storage.h>
+#include <applibs/wificonfig.h>
 
 #include <hw/sample_hardware.h>
 
@@ -22,9 +25,24 @@
 // I2C connected sensors/modules
 #include "i2c.h";
 #include "mcp23x17.h";
+#include "debounce.h"
+#include "led_animation.h"
+#include "input_capture.h"
+#include "mood_store.h"
+#include "mood_metrics.h"
+#include "rate_limit.h"
+#include "visit.h"
+#include "visit_funnel.h"
+#include "tsdb.h"
+#include "vote_log.h"
+#include "direct_methods.h"
+#include "telemetry_policy.h"
+#include "anomaly.h"
+#include "heatmap.h"
 #include "oled.h"
 #include "lsm6dso_reg.h"
 #include "lps22hh_reg.h"
+#include "parson.h"
 
 // Azure IoT SDK
 #include <iothub_client_core_common.h>
@@ -45,7 +63,12 @@ static bool iothubAuthenticated = false;
 static const int keepalivePeriodSeconds = 20;
 
 static void SendTelemetry(const unsigned char* key, const unsigned char* value);
+static bool SendMessage(const char* text);
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* context);
+static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char* payload,
+	size_t payloadSize, void* userContextCallback);
+static void ReportStatusCallback(int result, void* context);
+static void HeatmapReportStatusCallback(int result, void* context);
 static const char* GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
 static const char* getAzureSphereProvisioningResultString(AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
 
@@ -58,11 +81,23 @@ static void ClosePeripheralsAndHandlers(void);
 static int sendMessageButtonGpioFd = -1;
 static int sendOrientationButtonGpioFd = -1;
 
+// MCP23017 INTA (mirrored, so it covers both ports)
+static int mcp23x17IntGpioFd = -1;
+
 // Timer / polling
 static int buttonPollTimerFd = -1;
+static int inputSafetyPollTimerFd = -1;
 static int azureTimerFd = -1;
+static int historyTimerFd = -1;
 static int epollFd = -1;
 
+// Set once the LPS22HH behind the LSM6DSO sensor hub has answered
+static bool lps22hhReady = false;
+
+// Hour the anomaly detector is watching, and whether it has been watched from its start
+static uint32_t anomalyHour = 0;
+static bool anomalyHourWhole = false;
+
 // Azure IoT poll periods
 static const int AzureIoTDefaultPollPeriodSeconds = 5;
 static const int AzureIoTMinReconnectPeriodSeconds = 5;
@@ -70,11 +105,20 @@ static const int AzureIoTMaxReconnectPeriodSeconds = 1 * 60;
 
 static int azureIoTPollPeriodSeconds = -1;
 
+// The hour-of-week heatmap goes to the twin once a day, and on the first connection after boot.
+// A report that fails is retried from HeatmapMinRetryPeriodSeconds, with a backoff up to the
+// daily period.
+static const int HeatmapReportPeriodSeconds = 24 * 60 * 60;
+static const int HeatmapMinRetryPeriodSeconds = 60;
+static time_t heatmapReportDueAt = 0;
+static int heatmapRetryPeriodSeconds = 0;
+
 // Statistics
+// Votes and motion are counted in the mood store; these are its lifetime view for the OLED/telemetry
 static int voteCount = 0;
-static float voteTotal = 0.0;
 static float currentMood = 0.0;  // 2.0 is the meh value.  So, it is biased +2 for average reporting.
 static int motionCount = -1;
+static mood_metrics_t moodMetrics;		// recent mood: last votes, last hour, weighted
 
 static bool needScreenUpdate = true;	// we need to update the screen at least once. :)
 
@@ -90,6 +134,28 @@ static bool needScreenUpdate = true;	// we need to update the screen at least on
 
 #define NUM_INPUT_TRACKING 4
 
+// Inputs that raise an interrupt-on-change on port A
+#define INPUT_INTERRUPT_MASK 0x0FU
+
+// INTA is sampled locally every 1ms; the expander is read only when it is asserted.  The safety
+// poll reads GPIOA directly in case an edge was missed (it also clears a stuck interrupt).
+#define INPUT_SAFETY_POLL_NANO_SECONDS (100 * 1000 * 1000)
+
+// Debounce times, in 1ms button polls.  The arcade buttons bounce, the PIR output does not.
+#define INPUT_BUTTON_MASK 0x07U
+#define INPUT_PROXIMITY_MASK 0x08U
+#define INPUT_BUTTON_DEBOUNCE_POLLS 20
+#define INPUT_PROXIMITY_DEBOUNCE_POLLS 2
+#define INPUT_LONG_PRESS_POLLS 1000
+#define INPUT_REPEAT_POLLS 250
+
+// A gap between button polls longer than the debounce time means a whole press could have come and
+// gone unseen; INTCAP is then the only record of it.
+#define INPUT_STALL_NS (INPUT_BUTTON_DEBOUNCE_POLLS * 1000000ULL)
+
+// Button LEDs on port B (OLAT word, port B in the high byte)
+#define BUTTON_LED_ALL_ON 0x0700U
+
 #define GREEN_ELEMENT_NAME "HappyButton"
 #define YELLOW_ELEMENT_NAME "MehButton"
 #define RED_ELEMENT_NAME "MadButton"
@@ -101,35 +167,60 @@ struct InputState {
 	int State;
 };
 
-struct InputState previousInputState[NUM_INPUT_TRACKING] = {
+static const struct InputState defaultInputState[NUM_INPUT_TRACKING] = {
 	{GREEN_ELEMENT_NAME, 3, 0},
 	{YELLOW_ELEMENT_NAME, 2, 0},
 	{RED_ELEMENT_NAME, 1, 0},
 	{PROXIMITY_ELEMENT_NAME, 0, 0}
 };
 
-struct InputState currentInputState[NUM_INPUT_TRACKING] = {
-	{GREEN_ELEMENT_NAME, 3, 0},
-	{YELLOW_ELEMENT_NAME, 2, 0},
-	{RED_ELEMENT_NAME, 1, 0},
-	{PROXIMITY_ELEMENT_NAME, 0, 0}
+// One vote panel per MCP23017 in the device table, same index.  Each keeps the last raw value of
+// its expander pins, active high (bit set = pressed / motion), its debouncer and its input states.
+struct Panel {
+	uint16_t rawInputs;
+	debounce_t debounce;
+	uint64_t edgeNs;			// arrival of the oldest edge the vote logic has not acted on yet
+	bool edgePending;
+	struct InputState previousInputState[NUM_INPUT_TRACKING];
+	struct InputState currentInputState[NUM_INPUT_TRACKING];
+	bool admitted[RATE_LIMIT_BUTTONS];	// the rate limiter let the button's current press count
 };
 
+static struct Panel panels[MCP23X17_MAX_DEVICES];
+
+// Panels in the order they are read when INTA is asserted, the last one to interrupt first
+static uint8_t interruptOrder[MCP23X17_MAX_DEVICES];
+
+// When the button poll last ran, to spot the event loop having been blocked
+static uint64_t lastButtonPollNs = 0;
+
 static GPIO_Value_Type sendMessageButtonState = GPIO_Value_High;
 
 static void ButtonPollTimerEventHandler(EventData* eventData);
+static void InputSafetyPollTimerEventHandler(EventData* eventData);
 static bool IsButtonPressed(int fd, GPIO_Value_Type* oldState);
 static void SendMessageButtonHandler(void);
 static void AzureTimerEventHandler(EventData* eventData);
-static void RetainPreviousState();
-static void UpdateCurrentState();
-static void HandleInput(int index, int isButton);
+static void HistoryTimerEventHandler(EventData* eventData);
+static void SeedAnomalyBaselines(time_t now);
+static void CheckAnomalies(time_t now);
+static void SeedHeatmap(time_t now);
+static void ReportHeatmap(time_t now);
+static void RetryHeatmap(time_t now);
+static void RetainPreviousState(int panel);
+static void UpdateCurrentState(int panel, uint8_t inputState);
+static void ProcessInputs(int panel, uint8_t inputState);
+static void SetRawPortA(int panel, uint8_t portA);
+static void InitPanel(int panel);
+static void HandleInput(int panel, int index, int isButton);
 static void UpdatePasserByCount();
 static void UpdateMood(int index);
 
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData buttonPollEventData = { .eventHandler = &ButtonPollTimerEventHandler };
+static EventData inputSafetyPollEventData = { .eventHandler = &InputSafetyPollTimerEventHandler };
 static EventData azureEventData = { .eventHandler = &AzureTimerEventHandler };
+static EventData historyEventData = { .eventHandler = &HistoryTimerEventHandler };
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -188,6 +279,29 @@ static int InitPeripheralsAndHandlers(void)
 		return -1;
 	}
 
+	// Pick up the counts from before the last reboot or update
+	mood_store_init(time(NULL));
+	vote_log_open(time(NULL));
+
+	const mood_totals_t* restored = mood_store_lifetime();
+	voteCount = (int)mood_totals_votes(restored);
+	mood_totals_mood(restored, &currentMood);
+	motionCount += (int)restored->count[MOOD_COUNTER_MOTION];
+
+	mood_metrics_init(time(NULL));
+	mood_metrics_get(&moodMetrics);
+
+	SeedAnomalyBaselines(time(NULL));
+	SeedHeatmap(time(NULL));
+
+	rate_limit_init(input_capture_now_ns() / 1000000U);
+	visit_init(visit_funnel_on_visit);
+	visit_funnel_init();
+	telemetry_policy_init();
+
+	// Minute history, including what was spilled to storage before the reboot
+	tsdb_open();
+
 	// Open button A GPIO as input
 	Log_Debug("Opening SAMPLE_BUTTON_1 as input\n");
 	sendMessageButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
@@ -234,69 +348,31 @@ static int InitPeripheralsAndHandlers(void)
 
 	// Draw AVNET logo
 	oled_draw_logo();
-	oled_i2c_bus_status(0, currentMood, voteCount, motionCount);
+	oled_i2c_bus_status(0, currentMood, voteCount, motionCount,
+		moodMetrics.ewma[MOOD_EWMA_SHORT], moodMetrics.window);
 
-	// initialize the MCP23017
+	// initialize the MCP23017s, one per vote panel at 0x20-0x27
 	// - Port A input from buttons and proximity
 	// - Port B output to button LEDS
 	//
-	// - No need for interrupts as we are polling at every 0.001 seconds.
+	// - Port A raises interrupt-on-change on INTA, mirrored to cover port B as well
 	// - set port a with all pull-up resistors
 	// - output can be high, as we are going through transistors to power the lights.
-	mcp23x17_init(&i2cFd, 0);
-
 	bool mcp23x17Detected = false;
 	int failCount = 10;
-	int32_t resultCheck = -1;
 
 	while (!mcp23x17Detected) {
-		// Check if mcp23x17Detected is connected
-		resultCheck = mcp23x17_device_id_get(&mcp23x17_ctx, &whoami);
-
-		if ((resultCheck < 0) || (whoami != MCP23X17_DEFAULT_HIGH)) {
-			Log_Debug("resultCheck: %d\n", resultCheck);
-			Log_Debug("whoami: %0x\n", whoami);
-		}
-		if (resultCheck < 0) {
+		// Find every expander on the bus
+		if (mcp23x17_scan(&i2cFd) == 0) {
 			Log_Debug("MCP23x17 not found!\n");
-
-			mcp23x17_status = 1;
 		}
 		else {
-				mcp23x17Detected = true;
-				Log_Debug("MCP23X17 Found!\n");
-
-				mcp23x17_status = 0;
-
-				// add setup code here
-				uint8_t setOuputBank = 0x00U;
-				mcp23x17_write_reg(&mcp23x17_ctx, MCP23017_IODIRB, &setOuputBank, 1);
-
-				uint8_t testRead = 0xffU;
-
-				uint8_t test = mcp23x17_read_reg(&mcp23x17_ctx, MCP23017_IODIRB, &testRead, 1);
-
-				Log_Debug("test: %d\n", test);
-				Log_Debug("testRead: %0x\n", testRead);
-
-				// Setup default lights
-				uint8_t testOutput = 0x07U;
-
-				ssize_t writeRet = mcp23x17_write_reg(&mcp23x17_ctx, MCP23017_GPIOB, &testOutput, 1);
-
-				uint8_t readRet = mcp23x17_read_reg(&mcp23x17_ctx, MCP23017_GPIOB, &testRead, 1);
-				Log_Debug("readRet: %d\n", readRet);
-				Log_Debug("testRead: %0x\n", testRead);
-
-				// Setup the input buttons
-				uint8_t baseInputState = 0xffU;  // this is the default, but I am making sure
-				writeRet = mcp23x17_write_reg(&mcp23x17_ctx, MCP23017_IODIRA, &baseInputState, 1);
-				writeRet = mcp23x17_write_reg(&mcp23x17_ctx, MCP23017_GPPUA, &baseInputState, 1);
-
-				readRet = mcp23x17_read_reg(&mcp23x17_ctx, MCP23017_GPIOA, &testRead, 1);
+			mcp23x17Detected = true;
+			Log_Debug("MCP23X17 Found! %d panel(s)\n", mcp23x17_device_count);
 
-				Log_Debug("readRet(portA): %d\n", readRet);
-				Log_Debug("testRead(portA): %0x\n", testRead);
+			for (int panel = 0; panel < mcp23x17_device_count; panel++) {
+				InitPanel(panel);
+			}
 		}
 
 		// If we failed to detect the mcp23x17Detected device, then pause before trying again.
@@ -310,6 +386,27 @@ static int InitPeripheralsAndHandlers(void)
 		}
 	}
 
+	// Flash the button LEDs while nobody is around
+	if (led_animation_init(mcp23x17_devices, mcp23x17_device_count, BUTTON_LED_ALL_ON) != 0) {
+		return -1;
+	}
+
+	// Open the MCP23017 INTA GPIO as input
+	Log_Debug("Opening SAMPLE_MCP23017_INTA as input\n");
+	mcp23x17IntGpioFd = GPIO_OpenAsInput(SAMPLE_MCP23017_INTA);
+	if (mcp23x17IntGpioFd < 0) {
+		Log_Debug("ERROR: Could not open MCP23017 INTA: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+
+	// Slow poll of GPIOA in case an interrupt is ever missed
+	struct timespec inputSafetyPollPeriod = { 0, INPUT_SAFETY_POLL_NANO_SECONDS };
+	inputSafetyPollTimerFd =
+		CreateTimerFdAndAddToEpoll(epollFd, &inputSafetyPollPeriod, &inputSafetyPollEventData, EPOLLIN);
+	if (inputSafetyPollTimerFd < 0) {
+		return -1;
+	}
+
 	// initialize the temp and humidity
 
 	// lps22hh specific init
@@ -329,6 +426,7 @@ static int InitPeripheralsAndHandlers(void)
 		}
 		else {
 			lps22hhDetected = true;
+			lps22hhReady = true;
 			Log_Debug("LPS22HH Found!\n");
 		}
 
@@ -359,6 +457,12 @@ static int InitPeripheralsAndHandlers(void)
 	// maybe make a symaphore for the longer periodic and write stuff
 	// to limit the fast polling
 
+	struct timespec historyPeriod = { TSDB_INTERVAL_SECONDS, 0 };
+	historyTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &historyPeriod, &historyEventData, EPOLLIN);
+	if (historyTimerFd < 0) {
+		return -1;
+	}
+
 	azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
 	struct timespec azureTelemetryPeriod = { azureIoTPollPeriodSeconds, 0 };
 	azureTimerFd =
@@ -437,7 +541,11 @@ static void SetupAzureClient(void)
 		return;
 	}
 
-	//IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, TwinCallback, NULL);
+	// The twin carries the vote rate limits
+	IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, TwinCallback, NULL);
+
+	// History and diagnostics are asked for, answered from the local aggregates
+	IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, direct_methods_callback, NULL);
 	IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle,
 		HubConnectionStatusCallback, NULL);
 }
@@ -511,6 +619,14 @@ static void ClosePeripheralsAndHandlers(void)
 	//}
 
 	CloseFdAndPrintError(buttonPollTimerFd, "ButtonTimer");
+	CloseFdAndPrintError(inputSafetyPollTimerFd, "InputSafetyPollTimer");
+	CloseFdAndPrintError(mcp23x17IntGpioFd, "Mcp23x17IntA");
+	led_animation_close();
+	vote_log_close();
+	CloseFdAndPrintError(historyTimerFd, "HistoryTimer");
+	tsdb_close();
+	anomaly_close();
+	heatmap_close();
 	CloseFdAndPrintError(azureTimerFd, "AzureTimer");
 	CloseFdAndPrintError(sendMessageButtonGpioFd, "SendMessageButton");
 	//CloseFdAndPrintError(sendOrientationButtonGpioFd, "SendOrientationButton");
@@ -560,48 +676,76 @@ static void SendMessageButtonHandler(void)
 }
 
 /// <summary>
-/// IsInputStateChanged(index)
+/// IsInputStateChanged(panel, index)
 /// Compare the state of the input and report back whether the state has changed from the last time checked
 /// </summary>
-static bool IsInputStateChanged(int index)
+static bool IsInputStateChanged(int panel, int index)
 {
-	bool changed = currentInputState[index].State != previousInputState[index].State;
+	bool changed = panels[panel].currentInputState[index].State != panels[panel].previousInputState[index].State;
 	return changed;
 }
 
 /// <summary>
 /// UpdateButtonLED
-/// Read the current state of the input and update the LEDS of the buttons.
+/// Read the current state of the input and update the LEDS of the buttons.  Only the OLAT
+/// shadow changes here; the button poll flushes it once at the end of the tick.
 /// </summary>
-static void UpdateButtonLED()
+static void UpdateButtonLED(int panel)
 {
-	uint8_t buttonState = 0x007;
+	const struct InputState* currentInputState = panels[panel].currentInputState;
+	uint16_t buttonState = BUTTON_LED_ALL_ON;
 
 	if (currentInputState[0].State)
-		buttonState = buttonState & 0x06U;  // bit 0
+		buttonState = buttonState & 0x0600U;  // bit 0
 
 	if (currentInputState[1].State)
-		buttonState = buttonState & 0x05U;  // bit 1
+		buttonState = buttonState & 0x0500U;  // bit 1
 
 	if (currentInputState[2].State)
-		buttonState = buttonState & 0x03U;  // bit 2
+		buttonState = buttonState & 0x0300U;  // bit 2
+
+	mcp23x17_olat_write(&mcp23x17_devices[panel], BUTTON_LED_ALL_ON, buttonState);
+}
+
+/// <summary>
+/// StopLedAnimation
+/// Somebody is at one of the panels: stop the attract animation and put the button LEDs of every
+/// panel back, since they all show the animation.  Panels already flushed this tick go out on
+/// the next one.
+/// </summary>
+static void StopLedAnimation(void)
+{
+	if (!led_animation_activity()) {
+		return;
+	}
 
-	ssize_t writeRet = mcp23x17_write_reg(&mcp23x17_ctx, MCP23017_GPIOB, &buttonState, 1);
+	for (int panel = 0; panel < mcp23x17_device_count; panel++) {
+		UpdateButtonLED(panel);
+	}
 }
 
 /// <summary>
-/// UpdateMood(index) will increment the vote and re-calculate the current mood.
+/// UpdateMood(vote) will count the vote in the mood store and re-calculate the current mood.
 /// will also set that the display needs to be updated.
 /// </summary>
 static void UpdateMood(int vote)
 {
-	voteTotal += vote;
-	voteCount += 1.0;
-	currentMood = voteTotal/voteCount;
+	mood_counter_t counter = (vote == GREEN_VOTE) ? MOOD_COUNTER_HAPPY :
+		((vote == YELLOW_VOTE) ? MOOD_COUNTER_MEH : MOOD_COUNTER_MAD);
+
+	mood_store_add(counter, time(NULL));
+	vote_log_append(counter, time(NULL));
+	heatmap_add(HEATMAP_VOTES, time(NULL), 1);
+
+	voteCount = (int)mood_totals_votes(mood_store_lifetime());
+	mood_totals_mood(mood_store_lifetime(), &currentMood);
+
+	mood_metrics_vote((uint8_t)vote, time(NULL));
+	mood_metrics_get(&moodMetrics);
 
 	needScreenUpdate = true;
 
-	Log_Debug("Vote Count: %f, Vote Total: %f, Current Mood: %f\n", voteCount, voteTotal, currentMood);
+	Log_Debug("Vote Count: %d, Current Mood: %f\n", voteCount, currentMood);
 }
 
 /// <summary>
@@ -610,10 +754,13 @@ static void UpdateMood(int vote)
 static void UpdatePasserByCount()
 {
 	motionCount++;
+	mood_store_add(MOOD_COUNTER_MOTION, time(NULL));
+	vote_log_append(MOOD_COUNTER_MOTION, time(NULL));
+	heatmap_add(HEATMAP_MOTION, time(NULL), 1);
 
 	needScreenUpdate = true;
 
-	Log_Debug("Passer by count: %f\n", motionCount);
+	Log_Debug("Passer by count: %d\n", motionCount);
 }
 
 /// <summary>
@@ -623,20 +770,45 @@ static void UpdatePasserByCount()
 /// - updates the vote totals
 /// - send message on low input (button press)
 /// <summary>
-static void HandleInput(int index, int isButton)
+static void HandleInput(int panel, int index, int isButton)
 {
-	if (!IsInputStateChanged(index))
+	const struct InputState* currentInputState = panels[panel].currentInputState;
+
+	if (!IsInputStateChanged(panel, index))
 		return;
 
-	UpdateButtonLED();	// will read the current state and update the lights.
+	UpdateButtonLED(panel);	// will read the current state and update the lights.
+
+	uint64_t nowMs = input_capture_now_ns() / 1000000U;
 
 	if (currentInputState[index].State) {
+		// Whether a press counts is decided once, on the way down; a suppressed press sends nothing
+		if (isButton) {
+			rate_limit_reason_t reason = rate_limit_vote((uint8_t)panel, (uint8_t)index, nowMs);
+			panels[panel].admitted[index] = (reason == RATE_LIMIT_ALLOWED);
+			if (reason != RATE_LIMIT_ALLOWED) {
+				Log_Debug("Vote suppressed: %s (panel %d, reason %d).\n", currentInputState[index].ElementName, panel, reason);
+				return;
+			}
+			visit_vote((uint8_t)panel, nowMs);
+		}
+		else {
+			visit_proximity((uint8_t)panel, true, nowMs);
+		}
+
 		//updateTotals(currentInputState[index].Vote);
-		Log_Debug("Button Pressed: %s.\n", currentInputState[index].ElementName);
+		Log_Debug("Button Pressed: %s (panel %d).\n", currentInputState[index].ElementName, panel);
 		SendTelemetry(currentInputState[index].ElementName, "True");
 	}
 	else {
-		Log_Debug("Button Released: %s.\n", currentInputState[index].ElementName);
+		if (isButton && !panels[panel].admitted[index]) {
+			return;
+		}
+		if (!isButton) {
+			visit_proximity((uint8_t)panel, false, nowMs);
+		}
+
+		Log_Debug("Button Released: %s (panel %d).\n", currentInputState[index].ElementName, panel);
 
 		if (isButton) {
 			UpdateMood(currentInputState[index].Vote);
@@ -651,31 +823,26 @@ static void HandleInput(int index, int isButton)
 /// <summary>
 /// RetainPreviousState will copy the current button state to a previous for comparison
 /// </summary>
-static void RetainPreviousState()
+static void RetainPreviousState(int panel)
 {
 	for (size_t i = 0; i < 4; i++)
 	{
-		previousInputState[i].State = currentInputState[i].State;
+		panels[panel].previousInputState[i].State = panels[panel].currentInputState[i].State;
 	}
 }
 
 /// <summary>
-/// UpdateCurrentState will read the current input state then update the currentButtonState
-/// to be used by the rest of the program
+/// UpdateCurrentState will take the debounced port A value (active high) then update the
+/// currentButtonState to be used by the rest of the program
 /// </summary>
-static void UpdateCurrentState()
+static void UpdateCurrentState(int panel, uint8_t inputState)
 {
-	uint8_t inputState = 0x00U;
-
-	// grab the input byte from the MCP23017
-	uint8_t readRet = mcp23x17_read_reg(&mcp23x17_ctx, MCP23017_GPIOA, &inputState, 1);
-
 	uint8_t checkPosition = 0x01U;
 
 	// Shift off the value of each of the bits into the correct position of the state
 	for (size_t i = 0; i < 4; i++)
 	{
-		currentInputState[i].State = checkPosition & inputState ? 0 : 1;
+		panels[panel].currentInputState[i].State = checkPosition & inputState ? 1 : 0;
 
 		// move the checkPosition to what we care about
 		checkPosition <<= 1;
@@ -683,52 +850,537 @@ static void UpdateCurrentState()
 }
 
 /// <summary>
-/// Button timer event:  Check the status of buttons A and B
+/// SetRawPortA will record a GPIOA value read from the MCP23017.  The inputs pull low when active.
+/// </summary>
+static void SetRawPortA(int panel, uint8_t portA)
+{
+	panels[panel].rawInputs = (panels[panel].rawInputs & 0xFF00U) | (uint8_t)~portA;
+}
+
+/// <summary>
+/// InitPanel will configure the expander of a panel and start its inputs from the current state
+/// </summary>
+static void InitPanel(int panel)
+{
+	mcp23x17_ctx_t* device = &mcp23x17_devices[panel];
+
+	// Whole port setup in one burst:
+	// - port A inputs with pull-ups, interrupt on any change (INTCONA = 0 compares
+	//   against the previous value, so DEFVALA is unused)
+	// - port B outputs
+	// - INTA mirrored and active low.  With more than one panel the INTA pins share one GPIO,
+	//   so they are open drain and wire-or'ed.
+	const mcp23x17_config_t portConfig = {
+		.iodir = 0x00FFU,
+		.ipol = 0x0000U,
+		.gpinten = INPUT_INTERRUPT_MASK,
+		.defval = 0x0000U,
+		.intcon = 0x0000U,
+		.iocon = MCP23017_IOCON_MIRROR | ((mcp23x17_device_count > 1) ? MCP23017_IOCON_ODR : 0x00U),
+		.gppu = 0x00FFU
+	};
+	int32_t writeRet = mcp23x17_write_config(device, &portConfig);
+	Log_Debug("writeRet(config 0x%02x): %d\n", device->addr, writeRet);
+
+	// Setup default lights, the first flush always writes
+	mcp23x17_olat_write(device, 0xFFFFU, BUTTON_LED_ALL_ON);
+	writeRet = mcp23x17_olat_flush(device);
+
+	// Debounce the expander inputs on every button poll
+	debounce_init(&panels[panel].debounce, INPUT_BUTTON_DEBOUNCE_POLLS);
+	debounce_set_threshold(&panels[panel].debounce, INPUT_PROXIMITY_MASK, INPUT_PROXIMITY_DEBOUNCE_POLLS);
+	debounce_set_hold(&panels[panel].debounce, INPUT_LONG_PRESS_POLLS, INPUT_REPEAT_POLLS, INPUT_BUTTON_MASK);
+
+	memcpy(panels[panel].previousInputState, defaultInputState, sizeof(defaultInputState));
+	memcpy(panels[panel].currentInputState, defaultInputState, sizeof(defaultInputState));
+	panels[panel].rawInputs = 0x0000U;
+	panels[panel].edgePending = false;
+	memset(panels[panel].admitted, 0, sizeof(panels[panel].admitted));
+	interruptOrder[panel] = (uint8_t)panel;
+
+	uint16_t ports = 0xffffU;
+	int32_t readRet = mcp23x17_readGPIOAB(device, &ports);
+	Log_Debug("readRet(ports): %d\n", readRet);
+	Log_Debug("ports: %0x\n", ports);
+
+	// Start from the current state, this also clears anything pending
+	SetRawPortA(panel, (uint8_t)ports);
+}
+
+/// <summary>
+/// ProcessInputs will apply a debounced port A value and act on any input that changed
+/// </summary>
+static void ProcessInputs(int panel, uint8_t inputState)
+{
+	// break apart the bits
+	RetainPreviousState(panel);
+	UpdateCurrentState(panel, inputState);
+
+	// Send in the array of structs that holds:
+	// - state
+	// - Message to send to Azure
+	// - value to adjust the daily totals if any
+	// - Element Name for Azure
+	// -
+	HandleInput(panel, IDX_GREEN_BTN, 1);
+	HandleInput(panel, IDX_YELLOW_BTN, 1);
+	HandleInput(panel, IDX_RED_BTN, 1);
+	HandleInput(panel, IDX_PROXIMITY, 0);
+
+	// for each in the array that is non-zero then send a message for each
+	// proximity is just a funky button
+
+	// update the screen with a thanks for each with a pause... probably should make that call async
+	// maybe setup an array with the message and have the message pop up over the
+}
+
+/// <summary>
+/// ServiceInputInterrupts will read the expanders while INTA is asserted and queue what they
+/// latched.  The panel that interrupted last is read first, and INTA is sampled again (no bus
+/// traffic) after every panel that had flags set, so one busy panel costs a single burst however
+/// many there are.
+/// </summary>
+static void ServiceInputInterrupts(uint64_t arrivalNs, bool stalled)
+{
+	GPIO_Value_Type intState;
+
+	for (int n = 0; n < mcp23x17_device_count; n++) {
+		int panel = interruptOrder[n];
+		uint8_t intBurst[MCP23017_INT_BURST_LEN];
+
+		if (mcp23x17_read_interrupt_a(&mcp23x17_devices[panel], intBurst) < 0) {
+			continue;
+		}
+
+		if (intBurst[MCP23017_INTFA - MCP23017_INTFA] | intBurst[MCP23017_INTFB - MCP23017_INTFA]) {
+			const input_capture_event_t event = {
+				.arrivalNs = arrivalNs,
+				.panel = (uint8_t)panel,
+				.intf = intBurst[MCP23017_INTFA - MCP23017_INTFA],
+				.intcap = intBurst[MCP23017_INTCAPA - MCP23017_INTFA],
+				.gpio = intBurst[MCP23017_GPIOA - MCP23017_INTFA],
+				.stalled = stalled
+			};
+			input_capture_push(&event);
+
+			// Most likely to interrupt again, check it first next time
+			memmove(&interruptOrder[1], &interruptOrder[0], (size_t)n);
+			interruptOrder[0] = (uint8_t)panel;
+
+			if ((GPIO_GetValue(mcp23x17IntGpioFd, &intState) != 0) || (intState == GPIO_Value_High)) {
+				break;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// DrainInputCapture will hand the queued interrupts to the debouncers.  While a contact bounces
+/// every edge re-asserts INTA, so the live GPIOA value tracks it.  After a stall, a press that
+/// INTCAP latched but that is already over never reached the debouncer, so it is counted here.
+/// </summary>
+static void DrainInputCapture(void)
+{
+	input_capture_event_t event;
+
+	while (input_capture_pop(&event)) {
+		struct Panel* panel = &panels[event.panel];
+
+		SetRawPortA(event.panel, event.gpio);
+
+		if (!panel->edgePending) {
+			panel->edgeNs = event.arrivalNs;
+			panel->edgePending = true;
+		}
+
+		if (event.stalled) {
+			uint8_t debounced = (uint8_t)panel->debounce.state;
+			uint8_t latched = (uint8_t)~event.intcap;
+			uint8_t live = (uint8_t)~event.gpio;
+			uint8_t missed = event.intf & latched & (uint8_t)~live & (uint8_t)~debounced & INPUT_INTERRUPT_MASK;
+
+			if (missed) {
+				Log_Debug("Recovered press from INTCAP: %0x (panel %d)\n", missed, event.panel);
+				StopLedAnimation();
+				ProcessInputs(event.panel, debounced | missed);
+				ProcessInputs(event.panel, debounced);
+				input_capture_record_latency(event.arrivalNs);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Button timer event:  Check INTA of the MCP23017s and the status of button A
 /// </summary>
 static void ButtonPollTimerEventHandler(EventData* eventData)
 {
+	GPIO_Value_Type intState;
+
 	if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
 		terminationRequired = true;
 		return;
 	}
 
-	// test if the mcp is online and active
-	// pull the port A from mcp23017
-	if (!mcp23x17_status) {
+	// test if the mcp is online and has flagged a change (INTA is active low).  Only then go
+	// out on the bus.
+	uint64_t nowNs = input_capture_now_ns();
+	bool stalled = (lastButtonPollNs != 0) && (nowNs - lastButtonPollNs > INPUT_STALL_NS);
+	lastButtonPollNs = nowNs;
+
+	if (!mcp23x17_status && (GPIO_GetValue(mcp23x17IntGpioFd, &intState) == 0) && (intState == GPIO_Value_Low)) {
+		ServiceInputInterrupts(nowNs, stalled);
+	}
+
+	DrainInputCapture();
 
-		// break apart the bits
-		RetainPreviousState();
-		UpdateCurrentState();
+	for (int panel = 0; panel < mcp23x17_device_count; panel++) {
+		// The debouncer runs every poll, so a pin that has gone quiet still gets its stable time
+		debounce_events_t inputEvents;
+		uint16_t debounced = debounce_update(&panels[panel].debounce, panels[panel].rawInputs, &inputEvents);
 
-		// Send in the array of structs that holds:
-		// - state
-		// - Message to send to Azure
-		// - value to adjust the daily totals if any
-		// - Element Name for Azure
-		// -
-		HandleInput(IDX_GREEN_BTN, 1);
-		HandleInput(IDX_YELLOW_BTN, 1);
-		HandleInput(IDX_RED_BTN, 1);
-		HandleInput(IDX_PROXIMITY, 0);
+		if ((inputEvents.pressed | inputEvents.released) & INPUT_INTERRUPT_MASK) {
+			// Somebody is here, hand the LEDs back to the buttons before they get updated
+			StopLedAnimation();
+			ProcessInputs(panel, (uint8_t)debounced);
 
-		// for each in the array that is non-zero then send a message for each
-		// proximity is just a funky button
+			if (panels[panel].edgePending) {
+				input_capture_record_latency(panels[panel].edgeNs);
+				panels[panel].edgePending = false;
+			}
+		}
 
-		// update the screen with a thanks for each with a pause... probably should make that call async
-		// maybe setup an array with the message and have the message pop up over the
+		if (inputEvents.longPress & INPUT_BUTTON_MASK) {
+			Log_Debug("Long press: %0x (panel %d)\n", inputEvents.longPress, panel);
+		}
+		if (inputEvents.repeat) {
+			Log_Debug("Repeat: %0x (panel %d)\n", inputEvents.repeat, panel);
+		}
+
+		// Everything that changed the outputs during this tick goes out in one write
+		mcp23x17_olat_flush(&mcp23x17_devices[panel]);
 	}
 
-	oled_i2c_bus_status(0, currentMood, voteCount, motionCount);
+	if (needScreenUpdate) {
+		oled_i2c_bus_status(0, currentMood, voteCount, motionCount,
+			moodMetrics.ewma[MOOD_EWMA_SHORT], moodMetrics.window);
+		needScreenUpdate = false;
+	}
 
 	SendMessageButtonHandler();
 }
 
+/// <summary>
+/// Input safety poll:  read GPIOA of every panel directly, in case an interrupt was ever missed
+/// </summary>
+static void InputSafetyPollTimerEventHandler(EventData* eventData)
+{
+	if (ConsumeTimerFdEvent(inputSafetyPollTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	for (int panel = 0; panel < mcp23x17_device_count; panel++) {
+		uint16_t ports = 0x0000U;
+
+		if (mcp23x17_readGPIOAB(&mcp23x17_devices[panel], &ports) >= 0) {
+			SetRawPortA(panel, (uint8_t)ports);
+		}
+	}
+}
+
+/// <summary>
+/// ReadEnvironment will read the LPS22HH temperature and pressure through the sensor hub
+/// </summary>
+/// <returns>true if a new sample was read</returns>
+static bool ReadEnvironment(float* temperature_degC, float* pressure_hPa)
+{
+	lps22hh_reg_t lps22hhReg;
+	uint8_t raw[5];
+
+	if (!lps22hhReady || lps22hh_read_reg(&pressure_ctx, LPS22HH_STATUS, (uint8_t*)&lps22hhReg, 1) != 0 ||
+		!lps22hhReg.status.p_da || !lps22hhReg.status.t_da) {
+		return false;
+	}
+
+	// PRESS_OUT_XL through TEMP_OUT_H are consecutive, so read them in one hub operation
+	if (lps22hh_read_reg(&pressure_ctx, LPS22HH_PRESS_OUT_XL, raw, sizeof(raw)) != 0) {
+		return false;
+	}
+
+	*pressure_hPa = lps22hh_from_lsb_to_hpa((uint32_t)raw[0] | ((uint32_t)raw[1] << 8) | ((uint32_t)raw[2] << 16));
+	*temperature_degC = lps22hh_from_lsb_to_celsius((int16_t)(raw[3] | (raw[4] << 8)));
+	return true;
+}
+
+/// <summary>
+/// History timer event:  record one sample of every channel in the time-series store
+/// </summary>
+static void HistoryTimerEventHandler(EventData* eventData)
+{
+	if (ConsumeTimerFdEvent(historyTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	time_t now = time(NULL);
+	mood_totals_t lastMinute;
+	float temperature_degC;
+	float pressure_hPa;
+	WifiConfig_ConnectedNetwork network;
+
+	mood_metrics_tick(now);
+	mood_metrics_get(&moodMetrics);
+	tsdb_append(TSDB_CHANNEL_MOOD, now, (int32_t)(moodMetrics.ewma[MOOD_EWMA_SHORT] * 100.0f + 0.5f));
+
+	// The last whole minute of votes and motion
+	mood_store_tick(now);
+	if (mood_store_period(MOOD_RESOLUTION_MINUTE, 1, &lastMinute)) {
+		tsdb_append(TSDB_CHANNEL_VOTES, now, (int32_t)mood_totals_votes(&lastMinute));
+		tsdb_append(TSDB_CHANNEL_MOTION, now, (int32_t)lastMinute.count[MOOD_COUNTER_MOTION]);
+	}
+	CheckAnomalies(now);
+	heatmap_tick(now);
+
+	if (ReadEnvironment(&temperature_degC, &pressure_hPa)) {
+		tsdb_append(TSDB_CHANNEL_TEMPERATURE, now, (int32_t)(temperature_degC * 10.0f + (temperature_degC < 0 ? -0.5f : 0.5f)));
+		tsdb_append(TSDB_CHANNEL_PRESSURE, now, (int32_t)(pressure_hPa * 10.0f + 0.5f));
+	}
+
+	if (WifiConfig_GetCurrentNetwork(&network) == 0) {
+		tsdb_append(TSDB_CHANNEL_RSSI, now, network.signalRssi);
+	}
+}
+
+/// <summary>
+///     Loads the hour-of-week baselines kept in storage.  Without any (first start, or storage
+///     lost) they are seeded from the hours the mood store kept, so the detector does not start
+///     from nothing.  Empty hours are left out: they may only mean the device was off.
+/// </summary>
+static void SeedAnomalyBaselines(time_t now)
+{
+	uint32_t hour = (uint32_t)(now / 3600);
+	mood_totals_t totals;
+
+	mood_store_tick(now);
+
+	anomalyHour = hour;
+	anomalyHourWhole = false;
+	if (anomaly_open() > 0) {
+		return;
+	}
+
+	for (uint32_t hoursAgo = MOOD_STORE_HOURS - 1; hoursAgo > 0; hoursAgo--) {
+		if (!mood_store_period(MOOD_RESOLUTION_HOUR, hoursAgo, &totals)) {
+			continue;
+		}
+
+		anomaly_sample_t sample = { .votes = mood_totals_votes(&totals),
+			.motion = totals.count[MOOD_COUNTER_MOTION], .mood = 0.0f };
+		if (sample.votes + sample.motion == 0) {
+			continue;
+		}
+		mood_totals_mood(&totals, &sample.mood);
+		anomaly_observe(hour - hoursAgo, &sample, NULL, 0);
+	}
+}
+
+/// <summary>
+///     Once an hour has closed, scores it against its hour of week and sends an alert for every
+///     anomaly.  Hours not watched whole (the one the app started in, or across a clock change)
+///     are skipped.
+/// </summary>
+static void CheckAnomalies(time_t now)
+{
+	uint32_t hour = (uint32_t)(now / 3600);
+	mood_totals_t totals;
+	anomaly_alert_t alerts[ANOMALY_KIND_COUNT];
+	char message[128];
+
+	if (hour == anomalyHour) {
+		return;
+	}
+
+	if (anomalyHourWhole && hour == anomalyHour + 1 && mood_store_period(MOOD_RESOLUTION_HOUR, 1, &totals)) {
+		anomaly_sample_t sample = { .votes = mood_totals_votes(&totals),
+			.motion = totals.count[MOOD_COUNTER_MOTION], .mood = 0.0f };
+		mood_totals_mood(&totals, &sample.mood);
+
+		uint8_t count = anomaly_observe(anomalyHour, &sample, alerts, ANOMALY_KIND_COUNT);
+		for (uint8_t i = 0; i < count; i++) {
+			snprintf(message, sizeof(message),
+				"{\"anomaly\":\"%s\",\"hour\":%u,\"observed\":%.2f,\"expected\":%.2f,\"score\":%.1f}",
+				anomaly_kind_name(alerts[i].kind), alerts[i].hour, alerts[i].observed,
+				alerts[i].expected, alerts[i].score);
+			Log_Debug("Anomaly: %s\n", message);
+
+			if (iothubAuthenticated) {
+				SendMessage(message);
+			}
+		}
+	}
+
+	anomalyHourWhole = (hour == anomalyHour + 1);
+	anomalyHour = hour;
+}
+
+/// <summary>
+///     Loads the heatmap kept in storage and adds the hours the mood store counted since it was
+///     written.  Without one it is rebuilt from the whole week the mood store kept.
+/// </summary>
+static void SeedHeatmap(time_t now)
+{
+	uint32_t hour = (uint32_t)(now / 3600);
+	mood_totals_t totals;
+
+	heatmap_open();
+
+	for (uint32_t hoursAgo = MOOD_STORE_HOURS - 1; ; hoursAgo--) {
+		if (mood_store_period(MOOD_RESOLUTION_HOUR, hoursAgo, &totals)) {
+			time_t start = (time_t)(hour - hoursAgo) * 3600;
+			uint32_t votes = mood_totals_votes(&totals);
+			uint32_t motion = totals.count[MOOD_COUNTER_MOTION];
+
+			heatmap_restore(HEATMAP_VOTES, start, votes);
+			heatmap_restore(HEATMAP_MOTION, start, motion);
+		}
+		if (hoursAgo == 0) {
+			break;
+		}
+	}
+}
+
+/// <summary>
+///     Reports the heatmap as one reported property, both series encoded by heatmap_encode().
+/// </summary>
+static void ReportHeatmap(time_t now)
+{
+	static char motion[HEATMAP_ENCODED_MAX];
+	static char votes[HEATMAP_ENCODED_MAX];
+	static char reportBuffer[2 * HEATMAP_ENCODED_MAX + 160];
+
+	heatmap_encode(HEATMAP_MOTION, motion, sizeof(motion));
+	heatmap_encode(HEATMAP_VOTES, votes, sizeof(votes));
+
+	int len = snprintf(reportBuffer, sizeof(reportBuffer),
+		"{ \"heatmap\": { \"updated\": %lu, \"encoding\": \"delta-zigzag-varint-base64\", "
+		"\"decayShift\": %u, \"motion\": \"%s\", \"votes\": \"%s\" } }",
+		(unsigned long)now, HEATMAP_DECAY_SHIFT, motion, votes);
+	if (len > 0 && len < (int)sizeof(reportBuffer) &&
+		IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle, (const unsigned char*)reportBuffer,
+			(size_t)len, HeatmapReportStatusCallback, NULL) == IOTHUB_CLIENT_OK) {
+		Log_Debug("Heatmap reported: %d bytes\n", len);
+		heatmapReportDueAt = now + HeatmapReportPeriodSeconds;
+	}
+	else {
+		RetryHeatmap(now);
+	}
+}
+
+/// <summary>
+///     Schedules the heatmap report again after the next retry period, doubling it each time.
+/// </summary>
+static void RetryHeatmap(time_t now)
+{
+	if (heatmapRetryPeriodSeconds == 0) {
+		heatmapRetryPeriodSeconds = HeatmapMinRetryPeriodSeconds;
+	}
+	else {
+		heatmapRetryPeriodSeconds *= 2;
+		if (heatmapRetryPeriodSeconds > HeatmapReportPeriodSeconds) {
+			heatmapRetryPeriodSeconds = HeatmapReportPeriodSeconds;
+		}
+	}
+
+	Log_Debug("Heatmap report failed, retrying in %d s\n", heatmapRetryPeriodSeconds);
+	heatmapReportDueAt = now + heatmapRetryPeriodSeconds;
+}
+
+/// <summary>
+///     Reported properties callback for the heatmap: a report the hub did not take is retried
+///     with a backoff, one it took resets the backoff.
+/// </summary>
+static void HeatmapReportStatusCallback(int result, void* context)
+{
+	ReportStatusCallback(result, context);
+	if (result < 200 || result >= 300) {
+		RetryHeatmap(time(NULL));
+	}
+	else {
+		heatmapRetryPeriodSeconds = 0;
+	}
+}
+
+#ifdef ENABLE_STATS_DEBUG
+/// <summary>
+///     Logs the counters getDiagnostics returns, every Azure tick.
+/// </summary>
+static void LogStats(void)
+{
+	rate_limit_stats_t limitStats;
+	rate_limit_get_stats(&limitStats);
+	Log_Debug("Vote limiter: %u allowed, suppressed %u visit / %u button / %u global\n",
+		limitStats.allowed, limitStats.suppressed[RATE_LIMIT_VISIT], limitStats.suppressed[RATE_LIMIT_BUTTON],
+		limitStats.suppressed[RATE_LIMIT_GLOBAL]);
+
+	uint32_t writesIssued = 0;
+	uint32_t writesSuppressed = 0;
+	for (int panel = 0; panel < mcp23x17_device_count; panel++) {
+		writesIssued += mcp23x17_devices[panel].olatWritesIssued;
+		writesSuppressed += mcp23x17_devices[panel].olatWritesSuppressed;
+	}
+	Log_Debug("MCP23x17 output writes issued: %u, suppressed: %u\n", writesIssued, writesSuppressed);
+
+	telemetry_policy_stats_t telemetryStats;
+	telemetry_policy_get_stats(&telemetryStats);
+	Log_Debug("Telemetry: %u messages, %u bytes, %u fields (%u heartbeats); saved %u messages, %u bytes\n",
+		telemetryStats.messagesSent, telemetryStats.bytesSent, telemetryStats.fieldsSent, telemetryStats.heartbeats,
+		telemetryStats.legacyMessages - telemetryStats.messagesSent,
+		telemetryStats.legacyBytes > telemetryStats.bytesSent ? telemetryStats.legacyBytes - telemetryStats.bytesSent : 0);
+
+	input_capture_stats_t captureStats;
+	input_capture_get_stats(&captureStats);
+	Log_Debug("Input capture: %u captured, %u overflows, edge to vote %llu us mean, %llu us max\n",
+		captureStats.captured, captureStats.overflows,
+		captureStats.latencyCount ? captureStats.latencySumNs / captureStats.latencyCount / 1000 : 0ULL,
+		captureStats.latencyMaxNs / 1000);
+
+	vote_log_stats_t logStats;
+	vote_log_get_stats(&logStats);
+	Log_Debug("Vote log: %u records, %u record bytes, %u bytes written (x%.1f), %u checkpoints, %u errors\n",
+		logStats.recordsLogged, logStats.recordBytes, logStats.flashBytes,
+		logStats.recordBytes ? (double)logStats.flashBytes / logStats.recordBytes : 0.0,
+		logStats.checkpoints, logStats.writeErrors);
+
+	tsdb_stats_t historyStats;
+	tsdb_get_stats(&historyStats);
+	Log_Debug("History: %u samples, %.2f bits/sample, %u blocks sealed, %u spilled, %u dropped, %u open blocks saved\n",
+		historyStats.samples, historyStats.samples ? (double)historyStats.encodedBits / historyStats.samples : 0.0,
+		historyStats.sealedBlocks, historyStats.spilledBlocks, historyStats.droppedBlocks, historyStats.savedOpenBlocks);
+
+	anomaly_stats_t anomalyStats;
+	anomaly_get_stats(&anomalyStats);
+	Log_Debug("Anomalies: %u hours scored of %u, %u no traffic, %u motion high, %u PIR silent, %u mood low, %u mood high, %u write errors\n",
+		anomalyStats.hoursScored, anomalyStats.hoursObserved, anomalyStats.alerts[ANOMALY_NO_TRAFFIC],
+		anomalyStats.alerts[ANOMALY_MOTION_HIGH], anomalyStats.alerts[ANOMALY_PIR_SILENT],
+		anomalyStats.alerts[ANOMALY_MOOD_LOW], anomalyStats.alerts[ANOMALY_MOOD_HIGH], anomalyStats.writeErrors);
+
+	led_animation_stats_t animationStats;
+	led_animation_get_stats(&animationStats);
+	if (animationStats.playedMs >= 1000) {
+		Log_Debug("LED animation: %u frames, %u writes, %llu ms shown, %llu ns/s in handler\n",
+			animationStats.framesPlayed, animationStats.busWrites, animationStats.playedMs,
+			animationStats.handlerNs * 1000 / animationStats.playedMs);
+	}
+}
+#endif
+
 /// <summary>
 /// Azure timer event:  Check connection status and send telemetry
 /// </summary>
 static void AzureTimerEventHandler(EventData* eventData)
 {
-	char buf[24] = { 0 };
+	static char telemetryBuffer[512] = { 0 };
 
 	if (ConsumeTimerFdEvent(azureTimerFd) != 0) {
 		terminationRequired = true;
@@ -745,21 +1397,61 @@ static void AzureTimerEventHandler(EventData* eventData)
 		Log_Debug("Failed to get Network state\n");
 	}
 
+	// Keep the mood buckets rolling while nobody votes, and get logged votes out to storage
+	mood_store_tick(time(NULL));
+	vote_log_service(time(NULL));
+	mood_metrics_tick(time(NULL));
+	mood_metrics_get(&moodMetrics);
+	visit_tick(input_capture_now_ns() / 1000000U);
+	visit_funnel_tick(time(NULL));
+
+	rate_limit_stats_t limitStats;
+	rate_limit_get_stats(&limitStats);
+
 	if (iothubAuthenticated) {
-		// this is where all the periodic status of things is sent.
-		snprintf(buf, sizeof(buf), "%f", currentMood);
-		SendTelemetry("currentMood", buf);
+		// this is where all the periodic status of things is sent, each field only when it has
+		// moved or its heartbeat is due, all of them in one message
+		telemetry_policy_set(TELEMETRY_CURRENT_MOOD, currentMood);
+		telemetry_policy_set(TELEMETRY_MOOD_LAST_VOTES, moodMetrics.lastVotes);
+		telemetry_policy_set(TELEMETRY_MOOD_LAST_HOUR, moodMetrics.window);
+		telemetry_policy_set(TELEMETRY_MOOD_RECENT, moodMetrics.ewma[MOOD_EWMA_SHORT]);
+		telemetry_policy_set(TELEMETRY_MOOD_TREND, moodMetrics.ewma[MOOD_EWMA_LONG]);
+		telemetry_policy_set(TELEMETRY_VOTE_COUNT, (float)voteCount);
+		telemetry_policy_set(TELEMETRY_MOTION_COUNT, (float)motionCount);
+		telemetry_policy_set(TELEMETRY_VOTES_SUPPRESSED, (float)(limitStats.suppressed[RATE_LIMIT_VISIT] +
+			limitStats.suppressed[RATE_LIMIT_BUTTON] + limitStats.suppressed[RATE_LIMIT_GLOBAL]));
+
+		// The visit funnel only goes out as one summary per completed hour
+		visit_funnel_summary_t funnel;
+		if (visit_funnel_take_summary(&funnel)) {
+			Log_Debug("Visits in hour %u: %u, %u voted, dwell p50 %u ms, time to vote p50 %u ms\n",
+				funnel.hour, funnel.visits, funnel.converted, funnel.dwellP50Ms, funnel.responseP50Ms);
+
+			telemetry_policy_post(TELEMETRY_VISITS_HOUR, (float)funnel.visits);
+			telemetry_policy_post(TELEMETRY_CONVERSION_HOUR,
+				funnel.visits ? 100.0f * funnel.converted / funnel.visits : 0.0f);
+			telemetry_policy_post(TELEMETRY_DWELL_P50_MS, (float)funnel.dwellP50Ms);
+			telemetry_policy_post(TELEMETRY_TIME_TO_VOTE_P50_MS, (float)funnel.responseP50Ms);
+		}
 
-		snprintf(buf, sizeof(buf), "%d", voteCount);
-		SendTelemetry("voteCount", buf);
+		if (telemetry_policy_build(time(NULL), telemetryBuffer, sizeof(telemetryBuffer)) > 0 &&
+			SendMessage(telemetryBuffer)) {
+			telemetry_policy_sent(time(NULL));
+		}
 
-		snprintf(buf, sizeof(buf), "%d", motionCount);
-		SendTelemetry("motionCount", buf);
+		if (time(NULL) >= heatmapReportDueAt) {
+			ReportHeatmap(time(NULL));
+		}
 
 		IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
 	}
 
-	oled_i2c_bus_status(0, currentMood, voteCount, motionCount);
+#ifdef ENABLE_STATS_DEBUG
+	LogStats();
+#endif
+
+	oled_i2c_bus_status(0, currentMood, voteCount, motionCount,
+		moodMetrics.ewma[MOOD_EWMA_SHORT], moodMetrics.window);
 }
 
 // Azure stuff
@@ -777,17 +1469,28 @@ static void SendTelemetry(const unsigned char* key, const unsigned char* value)
 	if (len < 0)
 		return;
 
-	Log_Debug("Sending IoT Hub Message: %s\n", eventBuffer);
+	SendMessage(eventBuffer);
+}
+
+/// <summary>
+///     Sends a prepared JSON message to IoT Hub
+/// </summary>
+/// <param name="text">The message body</param>
+/// <returns>true if IoTHubClient accepted the message for delivery</returns>
+static bool SendMessage(const char* text)
+{
+	Log_Debug("Sending IoT Hub Message: %s\n", text);
 
-	IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(eventBuffer);
+	IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(text);
 
 	if (messageHandle == 0) {
 		Log_Debug("WARNING: unable to create a new IoTHubMessage\n");
-		return;
+		return false;
 	}
 
-	if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-		/*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
+	bool accepted = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
+		/*&callback_param*/ 0) == IOTHUB_CLIENT_OK;
+	if (!accepted) {
 		Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
 	}
 	else {
@@ -795,6 +1498,7 @@ static void SendTelemetry(const unsigned char* key, const unsigned char* value)
 	}
 
 	IoTHubMessage_Destroy(messageHandle);
+	return accepted;
 }
 
 /// <summary>
@@ -806,3 +1510,129 @@ static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void*
 {
 	Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
 }
+
+/// <summary>
+///     Reads a desired property as a number, either bare (IoT Hub) or as { "value": n } (IoT Central).
+/// </summary>
+/// <returns>true if the property was present</returns>
+static bool GetDesiredNumber(const JSON_Object* desired, const char* key, double* value)
+{
+	JSON_Value* property = json_object_get_value(desired, key);
+
+	if (property == NULL) {
+		return false;
+	}
+	if (json_value_get_type(property) == JSONObject) {
+		property = json_object_get_value(json_value_get_object(property), "value");
+	}
+	if (json_value_get_type(property) == JSONNumber) {
+		*value = json_value_get_number(property);
+		return true;
+	}
+	if (json_value_get_type(property) == JSONBoolean) {
+		*value = json_value_get_boolean(property) ? 1.0 : 0.0;
+		return true;
+	}
+	return false;
+}
+
+/// <summary>
+///     Applies the vote rate limits from the desired properties and reports what is in effect.
+/// </summary>
+static void ApplyRateLimitTwin(const JSON_Object* desired)
+{
+	static const struct {
+		const char* key;
+		size_t offset;
+	} limitKeys[] = {
+		{ "buttonVotesPerMinute", offsetof(rate_limit_config_t, buttonPerMinute) },
+		{ "buttonVoteBurst", offsetof(rate_limit_config_t, buttonBurst) },
+		{ "globalVotesPerMinute", offsetof(rate_limit_config_t, globalPerMinute) },
+		{ "globalVoteBurst", offsetof(rate_limit_config_t, globalBurst) }
+	};
+	rate_limit_config_t config;
+	double value;
+	bool changed = false;
+
+	rate_limit_get_config(&config);
+
+	// A rate or burst of 0 would lock the buttons out for good
+	for (size_t i = 0; i < sizeof(limitKeys) / sizeof(limitKeys[0]); i++) {
+		if (GetDesiredNumber(desired, limitKeys[i].key, &value) && value >= 1.0 && value <= UINT16_MAX) {
+			*(uint16_t*)((uint8_t*)&config + limitKeys[i].offset) = (uint16_t)value;
+			changed = true;
+		}
+	}
+	if (GetDesiredNumber(desired, "visitGapSeconds", &value) && value >= 0.0 && value <= UINT16_MAX) {
+		visit_set_gap((uint16_t)value);
+		changed = true;
+	}
+	if (GetDesiredNumber(desired, "oneVotePerVisit", &value)) {
+		config.oneVotePerVisit = value != 0.0;
+		changed = true;
+	}
+
+	if (!changed) {
+		return;
+	}
+
+	rate_limit_configure(&config);
+	rate_limit_get_config(&config);
+
+	Log_Debug("Vote limits: button %u/min burst %u, global %u/min burst %u, visit gap %us, one per visit %d\n",
+		config.buttonPerMinute, config.buttonBurst, config.globalPerMinute, config.globalBurst,
+		visit_get_gap(), config.oneVotePerVisit);
+
+	static char reportBuffer[200];
+	int len = snprintf(reportBuffer, sizeof(reportBuffer),
+		"{ \"buttonVotesPerMinute\": %u, \"buttonVoteBurst\": %u, \"globalVotesPerMinute\": %u, "
+		"\"globalVoteBurst\": %u, \"visitGapSeconds\": %u, \"oneVotePerVisit\": %s }",
+		config.buttonPerMinute, config.buttonBurst, config.globalPerMinute, config.globalBurst,
+		visit_get_gap(), config.oneVotePerVisit ? "true" : "false");
+	if (len > 0 && len < (int)sizeof(reportBuffer)) {
+		IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle, (const unsigned char*)reportBuffer,
+			(size_t)len, ReportStatusCallback, NULL);
+	}
+}
+
+/// <summary>
+///     Device twin callback: the whole document on connect, the desired properties after that.
+/// </summary>
+static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char* payload,
+	size_t payloadSize, void* userContextCallback)
+{
+	char* json = (char*)malloc(payloadSize + 1);
+	if (json == NULL) {
+		Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
+		return;
+	}
+
+	memcpy(json, payload, payloadSize);
+	json[payloadSize] = 0;
+
+	JSON_Value* root = json_parse_string(json);
+	if (root == NULL) {
+		Log_Debug("WARNING: Cannot parse the twin update as JSON content.\n");
+		free(json);
+		return;
+	}
+
+	JSON_Object* rootObject = json_value_get_object(root);
+	JSON_Object* desired = json_object_dotget_object(rootObject, "desired");
+	if (desired == NULL) {
+		desired = rootObject;
+	}
+
+	ApplyRateLimitTwin(desired);
+
+	json_value_free(root);
+	free(json);
+}
+
+/// <summary>
+///     Callback confirming reported properties were received by IoT Hub.
+/// </summary>
+static void ReportStatusCallback(int result, void* context)
+{
+	Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
+}
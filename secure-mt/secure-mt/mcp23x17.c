@@ -6,7 +6,10 @@
 #include "mcp23x17.h"
 
 uint8_t mcp23x17_buffer[BUFFER_SIZE];
-uint8_t mcp23x17_addr = mcp23x17_DEFAULT_ADDR;
+
+mcp23x17_ctx_t mcp23x17_devices[MCP23X17_MAX_DEVICES];
+uint8_t mcp23x17_device_count = 0;
+uint8_t mcp23x17_status = 1;
 
 ///**
 //  * @brief  Send command to mcp23x17.
@@ -204,18 +207,12 @@ int32_t mcp23x17_read_reg(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data,
  * @param  len       number of consecutive register to read
  *
  */
-static int32_t mcp23x17_read_ctx(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint8_t len)
+static int32_t mcp23x17_read_ctx(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len)
 {
 	ssize_t ret;
-	int test = *((int*)ctx->handle);
-	const uint8_t command[] = { reg, data };
 
-	// Send the data by I2C bus
-	// tried todo this the applibs way instead of the posix way.  I am sure I missed a memo....
-	int targetSet = I2CMaster_SetDefaultTargetAddress(*((int*)ctx->handle), mcp23x17_DEFAULT_ADDR);
-	int targetRegisterWrite = write(*((int*)ctx->handle), &reg, len);
-	ssize_t readRet = read(*((int*)ctx->handle), data, len);
-	ret = readRet;
+	// Send the one byte register address, then read len bytes back with a repeated start
+	ret = I2CMaster_WriteThenRead(*((int*)ctx->handle), ctx->addr, &reg, 1, data, len);
 
 #ifdef ENABLE_READ_WRITE_DEBUG
 	Log_Debug("Read %d bytes: ", len);
@@ -256,27 +253,210 @@ int32_t mcp23x17_write_reg(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data,
  * @param  len       number of consecutive register to write
  *
  */
-static uint8_t mcp23x17_write_ctx(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint8_t len)
+static int32_t mcp23x17_write_ctx(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len)
 {
 	ssize_t ret;
-	const uint8_t command[] = { reg, *data };
+	uint8_t command[MCP23017_MAX_BURST_LEN + 1];
+
+	if (len > MCP23017_MAX_BURST_LEN) {
+		return -1;
+	}
 
-	ret = I2CMaster_Write(*((int*)ctx->handle), mcp23x17_DEFAULT_ADDR, command, sizeof(command));
+	// Register address, then the data; with SEQOP clear the address increments after each byte
+	command[0] = reg;
+	memcpy(&command[1], data, len);
+
+	ret = I2CMaster_Write(*((int*)ctx->handle), ctx->addr, command, (size_t)len + 1);
 
 	return ret;
 }
 
-uint8_t mcp23x17_init(int* i2cFd, uint8_t addr)
+/**
+  * @brief  Read INTFA through GPIOA in one burst.
+  *
+  * @param  ctx   read / write interface definitions
+  * @param  buff  MCP23017_INT_BURST_LEN bytes: INTFA, INTFB, INTCAPA, INTCAPB, GPIOA
+  * @retval       interface status, negative on error
+  *
+  */
+int32_t mcp23x17_read_interrupt_a(mcp23x17_ctx_t* ctx, uint8_t* buff)
+{
+	return mcp23x17_read_reg(ctx, MCP23017_INTFA, buff, MCP23017_INT_BURST_LEN);
+}
+
+/**
+  * @brief  Write the whole port configuration in one burst.
+  *
+  * @param  ctx     read / write interface definitions
+  * @param  config  register values, port A in the low byte of each pair
+  * @retval         interface status, negative on error
+  *
+  */
+int32_t mcp23x17_write_config(mcp23x17_ctx_t* ctx, const mcp23x17_config_t* config)
+{
+	uint8_t burst[MCP23017_CONFIG_BURST_LEN];
+	const uint16_t pairs[] = { config->iodir, config->ipol, config->gpinten, config->defval, config->intcon };
+
+	for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+		burst[2 * i] = (uint8_t)pairs[i];
+		burst[2 * i + 1] = (uint8_t)(pairs[i] >> 8);
+	}
+
+	// The part powers up with BANK = 0, which is the layout this burst is addressed in.  IOCON
+	// appears at both 0x0A and 0x0B, so it is written twice with the same value.
+	uint8_t iocon = (config->iocon & (uint8_t)~(MCP23017_IOCON_BANK | MCP23017_IOCON_SEQOP)) | MCP23017_IOCON_SEQUENTIAL;
+	burst[MCP23017_IOCONA] = iocon;
+	burst[MCP23017_IOCONB] = iocon;
+
+	burst[MCP23017_GPPUA] = (uint8_t)config->gppu;
+	burst[MCP23017_GPPUB] = (uint8_t)(config->gppu >> 8);
+
+	return mcp23x17_write_reg(ctx, MCP23017_IODIRA, burst, MCP23017_CONFIG_BURST_LEN);
+}
+
+/**
+  * @brief  Read GPIOA and GPIOB in one transaction.
+  *
+  * @param  ctx    read / write interface definitions
+  * @param  value  port A in the low byte, port B in the high byte
+  * @retval        interface status, negative on error
+  *
+  */
+int32_t mcp23x17_readGPIOAB(mcp23x17_ctx_t* ctx, uint16_t* value)
+{
+	int32_t ret;
+	uint8_t ports[2];
+
+	ret = mcp23x17_read_reg(ctx, MCP23017_GPIOA, ports, 2);
+	if (ret >= 0) {
+		*value = (uint16_t)(ports[0] | (ports[1] << 8));
+	}
+
+	return ret;
+}
+
+/**
+  * @brief  Write GPIOA and GPIOB in one transaction.
+  *
+  * @param  ctx    read / write interface definitions
+  * @param  value  port A in the low byte, port B in the high byte
+  * @retval        interface status, negative on error
+  *
+  */
+int32_t mcp23x17_writeGPIOAB(mcp23x17_ctx_t* ctx, uint16_t value)
+{
+	uint8_t ports[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+
+	return mcp23x17_write_reg(ctx, MCP23017_GPIOA, ports, 2);
+}
+
+static void mcp23x17_olat_update(mcp23x17_ctx_t* ctx, uint16_t value)
 {
-	mcp23x17_status = 1;
+	ctx->olatShadow = value;
+	ctx->olatPendingChanges++;
+}
+
+void mcp23x17_olat_set(mcp23x17_ctx_t* ctx, uint16_t mask)
+{
+	mcp23x17_olat_update(ctx, ctx->olatShadow | mask);
+}
+
+void mcp23x17_olat_clear(mcp23x17_ctx_t* ctx, uint16_t mask)
+{
+	mcp23x17_olat_update(ctx, ctx->olatShadow & (uint16_t)~mask);
+}
+
+void mcp23x17_olat_toggle(mcp23x17_ctx_t* ctx, uint16_t mask)
+{
+	mcp23x17_olat_update(ctx, ctx->olatShadow ^ mask);
+}
+
+void mcp23x17_olat_write(mcp23x17_ctx_t* ctx, uint16_t mask, uint16_t value)
+{
+	mcp23x17_olat_update(ctx, (ctx->olatShadow & (uint16_t)~mask) | (value & mask));
+}
 
-	mcp23x17_ctx.handle = i2cFd;
-	mcp23x17_ctx.read_reg = mcp23x17_read_ctx;
-	mcp23x17_ctx.write_reg = mcp23x17_write_ctx;
+/**
+  * @brief  Write the OLAT shadow if it changed since the last flush.
+  *
+  * @param  ctx   read / write interface definitions
+  * @retval       interface status, negative on error, 0 if nothing had to be written
+  *
+  */
+int32_t mcp23x17_olat_flush(mcp23x17_ctx_t* ctx)
+{
+	int32_t ret = 0;
+	uint16_t changed = ctx->olatValid ? (ctx->olatShadow ^ ctx->olatWritten) : 0xFFFFU;
+	uint32_t pending = ctx->olatPendingChanges;
+
+	ctx->olatPendingChanges = 0;
 
-	if (addr != 0) {			// if the address is not the default.
-		mcp23x17_addr = addr;
+	if (changed == 0) {
+		ctx->olatWritesSuppressed += pending;
+		return 0;
 	}
 
+	uint8_t ports[2] = { (uint8_t)ctx->olatShadow, (uint8_t)(ctx->olatShadow >> 8) };
+
+	if ((changed & 0x00FFU) == 0) {
+		ret = mcp23x17_write_reg(ctx, MCP23017_OLATB, &ports[1], 1);
+	}
+	else if ((changed & 0xFF00U) == 0) {
+		ret = mcp23x17_write_reg(ctx, MCP23017_OLATA, &ports[0], 1);
+	}
+	else {
+		ret = mcp23x17_write_reg(ctx, MCP23017_OLATA, ports, 2);
+	}
+
+	ctx->olatWritesIssued++;
+	if (pending > 1) {
+		ctx->olatWritesSuppressed += pending - 1;
+	}
+
+	// On failure leave the shadow dirty, so the next flush tries again
+	if (ret >= 0) {
+		ctx->olatWritten = ctx->olatShadow;
+		ctx->olatValid = true;
+	}
+
+	return ret;
+}
+
+uint8_t mcp23x17_init(mcp23x17_ctx_t* ctx, int* i2cFd, uint8_t addr)
+{
+	ctx->handle = i2cFd;
+	ctx->read_reg = mcp23x17_read_ctx;
+	ctx->write_reg = mcp23x17_write_ctx;
+	ctx->addr = (addr != 0) ? addr : mcp23x17_DEFAULT_ADDR;
+
+	ctx->olatShadow = 0x0000U;
+	ctx->olatWritten = 0x0000U;
+	ctx->olatValid = false;
+	ctx->olatPendingChanges = 0;
+	ctx->olatWritesIssued = 0;
+	ctx->olatWritesSuppressed = 0;
+
 	return 0;
 }
+
+uint8_t mcp23x17_scan(int* i2cFd)
+{
+	mcp23x17_device_count = 0;
+
+	for (uint8_t i = 0; i < MCP23X17_MAX_DEVICES; i++) {
+		mcp23x17_ctx_t* ctx = &mcp23x17_devices[mcp23x17_device_count];
+		uint8_t probe = 0x00U;
+
+		mcp23x17_init(ctx, i2cFd, (uint8_t)(mcp23x17_DEFAULT_ADDR + i));
+
+		// IODIRA resets to all inputs; anything that reads back proves an expander is there
+		if (mcp23x17_device_id_get(ctx, &probe) >= 0) {
+			Log_Debug("MCP23X17 found at 0x%02x (IODIRA %02x)\n", ctx->addr, probe);
+			mcp23x17_device_count++;
+		}
+	}
+
+	mcp23x17_status = (mcp23x17_device_count > 0) ? 0 : 1;
+
+	return mcp23x17_device_count;
+}
@@ -5,7 +5,9 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "i2c.h"
+#include "panels.h"
 #include <applibs/i2c.h>
 #include <string.h>
 #include <math.h>
@@ -39,6 +41,28 @@
 
 #define MCP23017_INT_ERR 255
 
+// IOCON bits (IOCONA and IOCONB are the same register)
+#define MCP23017_IOCON_BANK 0x80U		// 1 = registers split by port; 0 = A/B pairs interleaved
+#define MCP23017_IOCON_MIRROR 0x40U		// INTA and INTB both fire for either port
+#define MCP23017_IOCON_SEQOP 0x20U		// 1 = address pointer does not increment
+#define MCP23017_IOCON_DISSLW 0x10U
+#define MCP23017_IOCON_HAEN 0x08U
+#define MCP23017_IOCON_ODR 0x04U		// INT pins open drain
+#define MCP23017_IOCON_INTPOL 0x02U		// INT pins active high
+
+// IOCON for this driver: BANK = 0 keeps the A/B registers of each pair adjacent, SEQOP = 0 lets
+// the address pointer auto-increment, so a pair (or a run of pairs) goes in one transaction.
+#define MCP23017_IOCON_SEQUENTIAL 0x00U
+
+// Length of the burst read that starts at INTFA: INTFA, INTFB, INTCAPA, INTCAPB, GPIOA
+#define MCP23017_INT_BURST_LEN 5
+
+// Length of the configuration burst, IODIRA through GPPUB
+#define MCP23017_CONFIG_BURST_LEN (MCP23017_GPPUB + 1)
+
+// Largest single register burst (the whole BANK = 0 register map)
+#define MCP23017_MAX_BURST_LEN (MCP23017_OLATB + 1)
+
 #define mcp23x17_DEFAULT_ADDR 0x20U
 
 #define BUFFER_SIZE 128/8
@@ -53,10 +77,39 @@ typedef struct {
 	mcp23x17_write_ptr  write_reg;
 	mcp23x17_read_ptr   read_reg;
 	void* handle;
+	uint8_t addr;					// 7-bit I2C address
+
+	// OLATA/OLATB shadow, port A in the low byte.  Changes collect here and go out in one
+	// transaction on mcp23x17_olat_flush(), only if the value differs from what the chip holds.
+	uint16_t olatShadow;
+	uint16_t olatWritten;
+	bool olatValid;					// false until olatWritten matches the chip
+	uint32_t olatPendingChanges;	// set/clear/toggle calls since the last flush
+	uint32_t olatWritesIssued;		// bus transactions actually sent
+	uint32_t olatWritesSuppressed;	// calls that were coalesced or changed nothing
 } mcp23x17_ctx_t;
 
-mcp23x17_ctx_t mcp23x17_ctx;
-uint8_t mcp23x17_status;
+// Device table filled by mcp23x17_scan(), in address order
+extern mcp23x17_ctx_t mcp23x17_devices[MCP23X17_MAX_DEVICES];
+extern uint8_t mcp23x17_device_count;
+
+// 0 once at least one expander answered
+extern uint8_t mcp23x17_status;
+
+/// <summary>
+///     Port configuration, one 16-bit word per register pair: port A in the low byte, port B in
+///     the high byte.  IOCON is a single register; BANK and SEQOP in it are always forced to the
+///     sequential layout.
+/// </summary>
+typedef struct {
+	uint16_t iodir;
+	uint16_t ipol;
+	uint16_t gpinten;
+	uint16_t defval;
+	uint16_t intcon;
+	uint8_t iocon;
+	uint16_t gppu;
+} mcp23x17_config_t;
 
 int32_t mcp23x17_read_reg(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 int32_t mcp23x17_write_reg(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint16_t len);
@@ -64,11 +117,60 @@ int32_t mcp23x17_write_reg(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint
 int32_t mcp23x17_device_id_get(mcp23x17_ctx_t* ctx, uint8_t* buff);
 
 /**
-  * @brief  Initialize mcp23x17.
-  * @param  None.
+  * @brief  Read INTFA, INTFB, INTCAPA, INTCAPB and GPIOA in one burst (IOCON.BANK = 0).
+  *         Reading INTCAPA/GPIOA clears the pending interrupt.
+  * @param  buff: MCP23017_INT_BURST_LEN bytes.
+  * @retval Interface status, negative on error.
+  */
+int32_t mcp23x17_read_interrupt_a(mcp23x17_ctx_t* ctx, uint8_t* buff);
+
+/**
+  * @brief  Write IODIR, IPOL, GPINTEN, DEFVAL, INTCON, IOCON and GPPU for both ports in one burst.
+  * @retval Interface status, negative on error.
+  */
+int32_t mcp23x17_write_config(mcp23x17_ctx_t* ctx, const mcp23x17_config_t* config);
+
+/**
+  * @brief  Read GPIOA and GPIOB in one transaction, port A in the low byte.
+  * @retval Interface status, negative on error.
+  */
+int32_t mcp23x17_readGPIOAB(mcp23x17_ctx_t* ctx, uint16_t* value);
+
+/**
+  * @brief  Write GPIOA and GPIOB in one transaction, port A in the low byte.
+  * @retval Interface status, negative on error.
+  */
+int32_t mcp23x17_writeGPIOAB(mcp23x17_ctx_t* ctx, uint16_t value);
+
+/**
+  * @brief  Output latch shadow.  set/clear/toggle/write only change the shadow; flush sends it.
+  * @param  mask: pins to change, port A in the low byte.
+  */
+void mcp23x17_olat_set(mcp23x17_ctx_t* ctx, uint16_t mask);
+void mcp23x17_olat_clear(mcp23x17_ctx_t* ctx, uint16_t mask);
+void mcp23x17_olat_toggle(mcp23x17_ctx_t* ctx, uint16_t mask);
+void mcp23x17_olat_write(mcp23x17_ctx_t* ctx, uint16_t mask, uint16_t value);
+
+/**
+  * @brief  Send the shadow to OLATA/OLATB if it differs from the last value written, in one
+  *         transaction covering only the port(s) that changed.  Call once per event-loop tick.
+  * @retval Interface status, negative on error, 0 if nothing had to be written.
+  */
+int32_t mcp23x17_olat_flush(mcp23x17_ctx_t* ctx);
+
+/**
+  * @brief  Initialize one mcp23x17 context.
+  * @param  addr: 7-bit address, 0 for the default.
   * @retval None.
   */
-extern uint8_t mcp23x17_init(int* i2cFd, uint8_t addr);
+extern uint8_t mcp23x17_init(mcp23x17_ctx_t* ctx, int* i2cFd, uint8_t addr);
+
+/**
+  * @brief  Probe every address an MCP23017 can have and fill the device table with the ones that
+  *         answer.  An absent address NACKs straight away, so the scan costs 8 short transactions.
+  * @retval Number of devices found.
+  */
+extern uint8_t mcp23x17_scan(int* i2cFd);
 
 
 //	void pinMode(uint8_t p, uint8_t d);
@@ -76,8 +178,6 @@ extern uint8_t mcp23x17_init(int* i2cFd, uint8_t addr);
 //	void pullUp(uint8_t p, uint8_t d);
 //	uint8_t digitalRead(uint8_t p);
 //
-//	void writeGPIOAB(uint16_t);
-//	uint16_t readGPIOAB();
 //	uint8_t readGPIO(uint8_t b);
 //
 //	void setupInterrupts(uint8_t mirroring, uint8_t open, uint8_t polarity);
@@ -0,0 +1,181 @@
+/***************************************************************************************************
+   Name: mood_metrics.c
+
+   "How is the office feeling now" metrics, kept up to date a vote at a time:
+      - the mean of the last N votes, from a ring of scores and its running sum
+      - the mean of the last T minutes, from a queue of per-second sums and counts that is trimmed
+        from the old end as time passes, with running totals
+      - exponentially weighted means with a half-life, decayed by the time since the last update
+        and shrunk towards meh by a small prior so an old mood fades instead of sticking
+****************************************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "mood_metrics.h"
+
+typedef struct {
+	uint32_t second;
+	uint16_t count;
+	uint16_t sum;
+} window_entry_t;
+
+typedef struct {
+	uint32_t halfLifeSeconds;
+	float weight;				// decayed number of votes
+	float sum;					// decayed sum of their scores
+} ewma_state_t;
+
+static uint8_t lastScores[MOOD_METRICS_LAST_VOTES];
+static uint16_t lastHead = 0;
+static uint16_t lastCount = 0;
+static uint32_t lastSum = 0;
+
+static window_entry_t window[MOOD_METRICS_WINDOW_CAPACITY];
+static uint16_t windowHead = 0;			// oldest entry
+static uint16_t windowEntries = 0;
+static uint32_t windowCount = 0;
+static uint32_t windowSum = 0;
+static uint32_t windowEvicted = 0;
+
+static ewma_state_t ewmas[MOOD_EWMA_COUNT];
+static time_t ewmaTime = 0;
+
+static void WindowDropOldest(void)
+{
+	window_entry_t* oldest = &window[windowHead];
+
+	windowCount -= oldest->count;
+	windowSum -= oldest->sum;
+	windowHead = (windowHead + 1) % MOOD_METRICS_WINDOW_CAPACITY;
+	windowEntries--;
+}
+
+static void WindowExpire(time_t now)
+{
+	uint32_t cutoff = (uint32_t)now - MOOD_METRICS_WINDOW_MINUTES * 60;
+
+	while (windowEntries > 0 && (int32_t)(window[windowHead].second - cutoff) <= 0) {
+		WindowDropOldest();
+	}
+}
+
+static void WindowAdd(uint8_t score, time_t now)
+{
+	uint32_t second = (uint32_t)now;
+
+	WindowExpire(now);
+
+	// Votes in the same second (or after the clock stepped back) join the newest entry
+	if (windowEntries > 0) {
+		window_entry_t* newest = &window[(windowHead + windowEntries - 1) % MOOD_METRICS_WINDOW_CAPACITY];
+		if ((int32_t)(second - newest->second) <= 0 && newest->sum <= UINT16_MAX - score) {
+			newest->count++;
+			newest->sum += score;
+			windowCount++;
+			windowSum += score;
+			return;
+		}
+	}
+
+	if (windowEntries == MOOD_METRICS_WINDOW_CAPACITY) {
+		WindowDropOldest();
+		windowEvicted++;
+	}
+
+	window_entry_t* entry = &window[(windowHead + windowEntries) % MOOD_METRICS_WINDOW_CAPACITY];
+	entry->second = second;
+	entry->count = 1;
+	entry->sum = score;
+	windowEntries++;
+	windowCount++;
+	windowSum += score;
+}
+
+static void EwmaDecay(time_t now)
+{
+	if (now <= ewmaTime) {
+		return;
+	}
+
+	float elapsed = (float)(now - ewmaTime);
+	for (int i = 0; i < MOOD_EWMA_COUNT; i++) {
+		float factor = exp2f(-elapsed / (float)ewmas[i].halfLifeSeconds);
+		ewmas[i].weight *= factor;
+		ewmas[i].sum *= factor;
+	}
+	ewmaTime = now;
+}
+
+void mood_metrics_init(time_t now)
+{
+	memset(lastScores, 0, sizeof(lastScores));
+	lastHead = 0;
+	lastCount = 0;
+	lastSum = 0;
+
+	windowHead = 0;
+	windowEntries = 0;
+	windowCount = 0;
+	windowSum = 0;
+	windowEvicted = 0;
+
+	memset(ewmas, 0, sizeof(ewmas));
+	ewmas[MOOD_EWMA_SHORT].halfLifeSeconds = MOOD_METRICS_SHORT_HALF_LIFE_SECONDS;
+	ewmas[MOOD_EWMA_LONG].halfLifeSeconds = MOOD_METRICS_LONG_HALF_LIFE_SECONDS;
+	ewmaTime = now;
+}
+
+void mood_metrics_set_half_life(mood_ewma_t ewma, uint32_t seconds)
+{
+	if (ewma >= MOOD_EWMA_COUNT || seconds == 0) {
+		return;
+	}
+
+	// Settle the time so far at the old rate first
+	EwmaDecay(time(NULL));
+	ewmas[ewma].halfLifeSeconds = seconds;
+}
+
+void mood_metrics_vote(uint8_t score, time_t now)
+{
+	// Last N votes: the oldest score leaves the running sum as the new one enters
+	if (lastCount == MOOD_METRICS_LAST_VOTES) {
+		lastSum -= lastScores[lastHead];
+	}
+	else {
+		lastCount++;
+	}
+	lastScores[lastHead] = score;
+	lastSum += score;
+	lastHead = (lastHead + 1) % MOOD_METRICS_LAST_VOTES;
+
+	WindowAdd(score, now);
+
+	EwmaDecay(now);
+	for (int i = 0; i < MOOD_EWMA_COUNT; i++) {
+		ewmas[i].weight += 1.0f;
+		ewmas[i].sum += score;
+	}
+}
+
+void mood_metrics_tick(time_t now)
+{
+	WindowExpire(now);
+	EwmaDecay(now);
+}
+
+void mood_metrics_get(mood_metrics_t* metrics)
+{
+	metrics->lastVotesCount = lastCount;
+	metrics->lastVotes = lastCount ? (float)lastSum / (float)lastCount : MOOD_METRICS_NEUTRAL;
+
+	metrics->windowCount = (uint16_t)(windowCount > UINT16_MAX ? UINT16_MAX : windowCount);
+	metrics->window = windowCount ? (float)windowSum / (float)windowCount : MOOD_METRICS_NEUTRAL;
+	metrics->windowEvicted = windowEvicted;
+
+	for (int i = 0; i < MOOD_EWMA_COUNT; i++) {
+		metrics->ewma[i] = (ewmas[i].sum + MOOD_METRICS_NEUTRAL * MOOD_METRICS_EWMA_PRIOR) /
+			(ewmas[i].weight + MOOD_METRICS_EWMA_PRIOR);
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Mean over the last this many votes
+#define MOOD_METRICS_LAST_VOTES 50
+
+// Mean over the votes of the last this many minutes
+#define MOOD_METRICS_WINDOW_MINUTES 60
+
+// Seconds with votes the time window can hold; votes within the same second share an entry
+#define MOOD_METRICS_WINDOW_CAPACITY 512
+
+// Default half-lives of the two exponentially weighted means
+#define MOOD_METRICS_SHORT_HALF_LIFE_SECONDS (15 * 60)
+#define MOOD_METRICS_LONG_HALF_LIFE_SECONDS (4 * 60 * 60)
+
+// What every metric reads with no votes behind it (meh)
+#define MOOD_METRICS_NEUTRAL 2.0f
+
+// Weight, in votes, of the neutral prior the weighted means are pulled towards as votes age
+#define MOOD_METRICS_EWMA_PRIOR 1.0f
+
+typedef enum {
+	MOOD_EWMA_SHORT = 0,
+	MOOD_EWMA_LONG,
+	MOOD_EWMA_COUNT
+} mood_ewma_t;
+
+typedef struct {
+	float lastVotes;			// mean of the last MOOD_METRICS_LAST_VOTES votes
+	float window;				// mean of the votes in the last MOOD_METRICS_WINDOW_MINUTES
+	float ewma[MOOD_EWMA_COUNT];
+	uint16_t lastVotesCount;	// votes behind lastVotes
+	uint16_t windowCount;		// votes behind window
+	uint32_t windowEvicted;		// window entries dropped before their time because it was full
+} mood_metrics_t;
+
+void mood_metrics_init(time_t now);
+
+/// <summary>
+///     Changes the half-life of one of the weighted means.  Votes already in it keep the weight
+///     they have; the new rate applies from now on.
+/// </summary>
+void mood_metrics_set_half_life(mood_ewma_t ewma, uint32_t seconds);
+
+/// <summary>
+///     Adds one vote (mad 1, meh 2, happy 3) to every metric.  O(1) apart from expiring window
+///     entries, each of which is only ever expired once.
+/// </summary>
+void mood_metrics_vote(uint8_t score, time_t now);
+
+/// <summary>
+///     Ages the time window and the weighted means to now, so they move with no votes coming in.
+/// </summary>
+void mood_metrics_tick(time_t now);
+
+void mood_metrics_get(mood_metrics_t* metrics);
@@ -0,0 +1,225 @@
+/***************************************************************************************************
+   Name: mood_store.c
+
+   Vote and motion counts bucketed by minute, hour and day.  Rather than counts, each bucket keeps
+   the lifetime totals as they were when the bucket opened, so the totals over any number of
+   recent buckets are the lifetime totals minus one snapshot, and a single bucket is the
+   difference of two neighbours.  Counting an event touches only the lifetime totals.  A ring's
+   buckets cover consecutive periods, so only the head's period is kept.
+****************************************************************************************************/
+
+#include <string.h>
+
+#include "mood_store.h"
+
+typedef struct {
+	mood_totals_t* buckets;		// lifetime totals when each bucket opened
+	uint32_t length;
+	uint32_t seconds;
+	uint32_t head;				// current bucket
+	uint32_t filled;			// buckets holding a period
+	uint32_t period;			// time / ring seconds of the period the head covers
+} mood_ring_t;
+
+static mood_totals_t minuteBuckets[MOOD_STORE_MINUTES];
+static mood_totals_t hourBuckets[MOOD_STORE_HOURS];
+static mood_totals_t dayBuckets[MOOD_STORE_DAYS];
+
+static mood_ring_t rings[MOOD_RESOLUTION_COUNT] = {
+	[MOOD_RESOLUTION_MINUTE] = { minuteBuckets, MOOD_STORE_MINUTES, 60 },
+	[MOOD_RESOLUTION_HOUR] = { hourBuckets, MOOD_STORE_HOURS, 60 * 60 },
+	[MOOD_RESOLUTION_DAY] = { dayBuckets, MOOD_STORE_DAYS, 24 * 60 * 60 }
+};
+
+static mood_totals_t lifetime;
+
+static void SubtractTotals(const mood_totals_t* a, const mood_totals_t* b, mood_totals_t* result)
+{
+	for (int i = 0; i < MOOD_COUNTER_COUNT; i++) {
+		result->count[i] = a->count[i] - b->count[i];
+	}
+}
+
+static void RingReset(mood_ring_t* ring, uint32_t period)
+{
+	ring->head = 0;
+	ring->filled = 1;
+	ring->period = period;
+	ring->buckets[0] = lifetime;
+}
+
+/// <summary>
+///     Opens a bucket for every period between the current one and now.  A jump longer than the
+///     ring (including the clock being set after boot) leaves nothing worth keeping.
+/// </summary>
+static void RingAdvance(mood_ring_t* ring, time_t now)
+{
+	uint32_t period = (uint32_t)(now / ring->seconds);
+	uint32_t current = ring->period;
+
+	// Same period, or the clock stepped back: keep counting into the current bucket
+	if (period <= current) {
+		return;
+	}
+
+	if (period - current >= ring->length) {
+		RingReset(ring, period);
+		return;
+	}
+
+	while (current < period) {
+		current++;
+		ring->head = (ring->head + 1) % ring->length;
+		ring->buckets[ring->head] = lifetime;
+		if (ring->filled < ring->length) {
+			ring->filled++;
+		}
+	}
+	ring->period = period;
+}
+
+void mood_store_init(time_t now)
+{
+	memset(&lifetime, 0, sizeof(lifetime));
+
+	for (int r = 0; r < MOOD_RESOLUTION_COUNT; r++) {
+		RingReset(&rings[r], (uint32_t)(now / rings[r].seconds));
+	}
+}
+
+void mood_store_tick(time_t now)
+{
+	for (int r = 0; r < MOOD_RESOLUTION_COUNT; r++) {
+		RingAdvance(&rings[r], now);
+	}
+}
+
+void mood_store_add(mood_counter_t counter, time_t now)
+{
+	if (counter >= MOOD_COUNTER_COUNT) {
+		return;
+	}
+
+	mood_store_tick(now);
+	lifetime.count[counter]++;
+}
+
+void mood_store_query(mood_resolution_t resolution, uint32_t periods, mood_totals_t* totals)
+{
+	const mood_ring_t* ring = &rings[resolution];
+
+	if (periods == 0) {
+		memset(totals, 0, sizeof(*totals));
+		return;
+	}
+	if (periods > ring->filled) {
+		periods = ring->filled;
+	}
+
+	uint32_t first = (ring->head + ring->length - (periods - 1)) % ring->length;
+	SubtractTotals(&lifetime, &ring->buckets[first], totals);
+}
+
+bool mood_store_period(mood_resolution_t resolution, uint32_t periodsAgo, mood_totals_t* totals)
+{
+	const mood_ring_t* ring = &rings[resolution];
+
+	if (periodsAgo >= ring->filled) {
+		return false;
+	}
+
+	uint32_t index = (ring->head + ring->length - periodsAgo) % ring->length;
+	const mood_totals_t* end = (periodsAgo == 0) ? &lifetime : &ring->buckets[(index + 1) % ring->length];
+
+	SubtractTotals(end, &ring->buckets[index], totals);
+	return true;
+}
+
+const mood_totals_t* mood_store_lifetime(void)
+{
+	return &lifetime;
+}
+
+// Saved image: the lifetime totals, then per ring its head, filled, period and every bucket
+size_t mood_store_state_size(void)
+{
+	size_t size = sizeof(mood_totals_t);
+
+	for (int r = 0; r < MOOD_RESOLUTION_COUNT; r++) {
+		size += 3 * sizeof(uint32_t) + rings[r].length * sizeof(mood_totals_t);
+	}
+	return size;
+}
+
+void mood_store_save(uint8_t* buffer)
+{
+	memcpy(buffer, &lifetime, sizeof(lifetime));
+	buffer += sizeof(lifetime);
+
+	for (int r = 0; r < MOOD_RESOLUTION_COUNT; r++) {
+		const mood_ring_t* ring = &rings[r];
+
+		memcpy(buffer, &ring->head, sizeof(uint32_t));
+		memcpy(buffer + sizeof(uint32_t), &ring->filled, sizeof(uint32_t));
+		memcpy(buffer + 2 * sizeof(uint32_t), &ring->period, sizeof(uint32_t));
+		buffer += 3 * sizeof(uint32_t);
+
+		memcpy(buffer, ring->buckets, ring->length * sizeof(mood_totals_t));
+		buffer += ring->length * sizeof(mood_totals_t);
+	}
+}
+
+bool mood_store_load(const uint8_t* buffer, size_t size)
+{
+	if (size != mood_store_state_size()) {
+		return false;
+	}
+
+	// Check every ring before touching any of them
+	const uint8_t* cursor = buffer + sizeof(mood_totals_t);
+	for (int r = 0; r < MOOD_RESOLUTION_COUNT; r++) {
+		uint32_t head;
+		uint32_t filled;
+
+		memcpy(&head, cursor, sizeof(uint32_t));
+		memcpy(&filled, cursor + sizeof(uint32_t), sizeof(uint32_t));
+		if (head >= rings[r].length || filled == 0 || filled > rings[r].length) {
+			return false;
+		}
+		cursor += 3 * sizeof(uint32_t) + rings[r].length * sizeof(mood_totals_t);
+	}
+
+	memcpy(&lifetime, buffer, sizeof(lifetime));
+	buffer += sizeof(lifetime);
+
+	for (int r = 0; r < MOOD_RESOLUTION_COUNT; r++) {
+		mood_ring_t* ring = &rings[r];
+
+		memcpy(&ring->head, buffer, sizeof(uint32_t));
+		memcpy(&ring->filled, buffer + sizeof(uint32_t), sizeof(uint32_t));
+		memcpy(&ring->period, buffer + 2 * sizeof(uint32_t), sizeof(uint32_t));
+		buffer += 3 * sizeof(uint32_t);
+
+		memcpy(ring->buckets, buffer, ring->length * sizeof(mood_totals_t));
+		buffer += ring->length * sizeof(mood_totals_t);
+	}
+	return true;
+}
+
+uint32_t mood_totals_votes(const mood_totals_t* totals)
+{
+	return totals->count[MOOD_COUNTER_HAPPY] + totals->count[MOOD_COUNTER_MEH] + totals->count[MOOD_COUNTER_MAD];
+}
+
+bool mood_totals_mood(const mood_totals_t* totals, float* mood)
+{
+	uint32_t votes = mood_totals_votes(totals);
+
+	if (votes == 0) {
+		return false;
+	}
+
+	uint32_t score = 3 * totals->count[MOOD_COUNTER_HAPPY] + 2 * totals->count[MOOD_COUNTER_MEH] + totals->count[MOOD_COUNTER_MAD];
+	*mood = (float)score / (float)votes;
+	return true;
+}
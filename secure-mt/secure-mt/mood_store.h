@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Ring lengths; the store is a fixed (MINUTES + HOURS + DAYS) * 20 bytes
+#define MOOD_STORE_MINUTES 120
+#define MOOD_STORE_HOURS 168
+#define MOOD_STORE_DAYS 90
+
+typedef enum {
+	MOOD_COUNTER_HAPPY = 0,
+	MOOD_COUNTER_MEH,
+	MOOD_COUNTER_MAD,
+	MOOD_COUNTER_MOTION,
+	MOOD_COUNTER_COUNT
+} mood_counter_t;
+
+typedef enum {
+	MOOD_RESOLUTION_MINUTE = 0,
+	MOOD_RESOLUTION_HOUR,
+	MOOD_RESOLUTION_DAY,
+	MOOD_RESOLUTION_COUNT
+} mood_resolution_t;
+
+typedef struct {
+	uint32_t count[MOOD_COUNTER_COUNT];
+} mood_totals_t;
+
+void mood_store_init(time_t now);
+
+/// <summary>
+///     Counts one vote or motion event.  O(1) apart from opening buckets the clock has moved into.
+/// </summary>
+void mood_store_add(mood_counter_t counter, time_t now);
+
+/// <summary>
+///     Rolls the rings forward to now, so periods without events still get their (empty) buckets.
+/// </summary>
+void mood_store_tick(time_t now);
+
+/// <summary>
+///     Totals over the last `periods` periods of the given resolution, the current partial period
+///     included.  Answered in O(1) from two cumulative snapshots; asking for more than the ring
+///     holds returns what the ring holds.
+/// </summary>
+void mood_store_query(mood_resolution_t resolution, uint32_t periods, mood_totals_t* totals);
+
+/// <summary>
+///     Totals for one whole period, `periodsAgo` periods before the current one (0 = current).
+/// </summary>
+/// <returns>false if that period is no longer in the ring</returns>
+bool mood_store_period(mood_resolution_t resolution, uint32_t periodsAgo, mood_totals_t* totals);
+
+/// <summary>
+///     Everything counted since boot, or since the first boot once a saved state has been loaded.
+/// </summary>
+const mood_totals_t* mood_store_lifetime(void);
+
+/// <summary>
+///     Size of the flat image written by mood_store_save, for sizing checkpoint buffers.
+/// </summary>
+size_t mood_store_state_size(void);
+
+/// <summary>
+///     Copies the lifetime totals and all three rings into buffer (mood_store_state_size bytes).
+/// </summary>
+void mood_store_save(uint8_t* buffer);
+
+/// <summary>
+///     Replaces the store with an image from mood_store_save.  The rings then roll forward from the
+///     saved periods on the next add or tick.
+/// </summary>
+/// <returns>false if the image is inconsistent, in which case the store is left untouched</returns>
+bool mood_store_load(const uint8_t* buffer, size_t size);
+
+uint32_t mood_totals_votes(const mood_totals_t* totals);
+
+/// <summary>
+///     Mean mood of the totals on the vote scale (mad 1, meh 2, happy 3).
+/// </summary>
+/// <returns>false if there were no votes</returns>
+bool mood_totals_mood(const mood_totals_t* totals, float* mood);
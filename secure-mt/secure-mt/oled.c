@@ -105,9 +105,11 @@ void update_oled()
   * @brief  Template to show I2C bus status
   * @param  sensor_number: Sensor number
   * @param  sensor_status: Sensor status
+  * @param  recentMood: Short half-life weighted mood
+  * @param  hourMood: Mean mood of the last hour's votes
   * @retval None.
   */
-void oled_i2c_bus_status(uint8_t sensor_number, float currentMood, int voteCount, int motionCount)
+void oled_i2c_bus_status(uint8_t sensor_number, float currentMood, int voteCount, int motionCount, float recentMood, float hourMood)
 {
 	char buf[48] = {0};
 
@@ -143,6 +145,10 @@ void oled_i2c_bus_status(uint8_t sensor_number, float currentMood, int voteCount
 			snprintf(buf, sizeof(buf), "%d", voteCount);
 			sd1306_draw_string(sizeof(totalVoteMessage) * 6, OLED_LINE_3_Y, buf, FONT_SIZE_LINE, white_pixel);
 
+			// Draw the recent mood: weighted "now" and the last hour
+			snprintf(buf, sizeof(buf), "Now: %.2f  1h: %.2f", recentMood, hourMood);
+			sd1306_draw_string(OLED_LINE_4_X, OLED_LINE_4_Y, buf, FONT_SIZE_LINE, white_pixel);
+
 			// Draw the amount of movement detected label
 			sd1306_draw_string(OLED_LINE_5_X, OLED_LINE_5_Y, motionSeen, FONT_SIZE_LINE, white_pixel);
 			if (motionCount >= 0) {
@@ -0,0 +1,4 @@
+#pragma once
+
+// One voting panel per MCP23x17: A0..A2 select one of 8 addresses from the default up
+#define MCP23X17_MAX_DEVICES 8
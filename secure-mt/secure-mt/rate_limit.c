@@ -0,0 +1,135 @@
+/***************************************************************************************************
+   Name: rate_limit.c
+
+   Keeps one person mashing a button from counting as a crowd.  Every button of every panel has a
+   token bucket, all of them share a global one, and a panel only takes one vote per visit, as
+   visit.c segments them.  Buckets are refilled lazily from the elapsed time when they are checked, in
+   units of 1/60000 of a token so a per-minute rate over milliseconds stays exact in integers.
+****************************************************************************************************/
+
+#include <string.h>
+
+#include "rate_limit.h"
+#include "visit.h"
+
+// One token in bucket units: rate per minute * ms elapsed adds exactly
+#define TOKEN_UNITS 60000U
+
+typedef struct {
+	uint32_t level;				// tokens * TOKEN_UNITS
+	uint64_t lastMs;
+} bucket_t;
+
+static rate_limit_config_t limits = {
+	.buttonPerMinute = RATE_LIMIT_BUTTON_PER_MINUTE,
+	.buttonBurst = RATE_LIMIT_BUTTON_BURST,
+	.globalPerMinute = RATE_LIMIT_GLOBAL_PER_MINUTE,
+	.globalBurst = RATE_LIMIT_GLOBAL_BURST,
+	.oneVotePerVisit = true
+};
+
+static bucket_t buttonBuckets[MCP23X17_MAX_DEVICES][RATE_LIMIT_BUTTONS];
+static bucket_t globalBucket;
+
+static rate_limit_stats_t limitStats;
+
+static void BucketFill(bucket_t* bucket, uint16_t burst, uint64_t nowMs)
+{
+	bucket->level = burst * TOKEN_UNITS;
+	bucket->lastMs = nowMs;
+}
+
+static void BucketRefill(bucket_t* bucket, uint16_t perMinute, uint16_t burst, uint64_t nowMs)
+{
+	uint32_t capacity = burst * TOKEN_UNITS;
+
+	// The burst may have been lowered since the bucket was last touched
+	if (bucket->level > capacity) {
+		bucket->level = capacity;
+	}
+
+	if (nowMs > bucket->lastMs) {
+		uint64_t added = (nowMs - bucket->lastMs) * perMinute;
+		bucket->level = (added >= capacity - bucket->level) ? capacity : bucket->level + (uint32_t)added;
+		bucket->lastMs = nowMs;
+	}
+	else if (nowMs < bucket->lastMs) {
+		bucket->lastMs = nowMs;
+	}
+}
+
+void rate_limit_init(uint64_t nowMs)
+{
+	for (int panel = 0; panel < MCP23X17_MAX_DEVICES; panel++) {
+		for (int button = 0; button < RATE_LIMIT_BUTTONS; button++) {
+			BucketFill(&buttonBuckets[panel][button], limits.buttonBurst, nowMs);
+		}
+	}
+	BucketFill(&globalBucket, limits.globalBurst, nowMs);
+
+	memset(&limitStats, 0, sizeof(limitStats));
+}
+
+void rate_limit_configure(const rate_limit_config_t* config)
+{
+	limits = *config;
+
+	if (limits.buttonPerMinute == 0) {
+		limits.buttonPerMinute = 1;
+	}
+	if (limits.globalPerMinute == 0) {
+		limits.globalPerMinute = 1;
+	}
+	if (limits.buttonBurst == 0) {
+		limits.buttonBurst = 1;
+	}
+	if (limits.globalBurst == 0) {
+		limits.globalBurst = 1;
+	}
+}
+
+void rate_limit_get_config(rate_limit_config_t* config)
+{
+	*config = limits;
+}
+
+rate_limit_reason_t rate_limit_vote(uint8_t panel, uint8_t button, uint64_t nowMs)
+{
+	rate_limit_reason_t reason = RATE_LIMIT_ALLOWED;
+
+	if (panel >= MCP23X17_MAX_DEVICES || button >= RATE_LIMIT_BUTTONS) {
+		return RATE_LIMIT_BUTTON;
+	}
+
+	bucket_t* bucket = &buttonBuckets[panel][button];
+
+	BucketRefill(bucket, limits.buttonPerMinute, limits.buttonBurst, nowMs);
+	BucketRefill(&globalBucket, limits.globalPerMinute, limits.globalBurst, nowMs);
+
+	// Nothing is taken unless the vote passes every check
+	if (limits.oneVotePerVisit && visit_has_voted(panel, nowMs)) {
+		reason = RATE_LIMIT_VISIT;
+	}
+	else if (bucket->level < TOKEN_UNITS) {
+		reason = RATE_LIMIT_BUTTON;
+	}
+	else if (globalBucket.level < TOKEN_UNITS) {
+		reason = RATE_LIMIT_GLOBAL;
+	}
+
+	if (reason != RATE_LIMIT_ALLOWED) {
+		limitStats.suppressed[reason]++;
+		return reason;
+	}
+
+	bucket->level -= TOKEN_UNITS;
+	globalBucket.level -= TOKEN_UNITS;
+	limitStats.allowed++;
+
+	return RATE_LIMIT_ALLOWED;
+}
+
+void rate_limit_get_stats(rate_limit_stats_t* stats)
+{
+	*stats = limitStats;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "panels.h"
+
+// Vote buttons per panel that get their own bucket
+#define RATE_LIMIT_BUTTONS 3
+
+// Defaults, all changeable from the device twin
+#define RATE_LIMIT_BUTTON_PER_MINUTE 6		// sustained votes per minute on one button
+#define RATE_LIMIT_BUTTON_BURST 3			// votes one button takes back to back
+#define RATE_LIMIT_GLOBAL_PER_MINUTE 60		// sustained votes per minute over every panel
+#define RATE_LIMIT_GLOBAL_BURST 20
+
+typedef enum {
+	RATE_LIMIT_ALLOWED = 0,
+	RATE_LIMIT_VISIT,		// this visit has already voted
+	RATE_LIMIT_BUTTON,		// the button's bucket is empty
+	RATE_LIMIT_GLOBAL,		// the shared bucket is empty
+	RATE_LIMIT_REASON_COUNT
+} rate_limit_reason_t;
+
+typedef struct {
+	uint16_t buttonPerMinute;
+	uint16_t buttonBurst;
+	uint16_t globalPerMinute;
+	uint16_t globalBurst;
+	bool oneVotePerVisit;
+} rate_limit_config_t;
+
+typedef struct {
+	uint32_t allowed;
+	uint32_t suppressed[RATE_LIMIT_REASON_COUNT];	// indexed by reason, [RATE_LIMIT_ALLOWED] unused
+} rate_limit_stats_t;
+
+void rate_limit_init(uint64_t nowMs);
+
+/// <summary>
+///     Applies new limits.  Buckets keep what they hold, clipped to the new burst sizes.  Rates
+///     and bursts below 1 are raised to 1: a bucket that never refills would lock its button out.
+/// </summary>
+void rate_limit_configure(const rate_limit_config_t* config);
+void rate_limit_get_config(rate_limit_config_t* config);
+
+/// <summary>
+///     Decides whether a button press counts as a vote and, if so, takes its tokens.  Constant
+///     time: refills are computed from the time since the bucket was last touched.  With one vote
+///     per visit, a press while the panel's open visit (see visit.h) has its vote is suppressed.
+/// </summary>
+rate_limit_reason_t rate_limit_vote(uint8_t panel, uint8_t button, uint64_t nowMs);
+
+void rate_limit_get_stats(rate_limit_stats_t* stats);
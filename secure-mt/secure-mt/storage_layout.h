@@ -0,0 +1,21 @@
+#pragma once
+
+#include "hour_of_week.h"
+#include "vote_log.h"
+
+// The mutable storage file, MutableStorage SizeKB in app_manifest.json.  Its budget, in order:
+//
+//   vote log      14736   two 6144 byte checkpoint slots, 2048 bytes of log and 400 of margin
+//   anomaly        5376   one 32 byte record per hour of week
+//   heatmap        1392   two 696 byte images written alternately, once an hour
+//   tsdb          44032   512 byte blocks: one open block per channel, then 80 sealed
+#define STORAGE_FILE_SIZE (64 * 1024)
+
+#define ANOMALY_STORAGE_START VOTE_LOG_REGION_SIZE
+#define ANOMALY_STORAGE_SIZE (HOURS_OF_WEEK * 32)
+
+#define HEATMAP_STORAGE_START (ANOMALY_STORAGE_START + ANOMALY_STORAGE_SIZE)
+#define HEATMAP_STORAGE_SIZE (2 * 696)
+
+#define TSDB_STORAGE_START (HEATMAP_STORAGE_START + HEATMAP_STORAGE_SIZE)
+#define TSDB_STORAGE_END STORAGE_FILE_SIZE
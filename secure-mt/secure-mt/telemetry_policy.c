@@ -0,0 +1,199 @@
+/***************************************************************************************************
+   Name: telemetry_policy.c
+
+   Decides what telemetry is worth a message.  Each periodic field has a deadband, a minimum
+   interval between reports and the shared heartbeat as its maximum; a tick sends only the fields
+   that are due, merged into one message, and nothing at all when a quiet kiosk has nothing new.
+   The stats keep what the old currentMood, voteCount and motionCount messages of every tick would
+   have cost alongside what was actually sent.
+****************************************************************************************************/
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "telemetry_policy.h"
+
+typedef struct {
+	const char* key;
+	float deadband;				// change that counts; 0 reports any change
+	uint16_t minIntervalSeconds;
+	uint8_t decimals;
+	bool event;
+	bool legacy;				// had a message of its own every tick before this policy
+} field_config_t;
+
+typedef struct {
+	float value;
+	float sentValue;
+	time_t sentAt;
+	bool valid;					// set or posted since init
+	bool sent;					// sentValue holds something
+	bool posted;				// event waiting for the next message
+	bool built;					// in the last message built, not yet known to be sent
+	bool builtHeartbeat;
+	float builtValue;
+} field_state_t;
+
+static const field_config_t fieldConfigs[TELEMETRY_FIELD_COUNT] = {
+	[TELEMETRY_CURRENT_MOOD] = { "currentMood", 0.01f, 5, 2, false, true },
+	[TELEMETRY_MOOD_LAST_VOTES] = { "moodLastVotes", 0.05f, 30, 2, false },
+	[TELEMETRY_MOOD_LAST_HOUR] = { "moodLastHour", 0.05f, 30, 2, false },
+	[TELEMETRY_MOOD_RECENT] = { "moodRecent", 0.05f, 30, 2, false },
+	[TELEMETRY_MOOD_TREND] = { "moodTrend", 0.02f, 60, 2, false },
+	[TELEMETRY_VOTE_COUNT] = { "voteCount", 0.0f, 5, 0, false, true },
+	[TELEMETRY_MOTION_COUNT] = { "motionCount", 0.0f, 30, 0, false, true },
+	[TELEMETRY_VOTES_SUPPRESSED] = { "votesSuppressed", 0.0f, 60, 0, false },
+	[TELEMETRY_VISITS_HOUR] = { "visitsHour", 0.0f, 0, 0, true },
+	[TELEMETRY_CONVERSION_HOUR] = { "conversionHour", 0.0f, 0, 1, true },
+	[TELEMETRY_DWELL_P50_MS] = { "dwellP50Ms", 0.0f, 0, 0, true },
+	[TELEMETRY_TIME_TO_VOTE_P50_MS] = { "timeToVoteP50Ms", 0.0f, 0, 0, true },
+};
+
+static field_state_t fieldStates[TELEMETRY_FIELD_COUNT];
+static size_t builtLength = 0;
+static telemetry_policy_stats_t stats;
+
+static bool IsDue(const field_config_t* config, const field_state_t* state, time_t now, bool* heartbeat)
+{
+	*heartbeat = false;
+
+	if (config->event) {
+		return state->posted;
+	}
+	if (!state->valid) {
+		return false;
+	}
+	if (!state->sent) {
+		return true;
+	}
+
+	time_t elapsed = now - state->sentAt;
+
+	if (elapsed >= TELEMETRY_HEARTBEAT_SECONDS) {
+		*heartbeat = (fabsf(state->value - state->sentValue) <= config->deadband);
+		return true;
+	}
+	return elapsed >= config->minIntervalSeconds &&
+		fabsf(state->value - state->sentValue) > config->deadband;
+}
+
+static void ClearBuilt(void)
+{
+	for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+		fieldStates[field].built = false;
+	}
+	builtLength = 0;
+}
+
+void telemetry_policy_init(void)
+{
+	memset(fieldStates, 0, sizeof(fieldStates));
+	builtLength = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void telemetry_policy_set(telemetry_field_t field, float value)
+{
+	if (field >= TELEMETRY_FIELD_COUNT || fieldConfigs[field].event) {
+		return;
+	}
+
+	fieldStates[field].value = value;
+	fieldStates[field].valid = true;
+}
+
+void telemetry_policy_post(telemetry_field_t field, float value)
+{
+	if (field >= TELEMETRY_FIELD_COUNT || !fieldConfigs[field].event) {
+		return;
+	}
+
+	fieldStates[field].value = value;
+	fieldStates[field].valid = true;
+	fieldStates[field].posted = true;
+}
+
+size_t telemetry_policy_build(time_t now, char* buffer, size_t size)
+{
+	size_t length = 0;
+	int written;
+
+	ClearBuilt();
+
+	if (size < 3) {
+		return 0;
+	}
+
+	buffer[length++] = '{';
+
+	for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+		const field_config_t* config = &fieldConfigs[field];
+		field_state_t* state = &fieldStates[field];
+
+		if (config->legacy && state->valid) {
+			stats.legacyMessages++;
+			written = snprintf(NULL, 0, "{ \"%s\": \"%f\" }", config->key, state->value);
+			stats.legacyBytes += (written > 0) ? (uint32_t)written : 0;
+		}
+
+		state->built = IsDue(config, state, now, &state->builtHeartbeat);
+		if (!state->built) {
+			continue;
+		}
+		state->builtValue = state->value;
+
+		written = snprintf(buffer + length, size - length, "%s\"%s\":%.*f", (length > 1) ? "," : "",
+			config->key, config->decimals, state->value);
+		if (written < 0 || (size_t)written >= size - length - 1) {
+			ClearBuilt();
+			buffer[0] = '\0';
+			return 0;
+		}
+		length += (size_t)written;
+	}
+
+	if (length == 1) {
+		buffer[0] = '\0';
+		return 0;
+	}
+
+	buffer[length++] = '}';
+	buffer[length] = '\0';
+
+	builtLength = length;
+	return length;
+}
+
+void telemetry_policy_sent(time_t now)
+{
+	if (builtLength == 0) {
+		return;
+	}
+
+	for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+		field_state_t* state = &fieldStates[field];
+
+		if (!state->built) {
+			continue;
+		}
+
+		state->sentValue = state->builtValue;
+		state->sentAt = now;
+		state->sent = true;
+		state->posted = false;
+		stats.fieldsSent++;
+		if (state->builtHeartbeat) {
+			stats.heartbeats++;
+		}
+	}
+
+	stats.messagesSent++;
+	stats.bytesSent += (uint32_t)builtLength;
+	ClearBuilt();
+}
+
+void telemetry_policy_get_stats(telemetry_policy_stats_t* policyStats)
+{
+	*policyStats = stats;
+}
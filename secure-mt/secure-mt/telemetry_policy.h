@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Longest a periodic field goes unreported, changed or not, so the cloud can tell the device is alive
+#define TELEMETRY_HEARTBEAT_SECONDS (15 * 60)
+
+typedef enum {
+	// Periodic: reported when they move past their deadband, and at least every heartbeat
+	TELEMETRY_CURRENT_MOOD = 0,
+	TELEMETRY_MOOD_LAST_VOTES,
+	TELEMETRY_MOOD_LAST_HOUR,
+	TELEMETRY_MOOD_RECENT,
+	TELEMETRY_MOOD_TREND,
+	TELEMETRY_VOTE_COUNT,
+	TELEMETRY_MOTION_COUNT,
+	TELEMETRY_VOTES_SUPPRESSED,
+
+	// Events: reported once each time they are posted
+	TELEMETRY_VISITS_HOUR,
+	TELEMETRY_CONVERSION_HOUR,
+	TELEMETRY_DWELL_P50_MS,
+	TELEMETRY_TIME_TO_VOTE_P50_MS,
+	TELEMETRY_FIELD_COUNT
+} telemetry_field_t;
+
+typedef struct {
+	uint32_t messagesSent;
+	uint32_t bytesSent;
+	uint32_t fieldsSent;
+	uint32_t heartbeats;		// fields sent only because their heartbeat was due
+	uint32_t legacyMessages;	// what the old currentMood, voteCount and motionCount messages every tick would have sent
+	uint32_t legacyBytes;
+} telemetry_policy_stats_t;
+
+void telemetry_policy_init(void);
+
+/// <summary>
+///     Updates a periodic field.  Whether it goes out is decided by telemetry_policy_build().
+/// </summary>
+void telemetry_policy_set(telemetry_field_t field, float value);
+
+/// <summary>
+///     Queues an event field for the next message.
+/// </summary>
+void telemetry_policy_post(telemetry_field_t field, float value);
+
+/// <summary>
+///     Merges every field that is due into one JSON object: periodic fields that moved past their
+///     deadband and are outside their minimum interval, those whose heartbeat is due, and posted
+///     events.  Nothing is taken as sent until telemetry_policy_sent(); a message that could not
+///     be handed over is built again next time.  Call once per telemetry tick.
+/// </summary>
+/// <returns>the message length, or 0 if nothing is due (or it would not fit)</returns>
+size_t telemetry_policy_build(time_t now, char* buffer, size_t size);
+
+/// <summary>
+///     The message from the last telemetry_policy_build() was accepted for delivery: its fields
+///     restart their deadband, interval and heartbeat from now, and its events are cleared.
+/// </summary>
+void telemetry_policy_sent(time_t now);
+
+void telemetry_policy_get_stats(telemetry_policy_stats_t* stats);
@@ -0,0 +1,189 @@
+/***************************************************************************************************
+   Name: bench_vote_log.c
+
+   Measures the vote log against a temporary file standing in for the mutable storage file.
+   Recovery: the log is filled to a given length without a checkpoint, then reopened, and the
+   time and bytes it takes to restore the mood store are reported against that length.  Write
+   amplification: a day of kiosk traffic is logged with the Azure tick's housekeeping, and the
+   bytes written are compared to the 2 bytes a record needs.  The Makefile builds this once per
+   checkpoint size.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "vote_log.h"
+#include "mood_store.h"
+#include "input_capture.h"
+
+// As big as the app's mutable storage
+#define STORAGE_SIZE (64 * 1024)
+
+// Reopens averaged for each recovery time
+#define RECOVERY_ROUNDS 20
+
+// A day at a busy kiosk: an event every ~20 s, housekeeping on the 5 s Azure tick
+#define DAY_SECONDS (24 * 3600)
+#define TICK_SECONDS 5
+#define EVENT_EVERY_SECONDS 20
+
+#define START_TIME 1700000000
+
+static char storagePath[] = "/tmp/vote_log_XXXXXX";
+
+int Log_Debug(const char* fmt, ...)
+{
+	return 0;
+}
+
+int Storage_OpenMutableFile(void)
+{
+	return open(storagePath, O_RDWR);
+}
+
+uint64_t input_capture_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void ResetStorage(void)
+{
+	int fd = open(storagePath, O_RDWR | O_TRUNC);
+	if (fd < 0 || ftruncate(fd, STORAGE_SIZE) != 0) {
+		printf("FAIL: cannot reset %s\n", storagePath);
+		exit(1);
+	}
+	close(fd);
+}
+
+static uint32_t LifetimeEvents(void)
+{
+	const mood_totals_t* lifetime = mood_store_lifetime();
+	uint32_t events = 0;
+
+	for (int counter = 0; counter < MOOD_COUNTER_COUNT; counter++) {
+		events += lifetime->count[counter];
+	}
+	return events;
+}
+
+/// <summary>
+///     Logs records events without a checkpoint, then times reopening the log.
+/// </summary>
+/// <returns>0 if every record came back</returns>
+static int BenchRecovery(uint32_t records)
+{
+	vote_log_stats_t before, after;
+	uint64_t totalNs = 0;
+	uint32_t bytes = 0;
+	int failures = 0;
+
+	ResetStorage();
+	mood_store_init(START_TIME);
+	vote_log_open(START_TIME);
+	for (uint32_t i = 0; i < records; i++) {
+		mood_counter_t counter = (mood_counter_t)(i % MOOD_COUNTER_COUNT);
+		mood_store_add(counter, START_TIME + i);
+		vote_log_append(counter, START_TIME + i);
+	}
+	vote_log_close();
+
+	for (int round = 0; round < RECOVERY_ROUNDS; round++) {
+		vote_log_get_stats(&before);
+		mood_store_init(START_TIME + records);
+		vote_log_open(START_TIME + records);
+		vote_log_get_stats(&after);
+		vote_log_close();
+
+		totalNs += after.recoveryNs;
+		bytes = after.recoveredBytes - before.recoveredBytes;
+		if (after.recoveredRecords - before.recoveredRecords != records || LifetimeEvents() != records) {
+			failures++;
+		}
+	}
+
+	printf("  %5u records  %6u log bytes read  %7.1f us\n", records, bytes,
+		(double)totalNs / RECOVERY_ROUNDS / 1000.0);
+	if (failures) {
+		printf("FAIL: %u records logged, %u came back\n", records, LifetimeEvents());
+	}
+	return failures;
+}
+
+/// <summary>
+///     Logs a day of traffic with the periodic housekeeping and reports bytes written per record.
+/// </summary>
+/// <returns>0 if the day survives a reopen</returns>
+static int BenchWriteAmplification(void)
+{
+	vote_log_stats_t before, after;
+	uint32_t events = 0;
+	uint32_t random = 1;
+
+	ResetStorage();
+	mood_store_init(START_TIME);
+	vote_log_open(START_TIME);
+	vote_log_get_stats(&before);
+
+	for (time_t t = START_TIME; t < START_TIME + DAY_SECONDS; t += TICK_SECONDS) {
+		random = random * 1664525u + 1013904223u;
+		if ((random >> 8) % (EVENT_EVERY_SECONDS / TICK_SECONDS) == 0) {
+			mood_counter_t counter = (mood_counter_t)((random >> 24) % MOOD_COUNTER_COUNT);
+			mood_store_add(counter, t);
+			vote_log_append(counter, t);
+			events++;
+		}
+		vote_log_service(t);
+	}
+	vote_log_close();
+	vote_log_get_stats(&after);
+
+	uint32_t recordBytes = after.recordBytes - before.recordBytes;
+	uint32_t flashBytes = after.flashBytes - before.flashBytes;
+
+	printf("  %u events in a day: %u record bytes, %u bytes written (x%.1f), %u blocks, %u checkpoints\n",
+		events, recordBytes, flashBytes, recordBytes ? (double)flashBytes / recordBytes : 0.0,
+		after.blocksWritten - before.blocksWritten, after.checkpoints - before.checkpoints);
+
+	mood_store_init(START_TIME + DAY_SECONDS);
+	vote_log_open(START_TIME + DAY_SECONDS);
+	vote_log_close();
+	if (LifetimeEvents() != events) {
+		printf("FAIL: %u events logged, %u came back\n", events, LifetimeEvents());
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	// The log after the two checkpoint slots holds 80 byte blocks of 32 records, up to the margin
+	static const uint32_t lengths[] = { 0, 32, 256, 512, 1024, 2048 };
+	const uint32_t longest = (VOTE_LOG_CHECKPOINT_BYTES + VOTE_LOG_MARGIN_BYTES) / 80 * 32;
+	int failures = 0;
+	int fd = mkstemp(storagePath);
+
+	if (fd < 0) {
+		printf("FAIL: cannot create a temporary storage file\n");
+		return 1;
+	}
+	close(fd);
+
+	printf("vote log, checkpoint every %u log bytes\n", VOTE_LOG_CHECKPOINT_BYTES);
+	printf(" recovery against log length:\n");
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]) && lengths[i] < longest; i++) {
+		failures += BenchRecovery(lengths[i]);
+	}
+	failures += BenchRecovery(longest);
+	printf(" write amplification:\n");
+	failures += BenchWriteAmplification();
+
+	unlink(storagePath);
+	return failures ? 1 : 0;
+}
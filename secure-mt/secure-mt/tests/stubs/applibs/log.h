@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for the Azure Sphere applibs header; the test provides Log_Debug
+
+int Log_Debug(const char* fmt, ...);
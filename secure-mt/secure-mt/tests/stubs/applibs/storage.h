@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for the Azure Sphere applibs header; the test provides the mutable file
+
+int Storage_OpenMutableFile(void);
@@ -0,0 +1,170 @@
+/***************************************************************************************************
+   Name: test_anomaly.c
+
+   Feeds the anomaly detector generated weeks of hourly traffic: busy office hours on weekdays,
+   a few PIR events at night, and a mood around 2.3 on the 1 (mad) to 3 (happy) scale.  Normal
+   weeks must stay nearly silent.  Then the baselines are reopened from storage as after a reboot,
+   and an outage, a chattering PIR, a dead PIR and a bad mood hour must each raise their alert
+   straight away.  A detector without the stored baselines must stay quiet through its warmup.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "anomaly.h"
+
+// First hour of a week: cell 0, Monday 00:00 UTC
+#define WEEK_START_HOUR (3000U * ANOMALY_HOURS_OF_WEEK - 3U * 24U)
+
+#define LEARN_WEEKS 8
+
+// False alerts tolerated over the learnt weeks after the first month
+#define MAX_FALSE_ALERTS 3
+
+static char storagePath[] = "/tmp/anomaly_XXXXXX";
+static uint32_t randomState = 7;
+static int failures = 0;
+
+int Log_Debug(const char* fmt, ...)
+{
+	return 0;
+}
+
+int Storage_OpenMutableFile(void)
+{
+	return open(storagePath, O_RDWR);
+}
+
+static void Expect(bool condition, const char* what)
+{
+	if (!condition) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static float Gaussian(void)
+{
+	float sum = 0.0f;
+
+	for (int i = 0; i < 12; i++) {
+		randomState = randomState * 1664525u + 1013904223u;
+		sum += (float)(randomState >> 8) / (float)(1u << 24);
+	}
+	return sum - 6.0f;
+}
+
+static uint32_t Poisson(float mean)
+{
+	float value = roundf(mean + sqrtf(mean) * Gaussian());
+	return (value > 0.0f) ? (uint32_t)value : 0;
+}
+
+static anomaly_sample_t NormalHour(uint32_t hour)
+{
+	uint32_t hourOfWeek = (hour - WEEK_START_HOUR) % ANOMALY_HOURS_OF_WEEK;
+	uint32_t day = hourOfWeek / 24;
+	uint32_t hourOfDay = hourOfWeek % 24;
+	bool busy = day < 5 && hourOfDay >= 9 && hourOfDay < 18;
+	anomaly_sample_t sample = {
+		.votes = busy ? Poisson(12.0f) : 0,
+		.motion = busy ? Poisson(40.0f) : Poisson(1.0f),
+		.mood = 2.3f + 0.15f * Gaussian()
+	};
+
+	return sample;
+}
+
+static uint8_t Observe(uint32_t hour, const anomaly_sample_t* sample, anomaly_kind_t* kind)
+{
+	anomaly_alert_t alerts[ANOMALY_KIND_COUNT];
+	uint8_t count = anomaly_observe(hour, sample, alerts, ANOMALY_KIND_COUNT);
+
+	if (count > 0 && kind != NULL) {
+		*kind = alerts[0].kind;
+	}
+	return count;
+}
+
+/// <summary>
+///     Observes an injected hour and checks it raises exactly the expected alert.
+/// </summary>
+static void ExpectAlert(uint32_t hour, anomaly_sample_t sample, anomaly_kind_t expected)
+{
+	anomaly_kind_t kind = ANOMALY_KIND_COUNT;
+	uint8_t count = Observe(hour, &sample, &kind);
+
+	if (count != 1 || kind != expected) {
+		printf("FAIL: expected one %s alert, got %u (first %s)\n", anomaly_kind_name(expected), count,
+			anomaly_kind_name(kind));
+		failures++;
+	}
+}
+
+int main(void)
+{
+	uint32_t falseAlerts = 0;
+	uint32_t hour = WEEK_START_HOUR;
+	int fd = mkstemp(storagePath);
+
+	if (fd < 0 || ftruncate(fd, STORAGE_FILE_SIZE) != 0) {
+		printf("FAIL: cannot create a temporary storage file\n");
+		return 1;
+	}
+	close(fd);
+
+	Expect(anomaly_open() == 0, "nothing loaded from empty storage");
+
+	for (uint32_t week = 0; week < LEARN_WEEKS; week++) {
+		for (uint32_t i = 0; i < ANOMALY_HOURS_OF_WEEK; i++, hour++) {
+			anomaly_sample_t sample = NormalHour(hour);
+			uint8_t count = Observe(hour, &sample, NULL);
+
+			if (week >= 4) {
+				falseAlerts += count;
+			}
+		}
+	}
+	anomaly_close();
+	printf("anomaly: %u false alerts in %u normal weeks\n", falseAlerts, LEARN_WEEKS - 4);
+	Expect(falseAlerts <= MAX_FALSE_ALERTS, "normal weeks stay quiet");
+
+	// A reboot: RAM is gone, the baselines come back from storage
+	anomaly_init();
+	Expect(anomaly_open() == ANOMALY_HOURS_OF_WEEK, "every hour of week loaded after a reboot");
+
+	// Monday 10:00 to 13:00
+	hour += 10;
+	ExpectAlert(hour++, (anomaly_sample_t){ .votes = 0, .motion = 0, .mood = 0.0f }, ANOMALY_NO_TRAFFIC);
+	ExpectAlert(hour++, (anomaly_sample_t){ .votes = 12, .motion = 400, .mood = 2.3f }, ANOMALY_MOTION_HIGH);
+	ExpectAlert(hour++, (anomaly_sample_t){ .votes = 12, .motion = 0, .mood = 2.3f }, ANOMALY_PIR_SILENT);
+	ExpectAlert(hour++, (anomaly_sample_t){ .votes = 12, .motion = 40, .mood = 1.1f }, ANOMALY_MOOD_LOW);
+	anomaly_close();
+
+	// A record that does not check out is dropped on its own
+	fd = open(storagePath, O_RDWR);
+	if (fd >= 0) {
+		uint8_t garbage = 0xA5;
+		pwrite(fd, &garbage, 1, ANOMALY_STORAGE_START + 1);
+		close(fd);
+	}
+	Expect(anomaly_open() == ANOMALY_HOURS_OF_WEEK - 1, "a corrupt record costs only its hour of week");
+	anomaly_close();
+
+	// Without the stored baselines one week is not enough to alert on
+	unlink(storagePath);
+	anomaly_init();
+	hour = WEEK_START_HOUR;
+	for (uint32_t i = 0; i < ANOMALY_HOURS_OF_WEEK; i++, hour++) {
+		anomaly_sample_t sample = NormalHour(hour);
+		Observe(hour, &sample, NULL);
+	}
+	hour += 10;
+	Expect(Observe(hour, &(anomaly_sample_t){ .votes = 0, .motion = 0, .mood = 0.0f }, NULL) == 0,
+		"no alert before the warmup");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+/***************************************************************************************************
+   Name: test_debounce.c
+
+   Replays a generated 1ms poll trace of a panel's port word through the debouncer, with the
+   button and PIR settings main.c uses.  Button 0 bounces for 12ms going down, chatters twice
+   while held for about 1.9s, and bounces again coming up.  Button 1 sees a 10ms spike and the
+   PIR a single poll glitch.  That must come out as one press, one release, one long press and
+   three repeats, all on button 0.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+
+// As main.c sets them up
+#define INPUT_BUTTON_MASK 0x07U
+#define INPUT_PROXIMITY_MASK 0x08U
+#define INPUT_BUTTON_DEBOUNCE_POLLS 20
+#define INPUT_PROXIMITY_DEBOUNCE_POLLS 2
+#define INPUT_LONG_PRESS_POLLS 1000
+#define INPUT_REPEAT_POLLS 250
+
+#define BUTTON_0 0x01U
+#define BUTTON_1 0x02U
+
+#define PRESS_POLL 100
+#define RELEASE_POLL 2000
+#define BOUNCE_POLLS 12
+#define TRACE_POLLS 3500
+
+static uint32_t bounceState = 2024;
+
+static int Bounce(void)
+{
+	bounceState = bounceState * 1664525u + 1013904223u;
+	return (bounceState >> 16) & 1;
+}
+
+/// <summary>
+///     Raw port word at a poll.
+/// </summary>
+static uint16_t TraceSample(int poll)
+{
+	uint16_t raw = 0;
+
+	if (poll >= PRESS_POLL && poll < RELEASE_POLL + BOUNCE_POLLS) {
+		bool bouncing = (poll < PRESS_POLL + BOUNCE_POLLS) || (poll >= RELEASE_POLL);
+		bool chatter = (poll == 600) || (poll == 1300) || (poll == 1301);
+
+		if (bouncing ? Bounce() : !chatter) {
+			raw |= BUTTON_0;
+		}
+	}
+	if (poll >= 3000 && poll < 3010) {
+		raw |= BUTTON_1;
+	}
+	if (poll == 50) {
+		raw |= INPUT_PROXIMITY_MASK;
+	}
+
+	return raw;
+}
+
+int main(void)
+{
+	debounce_t debounce;
+	uint32_t pressed = 0;
+	uint32_t released = 0;
+	uint32_t longPresses = 0;
+	uint32_t repeats = 0;
+	uint16_t otherPins = 0;
+	int failures = 0;
+
+	debounce_init(&debounce, INPUT_BUTTON_DEBOUNCE_POLLS);
+	debounce_set_threshold(&debounce, INPUT_PROXIMITY_MASK, INPUT_PROXIMITY_DEBOUNCE_POLLS);
+	debounce_set_hold(&debounce, INPUT_LONG_PRESS_POLLS, INPUT_REPEAT_POLLS, INPUT_BUTTON_MASK);
+
+	for (int poll = 0; poll < TRACE_POLLS; poll++) {
+		debounce_events_t events;
+
+		debounce_update(&debounce, TraceSample(poll), &events);
+
+		pressed += (events.pressed & BUTTON_0) ? 1 : 0;
+		released += (events.released & BUTTON_0) ? 1 : 0;
+		longPresses += (events.longPress & BUTTON_0) ? 1 : 0;
+		repeats += (events.repeat & BUTTON_0) ? 1 : 0;
+		otherPins |= (uint16_t)((events.pressed | events.released | events.longPress | events.repeat) & ~BUTTON_0);
+	}
+
+	printf("debounce: %u pressed, %u released, %u long press, %u repeats\n", pressed, released, longPresses, repeats);
+
+	if (pressed != 1 || released != 1) {
+		printf("FAIL: expected one press and one release\n");
+		failures++;
+	}
+	if (longPresses != 1) {
+		printf("FAIL: expected one long press\n");
+		failures++;
+	}
+	if (repeats != 3) {
+		printf("FAIL: expected three repeats\n");
+		failures++;
+	}
+	if (otherPins != 0) {
+		printf("FAIL: glitches reported as events on pins 0x%04x\n", otherPins);
+		failures++;
+	}
+
+	return failures ? 1 : 0;
+}
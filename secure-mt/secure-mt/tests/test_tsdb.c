@@ -0,0 +1,312 @@
+/***************************************************************************************************
+   Name: test_tsdb.c
+
+   Checks the time-series store against a temporary file standing in for the mutable storage
+   file.  Codec: samples whose interval and value changes sit on either side of every encoding
+   class, including repeats within a second and full 32 bit jumps, must read back exactly across
+   many sealed blocks.  Week: a generated week of every channel must still be there, hour by hour,
+   once it has been written.  Then the store is reopened as after clean reboots, which must not
+   seal the open blocks, and as after power cuts, which must lose no more than TSDB_SAVE_SAMPLES
+   and never count a sample twice.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "tsdb.h"
+
+#define START_TIME 1700000000U
+#define WEEK_MINUTES (7U * 24U * 60U)
+#define WEEK_HOURS (7U * 24U)
+
+static char storagePath[] = "/tmp/tsdb_XXXXXX";
+static uint32_t randomState = 11;
+static int failures = 0;
+
+typedef struct {
+	uint32_t time;
+	int32_t value;
+} sample_t;
+
+// Expected downsampled hours of the week, per channel
+static tsdb_point_t weekHours[TSDB_CHANNEL_COUNT][WEEK_HOURS];
+
+int Log_Debug(const char* fmt, ...)
+{
+	return 0;
+}
+
+int Storage_OpenMutableFile(void)
+{
+	return open(storagePath, O_RDWR);
+}
+
+static void Expect(bool condition, const char* what)
+{
+	if (!condition) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void ResetStorage(void)
+{
+	int fd = open(storagePath, O_RDWR | O_TRUNC);
+	if (fd < 0 || ftruncate(fd, STORAGE_FILE_SIZE) != 0) {
+		printf("FAIL: cannot reset %s\n", storagePath);
+		exit(1);
+	}
+	close(fd);
+}
+
+/// <summary>
+///     Reopens the store without closing it first, as the next boot after a power cut sees it.  The
+///     old descriptor is left open.
+/// </summary>
+static void PowerCut(void)
+{
+	Expect(tsdb_open() == 0, "reopen after a power cut");
+}
+
+static uint32_t Random(uint32_t range)
+{
+	randomState = randomState * 1664525u + 1013904223u;
+	return (randomState >> 8) % range;
+}
+
+/// <summary>
+///     Queries the single second at time and compares it to the samples expected there.
+/// </summary>
+static bool MatchesSecond(tsdb_channel_t channel, uint32_t time, const sample_t* samples, uint32_t count)
+{
+	tsdb_point_t point;
+	int32_t min = samples[0].value;
+	int32_t max = samples[0].value;
+
+	for (uint32_t i = 1; i < count; i++) {
+		min = (samples[i].value < min) ? samples[i].value : min;
+		max = (samples[i].value > max) ? samples[i].value : max;
+	}
+
+	return tsdb_query(channel, time, time + 1, 1, &point, 1) == 1 &&
+		point.time == time && point.count == count && point.min == min && point.max == max;
+}
+
+/// <summary>
+///     Round trips intervals and value changes on both sides of each encoding class boundary.
+/// </summary>
+static void TestCodec(void)
+{
+	// Changes in interval around 0, the 6 and 12 bit classes, then a raw interval; 0 repeats a second
+	static const uint32_t deltas[] = { 60, 60, 61, 59, 60, 91, 28, 92, 27, 2107, 60, 0, 0, 60, 5000, 60, 1, 60 };
+	// Value changes around 0 and the 4, 8 and 16 bit classes
+	static const int32_t diffs[] = { 0, 1, -1, 7, -8, 8, -9, 127, -128, 128, -129, 32767, -32767, 32768, -32769 };
+	static sample_t samples[4000];
+	const uint32_t sampleCount = sizeof(samples) / sizeof(samples[0]);
+	tsdb_stats_t stats;
+	uint32_t time = START_TIME;
+	int32_t value = 0;
+
+	ResetStorage();
+	Expect(tsdb_open() == 0, "open empty storage");
+
+	for (uint32_t i = 0; i < sampleCount; i++) {
+		time += deltas[i % (sizeof(deltas) / sizeof(deltas[0]))];
+		if (i % 97 == 50) {
+			value = (i & 1U) ? INT32_MAX : INT32_MIN;
+		}
+		else {
+			value += diffs[i % (sizeof(diffs) / sizeof(diffs[0]))];
+		}
+		samples[i].time = time;
+		samples[i].value = value;
+		tsdb_append(TSDB_CHANNEL_MOOD, time, value);
+	}
+
+	// An earlier sample is refused
+	tsdb_append(TSDB_CHANNEL_MOOD, START_TIME, 1);
+
+	tsdb_get_stats(&stats);
+	Expect(stats.sealedBlocks > 10, "codec samples span many blocks");
+	Expect(stats.droppedBlocks == 0, "codec samples all kept in RAM");
+
+	int mismatches = 0;
+	for (uint32_t i = 0; i < sampleCount; ) {
+		uint32_t count = 1;
+		while (i + count < sampleCount && samples[i + count].time == samples[i].time) {
+			count++;
+		}
+		if (!MatchesSecond(TSDB_CHANNEL_MOOD, samples[i].time, &samples[i], count)) {
+			mismatches++;
+		}
+		i += count;
+	}
+	Expect(mismatches == 0, "every sample reads back exactly");
+
+	printf("tsdb codec: %u samples in %u blocks, %.2f bits/sample, %d mismatches\n", stats.samples,
+		stats.sealedBlocks, (double)stats.encodedBits / stats.samples, mismatches);
+	tsdb_close();
+}
+
+/// <summary>
+///     A minute of the generated week: office hours traffic on weekdays, a slowly drifting mood,
+///     temperature and pressure, and a jittery RSSI.  The timer now and then fires a second late.
+/// </summary>
+static void AppendMinute(uint32_t minute)
+{
+	static int32_t values[TSDB_CHANNEL_COUNT] = { 230, 0, 0, 215, 10130, -60 };
+	uint32_t time = START_TIME + minute * 60U + ((Random(10) == 0) ? 1U : 0U);
+	uint32_t hourOfDay = (minute / 60U) % 24U;
+	bool busy = (minute / (24U * 60U)) < 5U && hourOfDay >= 8U && hourOfDay < 18U;
+
+	values[TSDB_CHANNEL_VOTES] = (busy && Random(4) == 0) ? (int32_t)Random(3) + 1 : 0;
+	values[TSDB_CHANNEL_MOTION] = busy ? (int32_t)Random(4) : ((Random(60) == 0) ? 1 : 0);
+	if (values[TSDB_CHANNEL_VOTES] > 0) {
+		values[TSDB_CHANNEL_MOOD] += (int32_t)Random(5) - 2;
+	}
+	if (Random(5) == 0) {
+		values[TSDB_CHANNEL_TEMPERATURE] += (hourOfDay >= 6U && hourOfDay < 15U) ? 1 : -1;
+	}
+	if (Random(10) == 0) {
+		values[TSDB_CHANNEL_PRESSURE] += (int32_t)Random(3) - 1;
+	}
+	values[TSDB_CHANNEL_RSSI] = -60 + (int32_t)Random(5) - 2;
+
+	for (int channel = 0; channel < TSDB_CHANNEL_COUNT; channel++) {
+		tsdb_point_t* hour = &weekHours[channel][minute / 60U];
+		int32_t value = values[channel];
+
+		if (hour->count == 0 || value < hour->min) {
+			hour->min = value;
+		}
+		if (hour->count == 0 || value > hour->max) {
+			hour->max = value;
+		}
+		hour->mean += (float)value;
+		hour->count++;
+
+		tsdb_append((tsdb_channel_t)channel, time, value);
+	}
+}
+
+/// <summary>
+///     Queries the week back an hour a point and compares every hour to what was appended.
+/// </summary>
+/// <returns>hours that do not match</returns>
+static int CheckWeek(void)
+{
+	static tsdb_point_t points[WEEK_HOURS];
+	int mismatches = 0;
+
+	for (int channel = 0; channel < TSDB_CHANNEL_COUNT; channel++) {
+		uint16_t found = tsdb_query((tsdb_channel_t)channel, START_TIME, START_TIME + WEEK_MINUTES * 60U, 3600,
+			points, WEEK_HOURS);
+
+		if (found != WEEK_HOURS) {
+			mismatches += WEEK_HOURS;
+			continue;
+		}
+		for (uint32_t i = 0; i < WEEK_HOURS; i++) {
+			const tsdb_point_t* expected = &weekHours[channel][i];
+			float mean = expected->mean / (float)expected->count;
+
+			if (points[i].time != START_TIME + i * 3600U || points[i].count != expected->count ||
+				points[i].min != expected->min || points[i].max != expected->max ||
+				fabsf(points[i].mean - mean) > 1e-3f * (fabsf(mean) + 1.0f)) {
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
+
+/// <summary>
+///     Counts the samples a channel holds in [from, to).
+/// </summary>
+static uint32_t CountSamples(tsdb_channel_t channel, uint32_t from, uint32_t to)
+{
+	tsdb_point_t point;
+
+	return tsdb_query(channel, from, to, to - from, &point, 1) == 1 ? point.count : 0;
+}
+
+static void TestWeek(void)
+{
+	tsdb_stats_t before, after;
+
+	ResetStorage();
+	Expect(tsdb_open() == 0, "open empty storage");
+	tsdb_get_stats(&before);
+	for (uint32_t minute = 0; minute < WEEK_MINUTES; minute++) {
+		AppendMinute(minute);
+	}
+
+	tsdb_get_stats(&after);
+	int mismatches = CheckWeek();
+	Expect(mismatches == 0, "the whole week reads back");
+	printf("tsdb week: %u samples in %u sealed blocks, %.2f bits/sample, %d hours wrong\n",
+		after.samples - before.samples, after.sealedBlocks - before.sealedBlocks,
+		(double)(after.encodedBits - before.encodedBits) / (after.samples - before.samples), mismatches);
+	before = after;
+
+	// Clean reboots keep the open blocks without sealing them
+	for (int reboot = 0; reboot < 10; reboot++) {
+		tsdb_close();
+		Expect(tsdb_open() == 0, "reopen after a clean shutdown");
+	}
+	tsdb_get_stats(&after);
+	Expect(after.sealedBlocks == before.sealedBlocks, "clean reboots seal nothing");
+	Expect(CheckWeek() == 0, "the week survives clean reboots");
+
+	// Power cuts lose at most the samples since the last save, and nothing comes back twice
+	uint32_t minute = WEEK_MINUTES;
+	for (int cut = 0; cut < 4; cut++) {
+		uint32_t from = START_TIME + minute * 60U;
+		uint32_t appended = TSDB_SAVE_SAMPLES + 3U * (uint32_t)cut;
+
+		for (uint32_t i = 0; i < appended; i++) {
+			tsdb_append(TSDB_CHANNEL_PRESSURE, START_TIME + minute * 60U, (int32_t)minute);
+			minute++;
+		}
+		PowerCut();
+
+		uint32_t kept = CountSamples(TSDB_CHANNEL_PRESSURE, from, START_TIME + minute * 60U);
+		Expect(kept <= appended && kept + TSDB_SAVE_SAMPLES > appended, "a power cut loses only unsaved samples");
+	}
+
+	// A power cut right after a block is sealed must not bring back the sealed copy as open
+	uint32_t from = START_TIME + minute * 60U;
+	uint32_t appended = 0;
+	tsdb_get_stats(&before);
+	do {
+		tsdb_append(TSDB_CHANNEL_RSSI, START_TIME + minute * 60U, (appended & 1U) ? INT32_MAX : INT32_MIN);
+		minute++;
+		appended++;
+		tsdb_get_stats(&after);
+	} while (after.sealedBlocks == before.sealedBlocks);
+	PowerCut();
+	Expect(CountSamples(TSDB_CHANNEL_RSSI, from, START_TIME + minute * 60U) == appended - 1,
+		"a block sealed before a power cut is read once");
+
+	tsdb_close();
+}
+
+int main(void)
+{
+	int fd = mkstemp(storagePath);
+
+	if (fd < 0) {
+		printf("FAIL: cannot create a temporary storage file\n");
+		return 1;
+	}
+	close(fd);
+
+	TestCodec();
+	TestWeek();
+
+	unlink(storagePath);
+	return failures ? 1 : 0;
+}
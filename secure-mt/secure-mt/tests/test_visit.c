@@ -0,0 +1,86 @@
+/***************************************************************************************************
+   Name: test_visit.c
+
+   Drives one panel's PIR and votes through visit.c with the rate limiter and the visit funnel
+   consuming it, as main.c wires them.  A vote cast just before the PIR fires must count as the
+   visit's vote for both, a second vote in the visit must be suppressed, and a PIR stuck active
+   must be cut at the dwell cap so later votes go through and are counted as orphans.
+****************************************************************************************************/
+
+#include <stdio.h>
+
+#include "rate_limit.h"
+#include "visit.h"
+#include "visit_funnel.h"
+
+#define PANEL 0
+#define BUTTON 0
+#define GAP_MS (VISIT_GAP_SECONDS * 1000U)
+#define CAP_MS (VISIT_MAX_DWELL_SECONDS * 1000U)
+
+// Far enough apart that the buttons' buckets have refilled
+#define VOTE_SPACING_MS 60000U
+
+static int failures = 0;
+
+static void Expect(bool condition, const char* what)
+{
+	if (!condition) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	visit_funnel_totals_t totals;
+	uint64_t t = 1000;
+
+	rate_limit_init(t);
+	visit_init(visit_funnel_on_visit);
+	visit_funnel_init();
+
+	// Vote 2 s before the PIR catches up: credited to the visit, and the next vote is its second
+	Expect(rate_limit_vote(PANEL, BUTTON, t) == RATE_LIMIT_ALLOWED, "first vote allowed");
+	visit_vote(PANEL, t);
+	visit_proximity(PANEL, true, t + 2000);
+	Expect(rate_limit_vote(PANEL, BUTTON + 1, t + 4000) == RATE_LIMIT_VISIT, "second vote in the visit suppressed");
+	visit_proximity(PANEL, false, t + 20000);
+	visit_tick(t + 20000 + GAP_MS);
+
+	visit_funnel_get_totals(&totals);
+	Expect(totals.visits == 1 && totals.converted == 1 && totals.orphanVotes == 0,
+		"vote before the PIR converts the visit");
+	Expect(totals.response[0] == 1, "vote before the PIR has no time to vote");
+	Expect(totals.dwell[5] == 1, "18 s dwell in the 16..32 s bin");
+
+	// A PIR that never goes quiet: cut at the cap, then votes go through as orphans
+	t += 100000;
+	visit_proximity(PANEL, true, t);
+	Expect(rate_limit_vote(PANEL, BUTTON, t + 1000) == RATE_LIMIT_ALLOWED, "vote in the stuck visit allowed");
+	visit_vote(PANEL, t + 1000);
+	for (uint64_t tick = t; tick < t + 3 * CAP_MS; tick += 5000) {
+		visit_tick(tick);
+	}
+	for (uint64_t vote = t + CAP_MS + 1000; vote < t + 3 * CAP_MS; vote += VOTE_SPACING_MS) {
+		Expect(rate_limit_vote(PANEL, BUTTON, vote) == RATE_LIMIT_ALLOWED, "vote after the dwell cap allowed");
+		visit_vote(PANEL, vote);
+	}
+	visit_tick(t + 4 * CAP_MS);
+
+	visit_funnel_get_totals(&totals);
+	Expect(totals.visits == 2 && totals.capped == 1, "stuck PIR gives one capped visit");
+	Expect(totals.orphanVotes == (2 * CAP_MS - 1000 + VOTE_SPACING_MS - 1) / VOTE_SPACING_MS,
+		"votes after the cap are orphans");
+
+	// The PIR recovers: the next activity is a new visit
+	visit_proximity(PANEL, false, t + 4 * CAP_MS);
+	visit_proximity(PANEL, true, t + 4 * CAP_MS + 1000);
+	visit_funnel_get_totals(&totals);
+	Expect(totals.visits == 3, "new visit once the stuck PIR goes quiet");
+
+	printf("visit: %u visits, %u converted, %u capped, %u orphan votes\n",
+		totals.visits, totals.converted, totals.capped, totals.orphanVotes);
+
+	return failures ? 1 : 0;
+}
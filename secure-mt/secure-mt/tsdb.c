@@ -0,0 +1,552 @@
+/***************************************************************************************************
+   Name: tsdb.c
+
+   Small time-series store for the minute history of mood, votes, motion and the environment.
+
+   Each channel appends to an open block in RAM.  Timestamps are stored as the change in the
+   interval between samples (delta of delta, one bit for a sample on schedule) and values as the
+   change from the previous value in a few variable-length classes (one bit when unchanged).  A
+   full block is sealed into a RAM ring and spilled to the store's region of the mutable storage
+   file, which keeps the newest blocks across a reboot.  The ring has one block per storage slot,
+   so history reads the same before and after a reboot.  Minute samples of every channel average
+   about 5 bits, so a week fills about 76 blocks.
+
+   The region starts with one slot per channel for its open block, rewritten every
+   TSDB_SAVE_SAMPLES and at close, and picked up again at open rather than sealed early.  An open
+   block carries the sequence of the channel's last sealed block, so a copy left in the slot by a
+   crash between sealing the block and saving its successor is recognised and dropped.
+****************************************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "tsdb.h"
+
+#define BLOCK_MAGIC 0x5354U		// "TS"
+
+// Sealed block slots, after the open block slots
+#define SEALED_START (TSDB_STORAGE_START + TSDB_CHANNEL_COUNT * TSDB_BLOCK_SIZE)
+#define STORAGE_BLOCKS ((TSDB_STORAGE_END - SEALED_START) / TSDB_BLOCK_SIZE)
+
+// A week of minute samples of every channel, with a few hours to spare
+#define WEEK_BLOCKS 80
+
+_Static_assert(STORAGE_BLOCKS >= WEEK_BLOCKS, "the tsdb region must keep a week of history");
+
+// Sealed blocks kept in RAM, oldest dropped first.  More than storage keeps would be lost at the
+// next reboot anyway.
+#define RAM_BLOCKS STORAGE_BLOCKS
+
+typedef struct {
+	uint16_t magic;
+	uint8_t channel;
+	uint8_t reserved;
+	uint32_t sequence;			// seal order, decides the storage slot and load order; in an
+								// open block, the channel's last sealed block
+	uint32_t firstTime;
+	uint32_t lastTime;
+	int32_t firstValue;
+	uint16_t count;
+	uint16_t bits;				// payload bits used
+	uint32_t crc;				// over the used payload bytes
+} block_header_t;
+
+#define PAYLOAD_BYTES (TSDB_BLOCK_SIZE - sizeof(block_header_t))
+
+typedef struct {
+	block_header_t header;
+	uint8_t data[PAYLOAD_BYTES];
+} tsdb_block_t;
+
+_Static_assert(sizeof(tsdb_block_t) == TSDB_BLOCK_SIZE, "tsdb block must be TSDB_BLOCK_SIZE bytes");
+
+typedef struct {
+	tsdb_block_t block;
+	uint32_t prevTime;
+	int64_t prevDelta;
+	int32_t prevValue;
+} open_block_t;
+
+typedef struct {
+	const tsdb_block_t* block;
+	uint32_t bit;
+	uint16_t index;
+	uint32_t time;
+	int64_t delta;
+	int32_t value;
+} decoder_t;
+
+static int storageFd = -1;
+static uint32_t nextSequence = 1;
+
+static open_block_t openBlocks[TSDB_CHANNEL_COUNT];
+
+static tsdb_block_t ramBlocks[RAM_BLOCKS];
+static uint16_t ramHead = 0;			// oldest sealed block
+static uint16_t ramCount = 0;
+
+static tsdb_stats_t tsdbStats;
+
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFFU;
+
+	while (length--) {
+		crc ^= *data++;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+		}
+	}
+	return ~crc;
+}
+
+static uint32_t ZigZag(int64_t value)
+{
+	return (uint32_t)((value << 1) ^ (value >> 63));
+}
+
+static int64_t UnZigZag(uint32_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1U);
+}
+
+// Bits are written most significant first.  Bits past header.bits are never read, so a sample
+// that does not fit can be abandoned halfway by putting header.bits back.
+static bool PutBits(tsdb_block_t* block, uint32_t value, uint8_t count)
+{
+	if (block->header.bits + count > PAYLOAD_BYTES * 8) {
+		return false;
+	}
+
+	while (count--) {
+		uint16_t bit = block->header.bits++;
+		uint8_t mask = (uint8_t)(0x80U >> (bit & 7U));
+
+		if ((value >> count) & 1U) {
+			block->data[bit >> 3] |= mask;
+		}
+		else {
+			block->data[bit >> 3] &= (uint8_t)~mask;
+		}
+	}
+	return true;
+}
+
+static uint32_t GetBits(decoder_t* decoder, uint8_t count)
+{
+	uint32_t value = 0;
+
+	while (count--) {
+		uint32_t bit = decoder->bit++;
+		value = (value << 1) | ((decoder->block->data[bit >> 3] >> (7U - (bit & 7U))) & 1U);
+	}
+	return value;
+}
+
+/// <summary>
+///     '0' on schedule, '10' + 6 bits, '110' + 12 bits of zigzagged change in interval, else
+///     '111' + the 32 bit interval itself.
+/// </summary>
+static bool PutTime(tsdb_block_t* block, int64_t delta, int64_t prevDelta)
+{
+	int64_t dod = delta - prevDelta;
+	uint32_t zz = (dod > -2048 && dod < 2048) ? ZigZag(dod) : UINT32_MAX;
+
+	if (dod == 0) {
+		return PutBits(block, 0x0U, 1);
+	}
+	if (zz < (1U << 6)) {
+		return PutBits(block, 0x2U, 2) && PutBits(block, zz, 6);
+	}
+	if (zz < (1U << 12)) {
+		return PutBits(block, 0x6U, 3) && PutBits(block, zz, 12);
+	}
+	return PutBits(block, 0x7U, 3) && PutBits(block, (uint32_t)delta, 32);
+}
+
+/// <summary>
+///     '0' unchanged, '10' + 4 bits, '110' + 8 bits, '1110' + 16 bits of zigzagged change, else
+///     '1111' + the 32 bit value itself.
+/// </summary>
+static bool PutValue(tsdb_block_t* block, int32_t value, int32_t prevValue)
+{
+	int64_t diff = (int64_t)value - prevValue;
+	uint32_t zz = (diff > -32768 && diff < 32768) ? ZigZag(diff) : UINT32_MAX;
+
+	if (diff == 0) {
+		return PutBits(block, 0x0U, 1);
+	}
+	if (zz < (1U << 4)) {
+		return PutBits(block, 0x2U, 2) && PutBits(block, zz, 4);
+	}
+	if (zz < (1U << 8)) {
+		return PutBits(block, 0x6U, 3) && PutBits(block, zz, 8);
+	}
+	if (zz < (1U << 16)) {
+		return PutBits(block, 0xEU, 4) && PutBits(block, zz, 16);
+	}
+	return PutBits(block, 0xFU, 4) && PutBits(block, (uint32_t)value, 32);
+}
+
+static void DecoderInit(decoder_t* decoder, const tsdb_block_t* block)
+{
+	decoder->block = block;
+	decoder->bit = 0;
+	decoder->index = 0;
+	decoder->time = block->header.firstTime;
+	decoder->delta = TSDB_INTERVAL_SECONDS;
+	decoder->value = block->header.firstValue;
+}
+
+static bool DecoderNext(decoder_t* decoder, uint32_t* time, int32_t* value)
+{
+	if (decoder->index >= decoder->block->header.count) {
+		return false;
+	}
+
+	// The first sample is in the header
+	if (decoder->index++ > 0) {
+		if (GetBits(decoder, 1) == 0) {
+			// on schedule
+		}
+		else if (GetBits(decoder, 1) == 0) {
+			decoder->delta += UnZigZag(GetBits(decoder, 6));
+		}
+		else if (GetBits(decoder, 1) == 0) {
+			decoder->delta += UnZigZag(GetBits(decoder, 12));
+		}
+		else {
+			decoder->delta = GetBits(decoder, 32);
+		}
+		decoder->time += (uint32_t)decoder->delta;
+
+		if (GetBits(decoder, 1) == 0) {
+			// unchanged
+		}
+		else if (GetBits(decoder, 1) == 0) {
+			decoder->value += (int32_t)UnZigZag(GetBits(decoder, 4));
+		}
+		else if (GetBits(decoder, 1) == 0) {
+			decoder->value += (int32_t)UnZigZag(GetBits(decoder, 8));
+		}
+		else if (GetBits(decoder, 1) == 0) {
+			decoder->value += (int32_t)UnZigZag(GetBits(decoder, 16));
+		}
+		else {
+			decoder->value = (int32_t)GetBits(decoder, 32);
+		}
+	}
+
+	*time = decoder->time;
+	*value = decoder->value;
+	return true;
+}
+
+static void SpillBlock(const tsdb_block_t* block)
+{
+	if (storageFd < 0) {
+		return;
+	}
+
+	off_t offset = SEALED_START + (off_t)(block->header.sequence % STORAGE_BLOCKS) * TSDB_BLOCK_SIZE;
+	if (lseek(storageFd, offset, SEEK_SET) < 0 || write(storageFd, block, sizeof(*block)) != (ssize_t)sizeof(*block)) {
+		Log_Debug("ERROR: tsdb spill failed: %s (%d).\n", strerror(errno), errno);
+		tsdbStats.writeErrors++;
+		return;
+	}
+	tsdbStats.spilledBlocks++;
+}
+
+static void PushRamBlock(const tsdb_block_t* block)
+{
+	if (ramCount == RAM_BLOCKS) {
+		ramHead = (ramHead + 1) % RAM_BLOCKS;
+		ramCount--;
+		tsdbStats.droppedBlocks++;
+	}
+
+	ramBlocks[(ramHead + ramCount) % RAM_BLOCKS] = *block;
+	ramCount++;
+}
+
+static void SealBlock(tsdb_channel_t channel)
+{
+	tsdb_block_t* block = &openBlocks[channel].block;
+
+	if (block->header.count == 0) {
+		return;
+	}
+
+	block->header.sequence = nextSequence++;
+	block->header.crc = Crc32(block->data, (block->header.bits + 7U) / 8U);
+
+	PushRamBlock(block);
+	SpillBlock(block);
+	tsdbStats.sealedBlocks++;
+
+	block->header.count = 0;
+	block->header.bits = 0;
+}
+
+/// <summary>
+///     Writes a channel's open block, as far as it is used, to the channel's slot.
+/// </summary>
+static void SaveOpenBlock(tsdb_channel_t channel)
+{
+	tsdb_block_t* block = &openBlocks[channel].block;
+	size_t used = (block->header.bits + 7U) / 8U;
+
+	if (storageFd < 0 || block->header.count == 0) {
+		return;
+	}
+
+	block->header.crc = Crc32(block->data, used);
+
+	off_t offset = TSDB_STORAGE_START + (off_t)channel * TSDB_BLOCK_SIZE;
+	size_t length = sizeof(block_header_t) + used;
+	if (lseek(storageFd, offset, SEEK_SET) < 0 || write(storageFd, block, length) != (ssize_t)length) {
+		Log_Debug("ERROR: tsdb open block write failed: %s (%d).\n", strerror(errno), errno);
+		tsdbStats.writeErrors++;
+		return;
+	}
+	tsdbStats.savedOpenBlocks++;
+}
+
+static bool LoadBlock(off_t offset, tsdb_block_t* block)
+{
+	if (lseek(storageFd, offset, SEEK_SET) < 0 || read(storageFd, block, sizeof(*block)) != (ssize_t)sizeof(*block)) {
+		return false;
+	}
+
+	const block_header_t* header = &block->header;
+	return header->magic == BLOCK_MAGIC && header->channel < TSDB_CHANNEL_COUNT &&
+		header->count > 0 && header->bits <= PAYLOAD_BYTES * 8 &&
+		Crc32(block->data, (header->bits + 7U) / 8U) == header->crc;
+}
+
+static bool LoadSlot(uint32_t slot, tsdb_block_t* block)
+{
+	return LoadBlock(SEALED_START + (off_t)slot * TSDB_BLOCK_SIZE, block) &&
+		block->header.sequence % STORAGE_BLOCKS == slot;
+}
+
+/// <summary>
+///     Takes a channel's saved open block back unless a newer block of the channel was sealed (the
+///     copy left behind by sealing it), and decodes it to the last sample so appending carries on
+///     where it stopped.  The sealed block it follows may have left the ring since.
+/// </summary>
+static void LoadOpenBlock(tsdb_channel_t channel, uint32_t lastSealed)
+{
+	open_block_t* open = &openBlocks[channel];
+	decoder_t decoder;
+	uint32_t time;
+	int32_t value;
+
+	open->block.header.sequence = lastSealed;
+
+	if (!LoadBlock(TSDB_STORAGE_START + (off_t)channel * TSDB_BLOCK_SIZE, &open->block) ||
+		open->block.header.channel != channel || open->block.header.sequence < lastSealed) {
+		memset(&open->block, 0, sizeof(open->block));
+		open->block.header.sequence = lastSealed;
+		return;
+	}
+
+	DecoderInit(&decoder, &open->block);
+	while (DecoderNext(&decoder, &time, &value)) {
+		// to the last sample
+	}
+	open->prevTime = decoder.time;
+	open->prevDelta = decoder.delta;
+	open->prevValue = decoder.value;
+	tsdbStats.loadedBlocks++;
+}
+
+int tsdb_open(void)
+{
+	static uint32_t slotSequence[STORAGE_BLOCKS];
+	uint32_t lastSealed[TSDB_CHANNEL_COUNT] = { 0 };
+	tsdb_block_t block;
+
+	memset(openBlocks, 0, sizeof(openBlocks));
+	ramHead = 0;
+	ramCount = 0;
+
+	storageFd = Storage_OpenMutableFile();
+	if (storageFd < 0) {
+		Log_Debug("ERROR: tsdb could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+
+	// Find the valid slots, then load them oldest first (load order is their age in the ring)
+	uint32_t newest = 0;
+	for (uint32_t slot = 0; slot < STORAGE_BLOCKS; slot++) {
+		slotSequence[slot] = LoadSlot(slot, &block) ? block.header.sequence : 0;
+		if (slotSequence[slot] > newest) {
+			newest = slotSequence[slot];
+		}
+	}
+
+	uint32_t oldest = (newest > STORAGE_BLOCKS) ? newest - STORAGE_BLOCKS + 1 : 1;
+	for (uint32_t sequence = oldest; newest != 0 && sequence <= newest; sequence++) {
+		uint32_t slot = sequence % STORAGE_BLOCKS;
+
+		if (slotSequence[slot] == sequence && LoadSlot(slot, &block)) {
+			PushRamBlock(&block);
+			lastSealed[block.header.channel] = sequence;
+			tsdbStats.loadedBlocks++;
+		}
+	}
+	nextSequence = newest + 1;
+
+	for (int channel = 0; channel < TSDB_CHANNEL_COUNT; channel++) {
+		LoadOpenBlock((tsdb_channel_t)channel, lastSealed[channel]);
+	}
+
+	Log_Debug("tsdb: %u blocks loaded from storage\n", tsdbStats.loadedBlocks);
+	return 0;
+}
+
+void tsdb_close(void)
+{
+	for (int channel = 0; channel < TSDB_CHANNEL_COUNT; channel++) {
+		SaveOpenBlock((tsdb_channel_t)channel);
+	}
+
+	if (storageFd >= 0) {
+		close(storageFd);
+		storageFd = -1;
+	}
+}
+
+void tsdb_append(tsdb_channel_t channel, time_t time, int32_t value)
+{
+	if (channel >= TSDB_CHANNEL_COUNT) {
+		return;
+	}
+
+	open_block_t* open = &openBlocks[channel];
+	block_header_t* header = &open->block.header;
+	uint32_t sampleTime = (uint32_t)time;
+
+	if (header->count > 0) {
+		if (sampleTime < open->prevTime) {
+			return;
+		}
+
+		int64_t delta = (int64_t)sampleTime - open->prevTime;
+		uint16_t bits = header->bits;
+
+		if (PutTime(&open->block, delta, open->prevDelta) && PutValue(&open->block, value, open->prevValue)) {
+			header->count++;
+			header->lastTime = sampleTime;
+			open->prevDelta = delta;
+			open->prevTime = sampleTime;
+			open->prevValue = value;
+			tsdbStats.samples++;
+			tsdbStats.encodedBits += header->bits - bits;
+			if (header->count % TSDB_SAVE_SAMPLES == 0) {
+				SaveOpenBlock(channel);
+			}
+			return;
+		}
+
+		// Full: abandon the partial sample and start a new block with it
+		header->bits = bits;
+		SealBlock(channel);
+	}
+
+	header->magic = BLOCK_MAGIC;
+	header->channel = (uint8_t)channel;
+	header->firstTime = sampleTime;
+	header->lastTime = sampleTime;
+	header->firstValue = value;
+	header->count = 1;
+	header->bits = 0;
+	open->prevTime = sampleTime;
+	open->prevDelta = TSDB_INTERVAL_SECONDS;
+	open->prevValue = value;
+	tsdbStats.samples++;
+}
+
+static void AccumulateBlock(const tsdb_block_t* block, uint32_t from, uint32_t to, uint32_t step,
+	tsdb_point_t* buckets)
+{
+	decoder_t decoder;
+	uint32_t time;
+	int32_t value;
+
+	if (block->header.count == 0 || block->header.lastTime < from || block->header.firstTime >= to) {
+		return;
+	}
+
+	DecoderInit(&decoder, block);
+	while (DecoderNext(&decoder, &time, &value)) {
+		if (time < from) {
+			continue;
+		}
+		if (time >= to) {
+			break;
+		}
+
+		tsdb_point_t* bucket = &buckets[(time - from) / step];
+		if (bucket->count == 0 || value < bucket->min) {
+			bucket->min = value;
+		}
+		if (bucket->count == 0 || value > bucket->max) {
+			bucket->max = value;
+		}
+		bucket->mean += (float)value;		// a sum until the buckets are finished
+		bucket->count++;
+	}
+}
+
+uint16_t tsdb_query(tsdb_channel_t channel, time_t from, time_t to, uint32_t stepSeconds,
+	tsdb_point_t* points, uint16_t maxPoints)
+{
+	if (channel >= TSDB_CHANNEL_COUNT || to <= from || maxPoints == 0) {
+		return 0;
+	}
+
+	uint32_t start = (uint32_t)from;
+	uint32_t span = (uint32_t)(to - from);
+	uint32_t step = (stepSeconds > 0) ? stepSeconds : TSDB_INTERVAL_SECONDS;
+
+	if ((span + step - 1) / step > maxPoints) {
+		step = (span + maxPoints - 1) / maxPoints;
+	}
+	uint16_t bucketCount = (uint16_t)((span + step - 1) / step);
+
+	memset(points, 0, bucketCount * sizeof(tsdb_point_t));
+
+	for (uint16_t i = 0; i < ramCount; i++) {
+		const tsdb_block_t* block = &ramBlocks[(ramHead + i) % RAM_BLOCKS];
+		if (block->header.channel == channel) {
+			AccumulateBlock(block, start, start + span, step, points);
+		}
+	}
+	AccumulateBlock(&openBlocks[channel].block, start, start + span, step, points);
+
+	// Keep the intervals that have samples, in place
+	uint16_t found = 0;
+	for (uint16_t i = 0; i < bucketCount; i++) {
+		if (points[i].count == 0) {
+			continue;
+		}
+
+		tsdb_point_t point = points[i];
+		point.time = start + i * step;
+		point.mean /= (float)point.count;
+		points[found++] = point;
+	}
+	return found;
+}
+
+void tsdb_get_stats(tsdb_stats_t* stats)
+{
+	*stats = tsdbStats;
+}
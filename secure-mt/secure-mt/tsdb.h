@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "storage_layout.h"
+
+// Compressed block size; a block holds one channel's samples until its bits run out
+#define TSDB_BLOCK_SIZE 512
+
+// Sampling interval the timestamp encoding expects; other intervals cost more bits, not accuracy
+#define TSDB_INTERVAL_SECONDS 60
+
+// Samples a channel appends between writes of its open block, so at most what a power cut loses
+#define TSDB_SAVE_SAMPLES 15
+
+typedef enum {
+	TSDB_CHANNEL_MOOD = 0,		// recent mood, x100
+	TSDB_CHANNEL_VOTES,			// votes in the interval
+	TSDB_CHANNEL_MOTION,		// PIR events in the interval
+	TSDB_CHANNEL_TEMPERATURE,	// degC x10
+	TSDB_CHANNEL_PRESSURE,		// hPa x10
+	TSDB_CHANNEL_RSSI,			// dBm
+	TSDB_CHANNEL_COUNT
+} tsdb_channel_t;
+
+typedef struct {
+	uint32_t time;				// start of the downsampled interval
+	int32_t min;				// channel units, see tsdb_channel_t
+	int32_t max;
+	float mean;
+	uint16_t count;				// samples behind the point
+} tsdb_point_t;
+
+typedef struct {
+	uint32_t samples;
+	uint32_t sealedBlocks;
+	uint32_t droppedBlocks;		// pushed out of RAM by newer ones
+	uint32_t spilledBlocks;		// written to mutable storage
+	uint32_t savedOpenBlocks;	// open blocks written to their channel's slot
+	uint32_t loadedBlocks;		// read back from mutable storage at open, open ones included
+	uint32_t encodedBits;		// payload bits of all samples appended
+	uint32_t writeErrors;
+} tsdb_stats_t;
+
+/// <summary>
+///     Opens the store's region of the mutable storage file and loads the blocks spilled there
+///     into RAM, oldest first.  Each channel then carries on appending to its saved open block.
+/// </summary>
+/// <returns>0 on success, or -1 if storage could not be opened (the store then lives in RAM only)</returns>
+int tsdb_open(void);
+
+/// <summary>
+///     Saves the open blocks to their slots so a clean shutdown loses nothing, then closes the file.
+///     They are not sealed, so a reboot costs no sealed block slots.
+/// </summary>
+void tsdb_close(void);
+
+/// <summary>
+///     Appends a sample.  Samples of a channel must come in time order; earlier ones are dropped.
+/// </summary>
+void tsdb_append(tsdb_channel_t channel, time_t time, int32_t value);
+
+/// <summary>
+///     Downsamples [from, to) of a channel into points of stepSeconds.  The step is widened if the
+///     range would need more than maxPoints.  Only intervals with samples are returned.
+/// </summary>
+/// <returns>the number of points written</returns>
+uint16_t tsdb_query(tsdb_channel_t channel, time_t from, time_t to, uint32_t stepSeconds,
+	tsdb_point_t* points, uint16_t maxPoints);
+
+void tsdb_get_stats(tsdb_stats_t* stats);
@@ -0,0 +1,166 @@
+/***************************************************************************************************
+   Name: visit.c
+
+   Splits each panel's PIR activity into visits, for the rate limiter and the visit funnel alike.
+   Activity separated by less than the gap is one visit, and no visit lasts longer than the dwell
+   cap: a PIR stuck active would otherwise hold one visit open for good and take every later
+   vote as its second.  After the cap the panel has no visit until the PIR goes quiet.  A vote
+   with no visit open waits for the gap, since the PIR often fires just after the press.
+****************************************************************************************************/
+
+#include <string.h>
+
+#include "visit.h"
+
+typedef struct {
+	visit_t visit;
+	bool open;
+	bool active;				// PIR currently active
+	bool stuck;					// visit cut at the dwell cap, PIR not quiet since
+	bool pending;				// a vote waits for a visit to claim it
+	uint64_t pendingMs;
+	uint64_t quietSinceMs;		// PIR went inactive
+} panel_visit_t;
+
+static panel_visit_t panelVisits[MCP23X17_MAX_DEVICES];
+static visit_listener_t visitListener = NULL;
+static uint32_t gapMs = VISIT_GAP_SECONDS * 1000U;
+
+static void Notify(uint8_t panel, visit_event_t event, const visit_t* visit)
+{
+	if (visitListener != NULL) {
+		visitListener(panel, event, visit);
+	}
+}
+
+static void Close(uint8_t panel, uint64_t endMs, bool capped)
+{
+	panel_visit_t* state = &panelVisits[panel];
+
+	state->open = false;
+	state->stuck = capped;
+	state->visit.endMs = endMs;
+	state->visit.capped = capped;
+	Notify(panel, VISIT_CLOSED, &state->visit);
+}
+
+/// <summary>
+///     Ends what has run out by nowMs: the open visit, at its gap or the dwell cap, and a held vote.
+/// </summary>
+static void Expire(uint8_t panel, uint64_t nowMs)
+{
+	panel_visit_t* state = &panelVisits[panel];
+	uint64_t capMs = state->visit.startMs + VISIT_MAX_DWELL_SECONDS * 1000U;
+
+	if (state->open && !state->active && nowMs - state->quietSinceMs >= gapMs) {
+		Close(panel, (state->quietSinceMs < capMs) ? state->quietSinceMs : capMs, false);
+	}
+	else if (state->open && nowMs >= capMs) {
+		Close(panel, capMs, state->active);
+	}
+
+	if (state->pending && nowMs - state->pendingMs >= gapMs) {
+		state->pending = false;
+		Notify(panel, VISIT_ORPHAN_VOTE, NULL);
+	}
+}
+
+void visit_init(visit_listener_t listener)
+{
+	memset(panelVisits, 0, sizeof(panelVisits));
+	visitListener = listener;
+}
+
+void visit_set_gap(uint16_t seconds)
+{
+	gapMs = (uint32_t)seconds * 1000U;
+}
+
+uint16_t visit_get_gap(void)
+{
+	return (uint16_t)(gapMs / 1000U);
+}
+
+void visit_proximity(uint8_t panel, bool active, uint64_t nowMs)
+{
+	if (panel >= MCP23X17_MAX_DEVICES) {
+		return;
+	}
+
+	panel_visit_t* state = &panelVisits[panel];
+
+	Expire(panel, nowMs);
+
+	if (!active) {
+		if (state->active) {
+			state->active = false;
+			state->stuck = false;
+			state->quietSinceMs = nowMs;
+		}
+		return;
+	}
+
+	state->active = true;
+	if (state->open || state->stuck) {
+		return;
+	}
+
+	memset(&state->visit, 0, sizeof(state->visit));
+	state->open = true;
+	state->visit.startMs = nowMs;
+	Notify(panel, VISIT_STARTED, &state->visit);
+
+	// A vote just before the PIR caught up belongs to this visit
+	if (state->pending) {
+		state->pending = false;
+		state->visit.votes = 1;
+		state->visit.firstVoteMs = state->pendingMs;
+		Notify(panel, VISIT_VOTE, &state->visit);
+	}
+}
+
+void visit_vote(uint8_t panel, uint64_t nowMs)
+{
+	if (panel >= MCP23X17_MAX_DEVICES) {
+		return;
+	}
+
+	panel_visit_t* state = &panelVisits[panel];
+
+	Expire(panel, nowMs);
+
+	if (state->open) {
+		if (state->visit.votes == 0) {
+			state->visit.firstVoteMs = nowMs;
+		}
+		if (state->visit.votes < UINT16_MAX) {
+			state->visit.votes++;
+		}
+		Notify(panel, VISIT_VOTE, &state->visit);
+		return;
+	}
+
+	// Only the latest vote can still be claimed
+	if (state->pending) {
+		Notify(panel, VISIT_ORPHAN_VOTE, NULL);
+	}
+	state->pending = true;
+	state->pendingMs = nowMs;
+}
+
+bool visit_has_voted(uint8_t panel, uint64_t nowMs)
+{
+	if (panel >= MCP23X17_MAX_DEVICES) {
+		return false;
+	}
+
+	Expire(panel, nowMs);
+	return panelVisits[panel].open && panelVisits[panel].visit.votes > 0;
+}
+
+void visit_tick(uint64_t nowMs)
+{
+	for (uint8_t panel = 0; panel < MCP23X17_MAX_DEVICES; panel++) {
+		Expire(panel, nowMs);
+	}
+}
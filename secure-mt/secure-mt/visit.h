@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "panels.h"
+
+// Defaults; the gap is changeable from the device twin
+#define VISIT_GAP_SECONDS 10			// PIR quiet this long ends a visit
+#define VISIT_MAX_DWELL_SECONDS 300		// a visit is cut here, so a stuck PIR cannot hold one open
+
+typedef enum {
+	VISIT_STARTED = 0,
+	VISIT_VOTE,				// a vote was attached to the visit, visit->votes counts it
+	VISIT_CLOSED,
+	VISIT_ORPHAN_VOTE		// a vote no visit claimed, visit is NULL
+} visit_event_t;
+
+typedef struct {
+	uint64_t startMs;
+	uint64_t endMs;			// set on VISIT_CLOSED: the PIR went quiet, or the dwell cap
+	uint64_t firstVoteMs;	// earlier than startMs for a vote cast just before the PIR fired
+	uint16_t votes;
+	bool capped;			// closed at the dwell cap with the PIR still active
+} visit_t;
+
+typedef void (*visit_listener_t)(uint8_t panel, visit_event_t event, const visit_t* visit);
+
+void visit_init(visit_listener_t listener);
+
+/// <summary>
+///     Changes the gap that splits PIR activity into visits.  Takes effect for open visits too.
+/// </summary>
+void visit_set_gap(uint16_t seconds);
+uint16_t visit_get_gap(void);
+
+/// <summary>
+///     The panel's PIR changed.  Active with no visit open starts one, unless the last visit was
+///     cut at the dwell cap and the PIR has not gone quiet since.
+/// </summary>
+void visit_proximity(uint8_t panel, bool active, uint64_t nowMs);
+
+/// <summary>
+///     A vote was cast on the panel.  With no visit open it is held for the gap: a PIR firing in
+///     that time credits it to the visit it starts, otherwise it is reported as an orphan.
+/// </summary>
+void visit_vote(uint8_t panel, uint64_t nowMs);
+
+/// <summary>
+///     Whether the panel's open visit already has a vote.
+/// </summary>
+bool visit_has_voted(uint8_t panel, uint64_t nowMs);
+
+/// <summary>
+///     Closes visits whose gap or dwell cap has run out and reports unclaimed votes.
+/// </summary>
+void visit_tick(uint64_t nowMs);
@@ -0,0 +1,175 @@
+/***************************************************************************************************
+   Name: visit_funnel.c
+
+   Counts the visits visit.c reports.  The first vote attached to a visit gives the time to vote,
+   zero for a vote cast just before the PIR fired, and the visit's dwell is recorded when it
+   closes.  Everything is kept as counts and log2
+   histograms, so memory is fixed however many people walk past; each completed hour is reduced
+   to a small summary for telemetry.
+****************************************************************************************************/
+
+#include <string.h>
+
+#include "visit_funnel.h"
+
+typedef struct {
+	uint32_t visits;
+	uint32_t converted;
+	uint32_t dwell[VISIT_FUNNEL_BINS];
+	uint32_t response[VISIT_FUNNEL_BINS];
+} hour_counts_t;
+
+static visit_funnel_totals_t totals;
+
+static uint32_t currentHour = 0;
+static hour_counts_t hourCounts;
+
+static visit_funnel_summary_t hours[VISIT_FUNNEL_HOURS];
+static uint8_t hoursHead = 0;		// next slot to write
+static uint8_t hoursHeld = 0;
+static bool summaryReady = false;
+
+static uint8_t HistogramBin(uint64_t ms, uint32_t baseMs)
+{
+	uint8_t bin = 0;
+	uint64_t edge = baseMs;
+
+	while (ms >= edge && bin < VISIT_FUNNEL_BINS - 1) {
+		edge <<= 1;
+		bin++;
+	}
+	return bin;
+}
+
+static void RollHour(time_t now)
+{
+	uint32_t hour = (uint32_t)(now / 3600);
+
+	if (hour == currentHour) {
+		return;
+	}
+
+	// Nothing to summarise before the first hour has started
+	if (currentHour != 0) {
+		visit_funnel_summary_t* summary = &hours[hoursHead];
+
+		summary->hour = currentHour;
+		summary->visits = hourCounts.visits;
+		summary->converted = hourCounts.converted;
+		summary->dwellP50Ms = visit_funnel_percentile(hourCounts.dwell, VISIT_FUNNEL_DWELL_BASE_MS, 0.5f);
+		summary->responseP50Ms = visit_funnel_percentile(hourCounts.response, VISIT_FUNNEL_RESPONSE_BASE_MS, 0.5f);
+
+		hoursHead = (hoursHead + 1) % VISIT_FUNNEL_HOURS;
+		if (hoursHeld < VISIT_FUNNEL_HOURS) {
+			hoursHeld++;
+		}
+		summaryReady = true;
+	}
+
+	memset(&hourCounts, 0, sizeof(hourCounts));
+	currentHour = hour;
+}
+
+void visit_funnel_init(void)
+{
+	memset(&totals, 0, sizeof(totals));
+	memset(&hourCounts, 0, sizeof(hourCounts));
+	currentHour = 0;
+	hoursHead = 0;
+	hoursHeld = 0;
+	summaryReady = false;
+}
+
+void visit_funnel_on_visit(uint8_t panel, visit_event_t event, const visit_t* visit)
+{
+	uint8_t bin;
+
+	RollHour(time(NULL));
+
+	switch (event) {
+	case VISIT_STARTED:
+		totals.visits++;
+		hourCounts.visits++;
+		break;
+
+	case VISIT_VOTE:
+		totals.votes++;
+		if (visit->votes == 1) {
+			bin = HistogramBin((visit->firstVoteMs > visit->startMs) ? visit->firstVoteMs - visit->startMs : 0,
+				VISIT_FUNNEL_RESPONSE_BASE_MS);
+			totals.converted++;
+			hourCounts.converted++;
+			totals.response[bin]++;
+			hourCounts.response[bin]++;
+		}
+		break;
+
+	case VISIT_CLOSED:
+		bin = HistogramBin(visit->endMs - visit->startMs, VISIT_FUNNEL_DWELL_BASE_MS);
+		totals.dwell[bin]++;
+		hourCounts.dwell[bin]++;
+		if (visit->capped) {
+			totals.capped++;
+		}
+		break;
+
+	case VISIT_ORPHAN_VOTE:
+		totals.orphanVotes++;
+		break;
+	}
+}
+
+void visit_funnel_tick(time_t now)
+{
+	RollHour(now);
+}
+
+bool visit_funnel_take_summary(visit_funnel_summary_t* summary)
+{
+	if (!summaryReady) {
+		return false;
+	}
+
+	summaryReady = false;
+	return visit_funnel_get_hour(0, summary);
+}
+
+bool visit_funnel_get_hour(uint8_t hoursAgo, visit_funnel_summary_t* summary)
+{
+	if (hoursAgo >= hoursHeld) {
+		return false;
+	}
+
+	*summary = hours[(hoursHead + VISIT_FUNNEL_HOURS - 1 - hoursAgo) % VISIT_FUNNEL_HOURS];
+	return true;
+}
+
+void visit_funnel_get_totals(visit_funnel_totals_t* funnelTotals)
+{
+	*funnelTotals = totals;
+}
+
+uint32_t visit_funnel_percentile(const uint32_t* bins, uint32_t baseMs, float fraction)
+{
+	uint32_t count = 0;
+
+	for (int bin = 0; bin < VISIT_FUNNEL_BINS; bin++) {
+		count += bins[bin];
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	uint32_t target = (uint32_t)(fraction * (float)count);
+	uint32_t seen = 0;
+	uint32_t edge = baseMs;
+
+	for (int bin = 0; bin < VISIT_FUNNEL_BINS - 1; bin++) {
+		seen += bins[bin];
+		if (seen > target) {
+			return edge;
+		}
+		edge <<= 1;
+	}
+	return edge;
+}
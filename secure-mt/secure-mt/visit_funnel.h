@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "visit.h"
+
+// Histogram bins: bin 0 is below the base, bin n covers [base * 2^(n-1), base * 2^n), the last
+// bin is open ended
+#define VISIT_FUNNEL_BINS 10
+#define VISIT_FUNNEL_DWELL_BASE_MS 1000		// dwell: 1 s ... 256 s+
+#define VISIT_FUNNEL_RESPONSE_BASE_MS 250	// time to vote: 250 ms ... 64 s+
+
+// Hours of per-hour conversion kept
+#define VISIT_FUNNEL_HOURS 24
+
+typedef struct {
+	uint32_t visits;			// visits started
+	uint32_t converted;			// visits with at least one vote
+	uint32_t votes;				// votes attached to a visit
+	uint32_t orphanVotes;		// votes with no visit open (PIR missed them, or no PIR)
+	uint32_t capped;			// visits cut at the dwell cap with the PIR still active
+	uint32_t dwell[VISIT_FUNNEL_BINS];
+	uint32_t response[VISIT_FUNNEL_BINS];	// visit start to first vote
+} visit_funnel_totals_t;
+
+typedef struct {
+	uint32_t hour;				// time / 3600 of the hour summarised
+	uint32_t visits;
+	uint32_t converted;
+	uint32_t dwellP50Ms;		// upper edge of the bin holding the median, 0 without visits
+	uint32_t responseP50Ms;
+} visit_funnel_summary_t;
+
+void visit_funnel_init(void);
+
+/// <summary>
+///     Listener for visit.c: counts the visit events into the current hour.
+/// </summary>
+void visit_funnel_on_visit(uint8_t panel, visit_event_t event, const visit_t* visit);
+
+/// <summary>
+///     Rolls the hourly counts.
+/// </summary>
+void visit_funnel_tick(time_t now);
+
+/// <summary>
+///     Hands out the summary of the last completed hour, once.
+/// </summary>
+/// <returns>true if an hour has completed since the last call</returns>
+bool visit_funnel_take_summary(visit_funnel_summary_t* summary);
+
+/// <summary>
+///     Summary of a completed hour, hoursAgo = 0 being the last one to complete.
+/// </summary>
+/// <returns>false if that hour is not held</returns>
+bool visit_funnel_get_hour(uint8_t hoursAgo, visit_funnel_summary_t* summary);
+
+/// <summary>
+///     Lifetime counts and histograms.
+/// </summary>
+void visit_funnel_get_totals(visit_funnel_totals_t* totals);
+
+/// <summary>
+///     Upper edge, in ms, of the histogram bin holding the given fraction of the samples.
+/// </summary>
+uint32_t visit_funnel_percentile(const uint32_t* bins, uint32_t baseMs, float fraction);
@@ -0,0 +1,344 @@
+/***************************************************************************************************
+   Name: vote_log.c
+
+   Keeps the mood store across reboots and OTA updates in the application's mutable storage file.
+
+   File layout:
+      two checkpoint slots, each a header plus a mood_store_save image
+      an append-only log of blocks, each a header plus up to VOTE_LOG_BATCH_RECORDS records
+
+   A record is 16 bits: the counter in the top 2 and the seconds since the previous record (or the
+   block's base time) in the low 14.  Checkpoints alternate between the slots with an increasing
+   sequence number, and every block carries the sequence of the checkpoint it follows, so a crash
+   between writing a checkpoint and ending the log only leaves blocks recovery will skip.  The
+   log is ended with a zeroed block header rather than truncated, as the file carries other data
+   after VOTE_LOG_REGION_SIZE.
+****************************************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "input_capture.h"
+#include "vote_log.h"
+
+#define CHECKPOINT_MAGIC 0x4D544350U		// "PCTM"
+#define BLOCK_MAGIC 0x4C42U					// "BL"
+
+#define CHECKPOINT_SLOT_SIZE VOTE_LOG_CHECKPOINT_SLOT_SIZE
+#define LOG_START (2 * CHECKPOINT_SLOT_SIZE)
+
+#define RECORD_DELTA_BITS 14
+#define RECORD_DELTA_MAX ((1U << RECORD_DELTA_BITS) - 1U)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t savedAt;
+	uint32_t length;			// bytes of mood store image that follow
+	uint32_t crc;				// over the image
+} checkpoint_header_t;
+
+typedef struct {
+	uint16_t magic;
+	uint16_t count;
+	uint32_t sequence;			// checkpoint this block follows
+	uint32_t baseTime;
+	uint32_t crc;				// over the records
+} block_header_t;
+
+static int storageFd = -1;
+static uint32_t checkpointSequence = 0;
+static uint32_t logEnd = LOG_START;
+
+static uint16_t batch[VOTE_LOG_BATCH_RECORDS];
+static uint16_t batchCount = 0;
+static uint32_t batchBase = 0;
+static uint32_t batchLast = 0;
+static time_t batchOpened = 0;
+
+static uint8_t checkpointImage[CHECKPOINT_SLOT_SIZE - sizeof(checkpoint_header_t)];
+
+static vote_log_stats_t logStats;
+
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFFU;
+
+	while (length--) {
+		crc ^= *data++;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+		}
+	}
+	return ~crc;
+}
+
+static bool ReadAt(uint32_t offset, void* buffer, size_t length)
+{
+	if (lseek(storageFd, (off_t)offset, SEEK_SET) < 0) {
+		return false;
+	}
+	return read(storageFd, buffer, length) == (ssize_t)length;
+}
+
+static bool WriteAt(uint32_t offset, const void* buffer, size_t length)
+{
+	if (lseek(storageFd, (off_t)offset, SEEK_SET) < 0 || write(storageFd, buffer, length) != (ssize_t)length) {
+		Log_Debug("ERROR: vote log write failed: %s (%d).\n", strerror(errno), errno);
+		logStats.writeErrors++;
+		return false;
+	}
+	logStats.flashBytes += (uint32_t)length;
+	return true;
+}
+
+/// <summary>
+///     Loads the newest checkpoint slot that is intact and fits this build's mood store.
+/// </summary>
+/// <returns>true if the mood store was loaded</returns>
+static bool LoadCheckpoint(void)
+{
+	size_t imageSize = mood_store_state_size();
+	checkpoint_header_t headers[2];
+	int best = -1;
+
+	for (int slot = 0; slot < 2; slot++) {
+		if (!ReadAt(slot * CHECKPOINT_SLOT_SIZE, &headers[slot], sizeof(checkpoint_header_t)) ||
+			headers[slot].magic != CHECKPOINT_MAGIC || headers[slot].length != imageSize) {
+			continue;
+		}
+		if (best < 0 || (int32_t)(headers[slot].sequence - headers[best].sequence) > 0) {
+			best = slot;
+		}
+	}
+
+	// Fall back to the older slot if the newer one was torn
+	for (int attempt = 0; attempt < 2 && best >= 0; attempt++) {
+		if (ReadAt(best * CHECKPOINT_SLOT_SIZE + sizeof(checkpoint_header_t), checkpointImage, imageSize) &&
+			Crc32(checkpointImage, imageSize) == headers[best].crc &&
+			mood_store_load(checkpointImage, imageSize)) {
+			checkpointSequence = headers[best].sequence;
+			logStats.recoveredBytes += (uint32_t)(sizeof(checkpoint_header_t) + imageSize);
+			return true;
+		}
+
+		int other = 1 - best;
+		best = (headers[other].magic == CHECKPOINT_MAGIC && headers[other].length == imageSize &&
+			headers[other].sequence != headers[best].sequence) ? other : -1;
+	}
+	return false;
+}
+
+/// <summary>
+///     Replays the blocks written since the loaded checkpoint and leaves logEnd after the last good one.
+/// </summary>
+static void ReplayLog(void)
+{
+	block_header_t header;
+	uint16_t records[VOTE_LOG_BATCH_RECORDS];
+
+	logEnd = LOG_START;
+
+	while (logEnd + sizeof(header) <= VOTE_LOG_REGION_SIZE && ReadAt(logEnd, &header, sizeof(header))) {
+		if (header.magic != BLOCK_MAGIC || header.sequence != checkpointSequence ||
+			header.count == 0 || header.count > VOTE_LOG_BATCH_RECORDS) {
+			break;
+		}
+
+		size_t length = header.count * sizeof(uint16_t);
+		if (!ReadAt(logEnd + sizeof(header), records, length) || Crc32((const uint8_t*)records, length) != header.crc) {
+			break;
+		}
+
+		uint32_t eventTime = header.baseTime;
+		for (uint16_t i = 0; i < header.count; i++) {
+			eventTime += records[i] & RECORD_DELTA_MAX;
+			mood_store_add((mood_counter_t)(records[i] >> RECORD_DELTA_BITS), (time_t)eventTime);
+		}
+
+		logEnd += (uint32_t)(sizeof(header) + length);
+		logStats.recoveredRecords += header.count;
+		logStats.recoveredBytes += (uint32_t)(sizeof(header) + length);
+	}
+}
+
+/// <summary>
+///     Marks the end of the log at offset, dropping whatever stale blocks follow it.
+/// </summary>
+static void EndLog(uint32_t offset)
+{
+	block_header_t end;
+
+	if (offset + sizeof(end) > VOTE_LOG_REGION_SIZE) {
+		return;
+	}
+
+	memset(&end, 0, sizeof(end));
+	WriteAt(offset, &end, sizeof(end));
+}
+
+/// <summary>
+///     Writes the mood store to the slot after the current one, then drops the log it replaces.
+/// </summary>
+static void Checkpoint(time_t now)
+{
+	size_t imageSize = mood_store_state_size();
+	uint32_t sequence = checkpointSequence + 1;
+	checkpoint_header_t header = {
+		.magic = CHECKPOINT_MAGIC,
+		.sequence = sequence,
+		.savedAt = (uint32_t)now,
+		.length = (uint32_t)imageSize
+	};
+
+	if (imageSize > sizeof(checkpointImage)) {
+		return;
+	}
+
+	mood_store_save(checkpointImage);
+	header.crc = Crc32(checkpointImage, imageSize);
+
+	uint32_t slot = (sequence & 1U) * CHECKPOINT_SLOT_SIZE;
+	if (!WriteAt(slot + sizeof(header), checkpointImage, imageSize) || !WriteAt(slot, &header, sizeof(header))) {
+		return;
+	}
+	fsync(storageFd);
+
+	// From here the old blocks are stale whether or not the end marker is written
+	checkpointSequence = sequence;
+	logEnd = LOG_START;
+	EndLog(LOG_START);
+	logStats.checkpoints++;
+}
+
+static void FlushBatch(void)
+{
+	if (batchCount == 0 || storageFd < 0) {
+		batchCount = 0;
+		return;
+	}
+
+	block_header_t header = {
+		.magic = BLOCK_MAGIC,
+		.count = batchCount,
+		.sequence = checkpointSequence,
+		.baseTime = batchBase,
+		.crc = Crc32((const uint8_t*)batch, batchCount * sizeof(uint16_t))
+	};
+	uint8_t block[sizeof(block_header_t) + sizeof(batch)];
+	size_t length = sizeof(header) + batchCount * sizeof(uint16_t);
+
+	memcpy(block, &header, sizeof(header));
+	memcpy(block + sizeof(header), batch, batchCount * sizeof(uint16_t));
+
+	// Only if a checkpoint keeps failing; the counts stay in the mood store until the next one works
+	if (logEnd + length > VOTE_LOG_REGION_SIZE) {
+		logStats.writeErrors++;
+		batchCount = 0;
+		return;
+	}
+
+	if (WriteAt(logEnd, block, length)) {
+		fsync(storageFd);
+		logEnd += (uint32_t)length;
+		logStats.blocksWritten++;
+	}
+	batchCount = 0;
+}
+
+int vote_log_open(time_t now)
+{
+	uint64_t startNs = input_capture_now_ns();
+
+	storageFd = Storage_OpenMutableFile();
+	if (storageFd < 0) {
+		Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+
+	if (!LoadCheckpoint()) {
+		checkpointSequence = 0;
+	}
+	ReplayLog();
+
+	// Whatever follows the last good block is torn or from before the checkpoint
+	EndLog(logEnd);
+	mood_store_tick(now);
+
+	logStats.recoveryNs = input_capture_now_ns() - startNs;
+	Log_Debug("Vote log: checkpoint %u, %u records replayed, %u bytes read in %llu us\n",
+		checkpointSequence, logStats.recoveredRecords, logStats.recoveredBytes, logStats.recoveryNs / 1000);
+
+	return 0;
+}
+
+void vote_log_close(void)
+{
+	if (storageFd < 0) {
+		return;
+	}
+
+	FlushBatch();
+	close(storageFd);
+	storageFd = -1;
+}
+
+void vote_log_append(mood_counter_t counter, time_t now)
+{
+	uint32_t eventTime = (uint32_t)now;
+
+	if (storageFd < 0) {
+		return;
+	}
+
+	// A gap too long for the delta field starts a new block
+	if (batchCount > 0 && eventTime > batchLast && eventTime - batchLast > RECORD_DELTA_MAX) {
+		FlushBatch();
+	}
+
+	if (batchCount == 0) {
+		batchBase = eventTime;
+		batchLast = eventTime;
+		batchOpened = now;
+	}
+
+	// The clock stepping back is logged as no time passing, as the mood store treats it
+	uint32_t delta = (eventTime > batchLast) ? eventTime - batchLast : 0;
+	if (eventTime > batchLast) {
+		batchLast = eventTime;
+	}
+
+	batch[batchCount++] = (uint16_t)(((uint32_t)counter << RECORD_DELTA_BITS) | delta);
+	logStats.recordsLogged++;
+	logStats.recordBytes += sizeof(uint16_t);
+
+	if (batchCount == VOTE_LOG_BATCH_RECORDS) {
+		FlushBatch();
+	}
+}
+
+void vote_log_service(time_t now)
+{
+	if (storageFd < 0) {
+		return;
+	}
+
+	if (batchCount > 0 && (now - batchOpened >= VOTE_LOG_FLUSH_SECONDS || now < batchOpened)) {
+		FlushBatch();
+	}
+
+	if (logEnd - LOG_START >= VOTE_LOG_CHECKPOINT_BYTES) {
+		FlushBatch();
+		Checkpoint(now);
+	}
+}
+
+void vote_log_get_stats(vote_log_stats_t* stats)
+{
+	*stats = logStats;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "mood_store.h"
+
+// Records held in RAM before they are written out as one block
+#define VOTE_LOG_BATCH_RECORDS 32
+
+// Longest a counted event waits in RAM before its block is written
+#define VOTE_LOG_FLUSH_SECONDS 60
+
+// Log length (bytes after the checkpoints) that triggers a checkpoint and a new log.  This is
+// also the bound on what recovery has to replay.  tests/bench_vote_log measures the trade off.
+#ifndef VOTE_LOG_CHECKPOINT_BYTES
+#define VOTE_LOG_CHECKPOINT_BYTES 2048
+#endif
+
+// One checkpoint slot: a 20 byte header and the 6100 byte mood store image
+#define VOTE_LOG_CHECKPOINT_SLOT_SIZE 6144
+
+// Log room past the checkpoint trigger: five full 80 byte blocks appended between two
+// vote_log_service() calls.  A log that reaches the end of the region needs no end marker.
+#define VOTE_LOG_MARGIN_BYTES 400
+
+// The vote log owns the start of the mutable storage file; storage_layout.h places the rest
+#define VOTE_LOG_REGION_SIZE (2 * VOTE_LOG_CHECKPOINT_SLOT_SIZE + VOTE_LOG_CHECKPOINT_BYTES + VOTE_LOG_MARGIN_BYTES)
+
+typedef struct {
+	uint32_t recordsLogged;
+	uint32_t blocksWritten;
+	uint32_t checkpoints;
+	uint32_t recordBytes;		// 2 bytes per logged record
+	uint32_t flashBytes;		// everything written to the file: block headers, records, checkpoints
+	uint32_t writeErrors;
+	uint32_t recoveredRecords;	// replayed from the log tail at open
+	uint32_t recoveredBytes;	// checkpoint plus log tail read at open
+	uint64_t recoveryNs;
+} vote_log_stats_t;
+
+/// <summary>
+///     Opens the mutable storage file and restores the mood store from it: the newest valid
+///     checkpoint, then the log blocks written after it.  A torn or stale tail is cut off.  The
+///     mood store must already be initialised; it is left as is when there is nothing to load.
+/// </summary>
+/// <returns>0 on success, or -1 if the file could not be opened (nothing is persisted then)</returns>
+int vote_log_open(time_t now);
+
+/// <summary>
+///     Flushes what is buffered and closes the file.
+/// </summary>
+void vote_log_close(void);
+
+/// <summary>
+///     Logs an event the caller has just counted in the mood store.  Buffered; a full batch is
+///     written immediately.
+/// </summary>
+void vote_log_append(mood_counter_t counter, time_t now);
+
+/// <summary>
+///     Periodic housekeeping: writes the batch once it is VOTE_LOG_FLUSH_SECONDS old, and
+///     checkpoints once the log reaches VOTE_LOG_CHECKPOINT_BYTES.
+/// </summary>
+void vote_log_service(time_t now);
+
+void vote_log_get_stats(vote_log_stats_t* stats);
@@ -0,0 +1,101 @@
+/***************************************************************************************************
+   Name: altitude.c
+
+   Pressure altitude without a powf per sample.  (p / p0) ^ k is split into p ^ k, taken from a
+   piecewise polynomial, and p0 ^ -k, which only changes when the sea level reference does.
+****************************************************************************************************/
+
+#include <math.h>
+
+#include "altitude.h"
+
+#define ALTITUDE_EXPONENT (1.0f / 5.255f)
+#define ALTITUDE_SCALE_M 44330.0f
+
+#define SEGMENT_WIDTH_HPA 100.0f
+#define SEGMENT_COUNT 8
+
+float seaLevelPressure_hPa = ALTITUDE_STANDARD_SEA_LEVEL_HPA;
+
+// p ^ (1 / 5.255) on each 100 hPa segment from 300 hPa, as a quartic in t = (p - center) / 50.
+// Chebyshev fits, max error 3.2e-7 (0.004 m of altitude).
+static const float segmentCoefficients[SEGMENT_COUNT][5] = {
+	{ 3.048760574e+00f, 8.287910327e-02f, -4.793320520e-03f, 4.188030571e-04f, -4.210704144e-05f },	// 300 - 400 hPa
+	{ 3.198106792e+00f, 6.761997410e-02f, -3.041772004e-03f, 2.055785713e-04f, -1.606365524e-05f },	// 400 - 500 hPa
+	{ 3.322593420e+00f, 5.747918149e-02f, -2.115502494e-03f, 1.166588315e-04f, -7.455307317e-06f },	// 500 - 600 hPa
+	{ 3.429913967e+00f, 5.020726104e-02f, -1.563577506e-03f, 7.284276591e-05f, -3.938102319e-06f },	// 600 - 700 hPa
+	{ 3.524598565e+00f, 4.471418598e-02f, -1.206842438e-03f, 4.867879012e-05f, -2.280509238e-06f },	// 700 - 800 hPa
+	{ 3.609554878e+00f, 4.040469142e-02f, -9.622313725e-04f, 3.422347149e-05f, -1.414548971e-06f },	// 800 - 900 hPa
+	{ 3.686767802e+00f, 3.692490003e-02f, -7.867965409e-04f, 2.502656419e-05f, -9.254695087e-07f },	// 900 - 1000 hPa
+	{ 3.757656596e+00f, 3.405061669e-02f, -6.564511990e-04f, 1.888553123e-05f, -6.318350984e-07f },	// 1000 - 1100 hPa
+};
+
+// p0 ^ -k for the sea level pressure it was computed from
+static float cachedSeaLevel_hPa = 0.0f;
+static float seaLevelScale = 0.0f;
+
+/// <summary>
+///     Recomputes p0 ^ -k when the sea level reference has been changed through the device twin.
+/// </summary>
+static void UpdateSeaLevelScale(void)
+{
+	if (seaLevelPressure_hPa == cachedSeaLevel_hPa) {
+		return;
+	}
+
+	// The twin handler validates the reference before reporting it; this only guards the fit
+	altitude_validate_sea_level(&seaLevelPressure_hPa);
+
+	cachedSeaLevel_hPa = seaLevelPressure_hPa;
+	seaLevelScale = powf(cachedSeaLevel_hPa, -ALTITUDE_EXPONENT);
+}
+
+bool altitude_validate_sea_level(float* pressure_hPa)
+{
+	// Written so that NaN fails too
+	if ((*pressure_hPa >= ALTITUDE_MIN_PRESSURE_HPA) && (*pressure_hPa <= ALTITUDE_MAX_PRESSURE_HPA)) {
+		return true;
+	}
+
+	*pressure_hPa = ALTITUDE_STANDARD_SEA_LEVEL_HPA;
+	return false;
+}
+
+/// <summary>
+///     p ^ (1 / 5.255) for p in the fitted range.
+/// </summary>
+static inline float PressurePower(float pressure_hPa)
+{
+	if (pressure_hPa < ALTITUDE_MIN_PRESSURE_HPA) {
+		pressure_hPa = ALTITUDE_MIN_PRESSURE_HPA;
+	}
+	else if (pressure_hPa > ALTITUDE_MAX_PRESSURE_HPA) {
+		pressure_hPa = ALTITUDE_MAX_PRESSURE_HPA;
+	}
+
+	int segment = (int)((pressure_hPa - ALTITUDE_MIN_PRESSURE_HPA) / SEGMENT_WIDTH_HPA);
+	if (segment >= SEGMENT_COUNT) {
+		segment = SEGMENT_COUNT - 1;
+	}
+
+	const float* c = segmentCoefficients[segment];
+	float center = ALTITUDE_MIN_PRESSURE_HPA + SEGMENT_WIDTH_HPA * ((float)segment + 0.5f);
+	float t = (pressure_hPa - center) * (2.0f / SEGMENT_WIDTH_HPA);
+
+	return c[0] + t * (c[1] + t * (c[2] + t * (c[3] + t * c[4])));
+}
+
+float altitude_from_pressure(float pressure_hPa)
+{
+	UpdateSeaLevelScale();
+	return ALTITUDE_SCALE_M * (1.0f - PressurePower(pressure_hPa) * seaLevelScale);
+}
+
+void altitude_from_pressure_block(const float* pressure_hPa, float* altitude_m, size_t count)
+{
+	UpdateSeaLevelScale();
+
+	for (size_t i = 0; i < count; i++) {
+		altitude_m[i] = ALTITUDE_SCALE_M * (1.0f - PressurePower(pressure_hPa[i]) * seaLevelScale);
+	}
+}
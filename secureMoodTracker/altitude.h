@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Pressure range covered by the approximation.  Readings outside it are clamped.
+#define ALTITUDE_MIN_PRESSURE_HPA 300.0f
+#define ALTITUDE_MAX_PRESSURE_HPA 1100.0f
+
+#define ALTITUDE_STANDARD_SEA_LEVEL_HPA 1013.25f
+
+// Sea level reference pressure, settable through the "seaLevelPressure" device twin property
+extern float seaLevelPressure_hPa;
+
+/// <summary>
+///     Pressure altitude in meters using the Bosch formula 44330 * (1 - (p / p0) ^ (1 / 5.255)).
+///     p ^ (1 / 5.255) comes from a piecewise quartic fit, so there is no powf per sample.  Over
+///     300-1100 hPa the fit is within 0.004 m of the exact formula.  With single precision rounding
+///     the error is at most 0.0073 m against the standard sea level pressure, and 0.013 m against
+///     any reference in range (tests/test_altitude.c).
+/// </summary>
+float altitude_from_pressure(float pressure_hPa);
+
+/// <summary>
+///     Checks a sea level reference before it is taken: it must lie in the fitted range.  A value
+///     outside it is almost certainly a typo in the twin and is replaced by the standard pressure.
+/// </summary>
+/// <returns>true if the reference was kept</returns>
+bool altitude_validate_sea_level(float* pressure_hPa);
+
+/// <summary>
+///     Converts a block of pressure readings, for example a FIFO drain, to altitudes.
+/// </summary>
+void altitude_from_pressure_block(const float* pressure_hPa, float* altitude_m, size_t count);
@@ -0,0 +1,176 @@
+/***************************************************************************************************
+   Name: baro_trend.c
+
+   Barometric trend.  Pressure readings are averaged into one point a minute, and least-squares
+   slopes over the last hour and the last three hours are kept up to date as points arrive.  The
+   three hour slope is classified as rising, falling or steady, and callers only hear about it when
+   that classification changes.
+****************************************************************************************************/
+
+#include "baro_trend.h"
+
+// Decimated points per hour, to turn slopes per point into hPa per hour
+#define POINTS_PER_HOUR (3600.0f / (float)BARO_TREND_DECIMATION_SECONDS)
+
+// A gap longer than this (device suspended, sensor unplugged) restarts the windows
+#define MAX_GAP_POINTS 10
+
+static const char* const trendNames[] = { "steady", "rising", "falling" };
+
+static void slope_window_init(baro_slope_window_t* window, float* points, uint32_t capacity)
+{
+	window->points = points;
+	window->capacity = capacity;
+	window->count = 0;
+	window->oldest = 0;
+	window->sumY = 0.0;
+	window->sumXY = 0.0;
+}
+
+/// <summary>
+///     Appends a point.  When the window is full the oldest point leaves, which shifts every other
+///     point's x down by one: sumXY loses sumY (without the leaving point) and the leaving point's
+///     contribution was x = 0.
+/// </summary>
+static void slope_window_push(baro_slope_window_t* window, float y)
+{
+	if (window->count < window->capacity) {
+		window->points[(window->oldest + window->count) % window->capacity] = y;
+		window->sumXY += (double)window->count * y;
+		window->sumY += y;
+		window->count++;
+		return;
+	}
+
+	float leaving = window->points[window->oldest];
+	window->points[window->oldest] = y;
+	window->oldest = (window->oldest + 1) % window->capacity;
+
+	window->sumXY -= window->sumY - leaving;
+	window->sumY -= leaving;
+	window->sumXY += (double)(window->capacity - 1) * y;
+	window->sumY += y;
+}
+
+/// <summary>
+///     Least-squares slope per point: (n Sxy - Sx Sy) / (n Sxx - Sx^2), with x = 0 .. n-1.
+/// </summary>
+static float slope_window_slope(const baro_slope_window_t* window)
+{
+	if (window->count < 2) {
+		return 0.0f;
+	}
+
+	double n = (double)window->count;
+	double sumX = n * (n - 1.0) / 2.0;
+	double sumXX = (n - 1.0) * n * (2.0 * n - 1.0) / 6.0;
+
+	return (float)((n * window->sumXY - sumX * window->sumY) / (n * sumXX - sumX * sumX));
+}
+
+void baro_trend_init(baro_trend_t* trend)
+{
+	slope_window_init(&trend->shortWindow, trend->shortPoints, BARO_TREND_SHORT_POINTS);
+	slope_window_init(&trend->longWindow, trend->longPoints, BARO_TREND_LONG_POINTS);
+
+	trend->bucketSum = 0.0;
+	trend->bucketCount = 0;
+	trend->bucketStart = 0;
+	trend->trend = BARO_TREND_STEADY;
+}
+
+/// <summary>
+///     Applies the hysteresis thresholds to the 3 hour slope.  Until the long window is warm, at
+///     start up or after a gap, the last classification stands, so no change is reported.
+/// </summary>
+static baro_trend_class_t Classify(const baro_trend_t* trend)
+{
+	if (trend->longWindow.count < BARO_TREND_MIN_POINTS) {
+		return trend->trend;
+	}
+
+	float slope = baro_trend_long_slope(trend);
+
+	switch (trend->trend) {
+	case BARO_TREND_RISING:
+		if (slope < BARO_TREND_EXIT_HPA_PER_HOUR) {
+			return (slope < -BARO_TREND_ENTER_HPA_PER_HOUR) ? BARO_TREND_FALLING : BARO_TREND_STEADY;
+		}
+		return BARO_TREND_RISING;
+
+	case BARO_TREND_FALLING:
+		if (slope > -BARO_TREND_EXIT_HPA_PER_HOUR) {
+			return (slope > BARO_TREND_ENTER_HPA_PER_HOUR) ? BARO_TREND_RISING : BARO_TREND_STEADY;
+		}
+		return BARO_TREND_FALLING;
+
+	default:
+		if (slope > BARO_TREND_ENTER_HPA_PER_HOUR) {
+			return BARO_TREND_RISING;
+		}
+		if (slope < -BARO_TREND_ENTER_HPA_PER_HOUR) {
+			return BARO_TREND_FALLING;
+		}
+		return BARO_TREND_STEADY;
+	}
+}
+
+bool baro_trend_add_block(baro_trend_t* trend, const float* pressure_hPa, size_t count, time_t now)
+{
+	bool changed = false;
+
+	if (trend->bucketCount == 0) {
+		trend->bucketStart = now;
+	}
+
+	// Close the bucket once its period is over.  Missed periods repeat the last point so the
+	// windows stay evenly spaced.
+	time_t elapsed = now - trend->bucketStart;
+	if ((trend->bucketCount > 0) && (elapsed >= BARO_TREND_DECIMATION_SECONDS)) {
+
+		float point = (float)(trend->bucketSum / (double)trend->bucketCount);
+		time_t periods = elapsed / BARO_TREND_DECIMATION_SECONDS;
+
+		if (periods > MAX_GAP_POINTS) {
+			baro_trend_class_t previous = trend->trend;
+			baro_trend_init(trend);
+			trend->trend = previous;
+			periods = 1;
+		}
+
+		for (time_t i = 0; i < periods; i++) {
+			slope_window_push(&trend->shortWindow, point);
+			slope_window_push(&trend->longWindow, point);
+		}
+
+		trend->bucketSum = 0.0;
+		trend->bucketCount = 0;
+		trend->bucketStart = now;
+
+		baro_trend_class_t next = Classify(trend);
+		changed = (next != trend->trend);
+		trend->trend = next;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		trend->bucketSum += pressure_hPa[i];
+	}
+	trend->bucketCount += (uint32_t)count;
+
+	return changed;
+}
+
+float baro_trend_short_slope(const baro_trend_t* trend)
+{
+	return slope_window_slope(&trend->shortWindow) * POINTS_PER_HOUR;
+}
+
+float baro_trend_long_slope(const baro_trend_t* trend)
+{
+	return slope_window_slope(&trend->longWindow) * POINTS_PER_HOUR;
+}
+
+const char* baro_trend_name(baro_trend_class_t trend)
+{
+	return trendNames[trend];
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Pressure is averaged into one point per decimation period before it enters the trend windows
+#define BARO_TREND_DECIMATION_SECONDS 60
+
+// Window lengths in decimated points
+#define BARO_TREND_SHORT_POINTS 60		// 1 hour
+#define BARO_TREND_LONG_POINTS 180		// 3 hours
+
+// The long window classifies the trend once it holds at least this many points.  Until then,
+// after start up or a gap that restarts the windows, the previous classification is kept.
+#define BARO_TREND_MIN_POINTS 60
+
+// Classification thresholds on the 3 hour slope, in hPa per hour.  A trend is entered above the
+// enter threshold and only left again below the exit threshold, so noise around one value does not
+// flip the classification back and forth.
+#define BARO_TREND_ENTER_HPA_PER_HOUR 0.5f
+#define BARO_TREND_EXIT_HPA_PER_HOUR 0.3f
+
+typedef enum {
+	BARO_TREND_STEADY = 0,
+	BARO_TREND_RISING,
+	BARO_TREND_FALLING
+} baro_trend_class_t;
+
+/// <summary>
+///     Least-squares slope over the last N evenly spaced points.  The sums are updated as points
+///     enter and leave the ring, so each point costs O(1) no matter how long the window is.
+/// </summary>
+typedef struct {
+	float* points;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t oldest;
+	double sumY;			// sum of y
+	double sumXY;			// sum of x * y, with x = 0 for the oldest point
+} baro_slope_window_t;
+
+typedef struct {
+	float shortPoints[BARO_TREND_SHORT_POINTS];
+	float longPoints[BARO_TREND_LONG_POINTS];
+	baro_slope_window_t shortWindow;
+	baro_slope_window_t longWindow;
+
+	// Decimation bucket being filled
+	double bucketSum;
+	uint32_t bucketCount;
+	time_t bucketStart;
+
+	baro_trend_class_t trend;
+} baro_trend_t;
+
+void baro_trend_init(baro_trend_t* trend);
+
+/// <summary>
+///     Adds a block of pressure readings taken at time now.
+/// </summary>
+/// <returns>true if the classification changed</returns>
+bool baro_trend_add_block(baro_trend_t* trend, const float* pressure_hPa, size_t count, time_t now);
+
+/// <summary>
+///     Slopes of the 1 hour and 3 hour windows in hPa per hour.  0 until a window holds two points.
+/// </summary>
+float baro_trend_short_slope(const baro_trend_t* trend);
+float baro_trend_long_slope(const baro_trend_t* trend);
+
+const char* baro_trend_name(baro_trend_class_t trend);
@@ -29,4 +29,23 @@
 #define ACCEL_READ_PERIOD_NANO_SECONDS 0
 
 // Enables I2C read/write debug
-#define ENABLE_READ_WRITE_DEBUG
\ No newline at end of file
+#define ENABLE_READ_WRITE_DEBUG
+// Enable to build the sensor fusion filter with integer math instead of floats
+//#define SENSOR_FUSION_FIXED_POINT
+
+// Enable to log the cost of one sensor fusion update at startup
+//#define SENSOR_FUSION_BENCHMARK
+
+// Selects how the LPS22HH pressure sensor is read through the LSM6DSO sensor hub
+#define PRESSURE_MODE_POLLED 0		// read the latest conversion on every accel tick
+#define PRESSURE_MODE_FIFO 1		// let the LPS22HH FIFO collect every conversion and drain it in blocks
+#define PRESSURE_MODE_ONE_SHOT 2	// keep the LPS22HH powered down and convert once per accel period
+#define PRESSURE_ACQUISITION_MODE PRESSURE_MODE_FIFO
+
+// Number of accel ticks between LPS22HH FIFO drains.  The FIFO holds 128 samples, so at 10Hz this must stay under 12s.
+#define PRESSURE_FIFO_DRAIN_TICKS 5
+
+// One-shot mode: the conversion is started this long before the accel tick that consumes it, and read
+// back this long after it was started
+#define PRESSURE_ONE_SHOT_LEAD_MS 100
+#define PRESSURE_ONE_SHOT_CONVERSION_MS 50
@@ -21,6 +21,9 @@
 #include "azure_iot_utilities.h"
 #include "parson.h"
 #include "build_options.h"
+#include "sensor_stats.h"
+#include "power_governor.h"
+#include "altitude.h"
 
 bool userLedRedIsOn = false;
 bool userLedGreenIsOn = false;
@@ -79,12 +82,25 @@ twin_t twinArray[] = {
 	{.twinKey = "OledDisplayMsg1",.twinVar = oled_ms1,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
 	{.twinKey = "OledDisplayMsg2",.twinVar = oled_ms2,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
 	{.twinKey = "OledDisplayMsg3",.twinVar = oled_ms3,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
-	{.twinKey = "OledDisplayMsg4",.twinVar = oled_ms4,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true}
+	{.twinKey = "OledDisplayMsg4",.twinVar = oled_ms4,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_STRING,.active_high = true},
+	{.twinKey = "statsWindow",.twinVar = &statsWindowSamples,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "sensorPowerProfile",.twinVar = &sensorPowerProfile,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "seaLevelPressure",.twinVar = &seaLevelPressure_hPa,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true}
 };
 
 // Calculate how many twin_t items are in the array.  We use this to iterate through the structure.
 int twinArraySize = sizeof(twinArray) / sizeof(twin_t);
 
+///<summary>
+///		Range checks a float setting before it is taken and reported back, so the reported value is the one in use.
+///</summary>
+static void ValidateTwinFloat(twin_t* twinItem)
+{
+	if (twinItem->twinVar == &seaLevelPressure_hPa && !altitude_validate_sea_level(&seaLevelPressure_hPa)) {
+		Log_Debug("%s out of range, using %0.2f\n", twinItem->twinKey, seaLevelPressure_hPa);
+	}
+}
+
 ///<summary>
 ///		check to see if any of the device twin properties have been updated.  If so, send up the current data.
 ///</summary>
@@ -187,6 +203,7 @@ void deviceTwinChangedHandler(JSON_Object * desiredProperties)
 				break;
 			case TYPE_FLOAT:
 				*(float*)twinArray[i].twinVar = (float)json_object_get_number(currentJSONProperties, "value");
+				ValidateTwinFloat(&twinArray[i]);
 				Log_Debug("Received device update. New %s is %0.2f\n", twinArray[i].twinKey, *(float*)twinArray[i].twinVar);
 				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_FLOAT, true);
 				break;
@@ -227,6 +244,7 @@ void deviceTwinChangedHandler(JSON_Object * desiredProperties)
 				break;
 			case TYPE_FLOAT:
 				*(float*)twinArray[i].twinVar = (float)json_object_get_number(desiredProperties, twinArray[i].twinKey);
+				ValidateTwinFloat(&twinArray[i]);
 				Log_Debug("Received device update. New %s is %0.2f\n", twinArray[i].twinKey, *(float*)twinArray[i].twinVar);
 				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_FLOAT, true);
 				break;
@@ -51,12 +51,26 @@
 #include "lsm6dso_reg.h"
 #include "lps22hh_reg.h"
 #include "mcp23x17.h"
+#include "sensor_stats.h"
+#include "sensor_fusion.h"
+#include "motion_detect.h"
+#include "power_governor.h"
+#include "altitude.h"
+#include "pressure_acq.h"
+#include "baro_trend.h"
+
+// The sensor hub reads at most this many bytes from a slave in one operation
+#define LSM6DSO_SH_MAX_READ 7
+
+// Slaves the sensor hub points at the LPS22HH FIFO output in one operation.  The 18 sensor hub
+// output registers, less the byte our block skips, hold three 5 byte FIFO slots.
+#define LSM6DSO_SH_FIFO_SLAVES 3
+#define LPS22HH_FIFO_SLOT_SIZE 5
 
 /* Private variables ---------------------------------------------------------*/
 static axis3bit16_t data_raw_acceleration;
 static axis3bit16_t data_raw_angular_rate;
 static axis3bit16_t raw_angular_rate_calibration;
-static axis1bit32_t data_raw_pressure;
 static axis1bit16_t data_raw_temperature;
 static float acceleration_mg[3];
 static float angular_rate_dps[3];
@@ -66,6 +80,7 @@ static float lps22hhTemperature_degC;
 
 static uint8_t whoamI, rst;
 static int accelTimerFd = -1;
+static int imuFifoTimerFd = -1;
 const uint8_t lsm6dsOAddress = LSM6DSO_ADDRESS;     // Addr = 0x6A
 lsm6dso_ctx_t dev_ctx;
 lps22hh_ctx_t pressure_ctx;
@@ -73,6 +88,20 @@ mcp23x17_ctx_t mcp23x17_ctx;
 
 float altitude;
 
+// Summary statistics of the sensor reads since the last telemetry message
+static sensor_window_t sensorWindow;
+
+// Orientation estimate fed from the LSM6DSO FIFO
+static sensor_fusion_t sensorFusion;
+static imu_sample_t imuSample;
+
+// Pressure samples collected since the last read, and their altitudes
+static pressure_block_t pressureBlock;
+static float pressureAltitude_m[PRESSURE_FIFO_DEPTH];
+
+// Pressure history for the weather trend
+static baro_trend_t baroTrend;
+
 // Status variables
 uint8_t lsm6dso_status = 1;
 uint8_t lps22hh_status = 1;
@@ -93,11 +122,17 @@ static int32_t platform_read(int *fD, uint8_t reg, uint8_t *bufp, uint16_t len);
 // Routines to read/write to the LPS22HH device connected to the LSM6DSO sensor hub
 static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
+static int32_t SensorHubRead(const lsm6dso_sh_cfg_read_t* slaves, uint8_t slaveCount, uint8_t* data);
 
 // Routines to read/write to the MCP23X17 device connected to I2C
 static uint8_t mcp23x17_read_cx(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint8_t len);
 static uint8_t mcp23x17_write_cx(mcp23x17_ctx_t* ctx, uint8_t reg, uint8_t* data, uint8_t len);
 
+static void DrainImuFifo(void);
+static void ImuFifoTimerEventHandler(EventData* eventData);
+static void PowerProfileChanged(power_profile_t profile);
+static void SendBaroTrendEvent(void);
+
 /// <summary>
 ///     Sleep for delayTime ms
 /// </summary>
@@ -114,11 +149,7 @@ void HAL_Delay(int delayTime) {
 void AccelTimerEventHandler(EventData *eventData)
 {
 	uint8_t reg;
-	lps22hh_reg_t lps22hhReg;
-
-#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 	static bool firstPass = true;
-#endif
 	// Consume the event.  If we don't do this we'll come right back
 	// to process the same event again
 	if (ConsumeTimerFdEvent(accelTimerFd) != 0) {
@@ -126,6 +157,15 @@ void AccelTimerEventHandler(EventData *eventData)
 		return;
 	}
 
+	// Pick up expired burst requests and twin changes before reading anything
+	power_governor_update();
+
+	// In idle the sensors are left alone: wakeups come from the motion_detect INT1 events, which
+	// move the governor out of idle before this handler reads anything again
+	if (power_governor_profile() == POWER_PROFILE_IDLE) {
+		return;
+	}
+
 	// Read the sensors on the lsm6dso device
 
 	//Read output only if new xl value is available
@@ -142,6 +182,13 @@ void AccelTimerEventHandler(EventData *eventData)
 
 		Log_Debug("\nLSM6DSO: Acceleration [mg]  : %.4lf, %.4lf, %.4lf\n",
 			acceleration_mg[0], acceleration_mg[1], acceleration_mg[2]);
+
+		// We've seen that the first read of the Accelerometer data is garbage, keep it out of the statistics.
+		if (!firstPass) {
+			sensor_window_add(&sensorWindow, STATS_ACCEL_X, acceleration_mg[0]);
+			sensor_window_add(&sensorWindow, STATS_ACCEL_Y, acceleration_mg[1]);
+			sensor_window_add(&sensorWindow, STATS_ACCEL_Z, acceleration_mg[2]);
+		}
 	}
 
 	lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
@@ -159,6 +206,11 @@ void AccelTimerEventHandler(EventData *eventData)
 		Log_Debug("LSM6DSO: Angular rate [dps] : %4.2f, %4.2f, %4.2f\r\n",
 			angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2]);
 
+		if (!firstPass) {
+			sensor_window_add(&sensorWindow, STATS_GYRO_X, angular_rate_dps[0]);
+			sensor_window_add(&sensorWindow, STATS_GYRO_Y, angular_rate_dps[1]);
+			sensor_window_add(&sensorWindow, STATS_GYRO_Z, angular_rate_dps[2]);
+		}
 	}
 
 	lsm6dso_temp_flag_data_ready_get(&dev_ctx, &reg);
@@ -170,27 +222,50 @@ void AccelTimerEventHandler(EventData *eventData)
 		lsm6dsoTemperature_degC = lsm6dso_from_lsb_to_celsius(data_raw_temperature.i16bit);
 
 		Log_Debug("LSM6DSO: Temperature1 [degC]: %.2f\r\n", lsm6dsoTemperature_degC);
-	}
 
-	// Read the sensors on the lsm6dso device
-
-	lps22hh_read_reg(&pressure_ctx, LPS22HH_STATUS, (uint8_t *)&lps22hhReg, 1);
+		if (!firstPass) {
+			sensor_window_add(&sensorWindow, STATS_TEMPERATURE, lsm6dsoTemperature_degC);
+		}
+	}
 
-	//Read output only if new value is available
+	// Read the sensors on the lps22hh device
 
-	if ((lps22hhReg.status.p_da == 1) && (lps22hhReg.status.t_da == 1))
+	if (pressure_acq_read(&pressureBlock) > 0)
 	{
-		memset(data_raw_pressure.u8bit, 0x00, sizeof(int32_t));
-		lps22hh_pressure_raw_get(&pressure_ctx, data_raw_pressure.u8bit);
+		uint32_t newest = pressureBlock.count - 1;
+		pressure_hPa = pressureBlock.pressure_hPa[newest];
+		lps22hhTemperature_degC = pressureBlock.temperature_degC[newest];
 
-		pressure_hPa = lps22hh_from_lsb_to_hpa((uint32_t)data_raw_pressure.i32bit);
+		Log_Debug("LPS22HH: Pressure     [hPa] : %.2f (%u samples)\r\n", pressure_hPa, pressureBlock.count);
+		Log_Debug("LPS22HH: Temperature2 [degC]: %.2f\r\n", lps22hhTemperature_degC);
 
-		memset(data_raw_temperature.u8bit, 0x00, sizeof(int16_t));
-		lps22hh_temperature_raw_get(&pressure_ctx, data_raw_temperature.u8bit);
-		lps22hhTemperature_degC = lps22hh_from_lsb_to_celsius(data_raw_temperature.i16bit);
+		/*
+		The ALTITUDE value calculated is actually "Pressure Altitude". This lacks correction for temperature (and humidity)
+		"pressure altitude" calculator located at: https://www.weather.gov/epz/wxcalc_pressurealtitude
+		"pressure altitude" formula is defined at: https://www.weather.gov/media/epz/wxcalc/pressureAltitude.pdf
+		 altitude in feet = 145366.45 * (1 - (hPa / 1013.25) ^ 0.190284) feet
+		 altitude in meters = 145366.45 * 0.3048 * (1 - (hPa / 1013.25) ^ 0.190284) meters
+		*/
+		// weather.com formula
+		//altitude = 44307.69396 * (1 - powf((atm / 1013.25), 0.190284));  // pressure altitude in meters
+		// Bosch's formula, using the sea level pressure from the device twin.  Report the average over the block.
+		float altitudeSum = 0.0f;
+		altitude_from_pressure_block(pressureBlock.pressure_hPa, pressureAltitude_m, pressureBlock.count);
+		for (uint32_t i = 0; i < pressureBlock.count; i++) {
+			altitudeSum += pressureAltitude_m[i];
+		}
+		altitude = altitudeSum / (float)pressureBlock.count;  // pressure altitude in meters
 
-		Log_Debug("LPS22HH: Pressure     [hPa] : %.2f\r\n", pressure_hPa);
-		Log_Debug("LPS22HH: Temperature2 [degC]: %.2f\r\n", lps22hhTemperature_degC);
+		if (!firstPass) {
+			sensor_stats_add_block(&sensorWindow.channel[STATS_PRESSURE], pressureBlock.pressure_hPa, pressureBlock.count);
+		}
+
+		// Only tell Azure about the pressure trend when it changes
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (baro_trend_add_block(&baroTrend, pressureBlock.pressure_hPa, pressureBlock.count, now.tv_sec)) {
+			SendBaroTrendEvent();
+		}
 	}
 
 
@@ -204,49 +279,128 @@ void AccelTimerEventHandler(EventData *eventData)
 	sensor_data.lps22hhpressure_hPa = pressure_hPa;
 	sensor_data.lps22hhTemperature_degC = lps22hhTemperature_degC;
 
-	/*
-	The ALTITUDE value calculated is actually "Pressure Altitude". This lacks correction for temperature (and humidity)
-	"pressure altitude" calculator located at: https://www.weather.gov/epz/wxcalc_pressurealtitude
-	"pressure altitude" formula is defined at: https://www.weather.gov/media/epz/wxcalc/pressureAltitude.pdf
-	 altitude in feet = 145366.45 * (1 - (hPa / 1013.25) ^ 0.190284) feet
-	 altitude in meters = 145366.45 * 0.3048 * (1 - (hPa / 1013.25) ^ 0.190284) meters
-	*/
-	// weather.com formula
-	//altitude = 44307.69396 * (1 - powf((atm / 1013.25), 0.190284));  // pressure altitude in meters
-	// Bosch's formula
-	altitude = 44330 * (1 - powf((pressure_hPa / 1013.25), 1 / 5.255));  // pressure altitude in meters
-
 	Log_Debug("ALSPT19: Ambient Light[Lux] : %.2f\r\n", light_sensor);
 
 	//// OLED
 	update_oled();
 
-#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	// The first pass is not part of any window.  After that, only report once the window is complete.
+	if (firstPass) {
+		firstPass = false;
+		return;
+	}
+
+	if (!sensor_window_tick(&sensorWindow)) {
+		return;
+	}
 
-	// We've seen that the first read of the Accelerometer data is garbage.  If this is the first pass
-	// reading data, don't report it to Azure.  Since we're graphing data in Azure, this data point
-	// will skew the data.
-	if (!firstPass) {
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 
-		// Allocate memory for a telemetry message to Azure
-		char *pjsonBuffer = (char *)malloc(JSON_BUFFER_SIZE);
-		if (pjsonBuffer == NULL) {
-			Log_Debug("ERROR: not enough memory to send telemetry");
-		}
+	// Allocate memory for a telemetry message to Azure
+	char *pjsonBuffer = (char *)malloc(SENSOR_STATS_JSON_BUFFER_SIZE);
+	if (pjsonBuffer == NULL) {
+		Log_Debug("ERROR: not enough memory to send telemetry");
+	}
+	else {
 
-		snprintf(pjsonBuffer, JSON_BUFFER_SIZE, "{\"gX\":\"%.2lf\", \"gY\":\"%.2lf\", \"gZ\":\"%.2lf\", \"aX\": \"%.2f\", \"aY\": \"%.2f\", \"aZ\": \"%.2f\", \"pressure\": \"%.2f\", \"light_intensity\": \"%.2f\", \"altitude\": \"%.2f\", \"temp\": \"%.2f\",  \"rssi\": \"%d\"}",
-			angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2], acceleration_mg[0], acceleration_mg[1], acceleration_mg[2], pressure_hPa, light_sensor, altitude, lsm6dsoTemperature_degC, network_data.rssi);
+		// Summaries of the window, followed by the values that are only meaningful as the latest reading
+		pjsonBuffer[0] = '{';
+		int len = sensor_window_to_json(&sensorWindow, pjsonBuffer + 1, SENSOR_STATS_JSON_BUFFER_SIZE - 1);
+		if (len >= 0) {
+			snprintf(pjsonBuffer + 1 + len, SENSOR_STATS_JSON_BUFFER_SIZE - 1 - (size_t)len, "%s\"light_intensity\": \"%.2f\", \"altitude\": \"%.2f\", \"rssi\": \"%d\", \"pressure_overruns\": \"%u\"}",
+				(len > 0) ? ", " : "", light_sensor, altitude, network_data.rssi, pressureBlock.overruns);
 
-		Log_Debug("\n[Info] Sending telemetry: %s\n", pjsonBuffer);
-		AzureIoT_SendMessage(pjsonBuffer);
+			Log_Debug("\n[Info] Sending telemetry: %s\n", pjsonBuffer);
+			AzureIoT_SendMessage(pjsonBuffer);
+		}
+		else {
+			Log_Debug("ERROR: telemetry summary does not fit in the message buffer\n");
+		}
 		free(pjsonBuffer);
+	}
+
+#endif
 
+	sensor_window_restart(&sensorWindow);
 }
 
-	firstPass = false;
+/// <summary>
+///     Sends the new barometric trend classification to Azure.
+/// </summary>
+static void SendBaroTrendEvent(void)
+{
+	char eventBuffer[128];
 
+	snprintf(eventBuffer, sizeof(eventBuffer), "{\"baroTrend\": \"%s\", \"baroSlope1h\": \"%.2f\", \"baroSlope3h\": \"%.2f\"}",
+		baro_trend_name(baroTrend.trend), baro_trend_short_slope(&baroTrend), baro_trend_long_slope(&baroTrend));
+	Log_Debug("LPS22HH: Pressure trend changed: %s\n", eventBuffer);
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	AzureIoT_SendMessage(eventBuffer);
 #endif
+}
+
+/// <summary>
+///     Reads every word queued in the LSM6DSO FIFO and runs the sensor fusion filter on the gyro samples.  If the
+///     device has been tilted since the last report, an orientation event is sent to Azure.
+/// </summary>
+static void DrainImuFifo(void)
+{
+	uint16_t level = 0;
+	uint8_t word[1 + 6];
+
+	if (lsm6dso_fifo_data_level_get(&dev_ctx, &level) != 0) {
+		return;
+	}
+
+	while (level-- > 0) {
+
+		// One FIFO word is the tag byte followed by six data bytes.  Read them in a single burst.
+		if (platform_read(&i2cFd, LSM6DSO_FIFO_DATA_OUT_TAG, word, sizeof(word)) != 0) {
+			return;
+		}
+
+		int16_t x = (int16_t)(word[1] | (word[2] << 8));
+		int16_t y = (int16_t)(word[3] | (word[4] << 8));
+		int16_t z = (int16_t)(word[5] | (word[6] << 8));
 
+		switch (word[0] >> 3) {
+
+		case LSM6DSO_TIMESTAMP_TAG:
+			// 25us per timestamp LSB.  Wrapping is fine, the filter only uses differences.
+			imuSample.timestamp_us = (uint32_t)(word[1] | (word[2] << 8) | (word[3] << 16) | ((uint32_t)word[4] << 24)) * 25U;
+			break;
+
+		case LSM6DSO_XL_NC_TAG:
+			imuSample.accel[0] = x;
+			imuSample.accel[1] = y;
+			imuSample.accel[2] = z;
+			break;
+
+		case LSM6DSO_GYRO_NC_TAG:
+			imuSample.gyro[0] = (int16_t)(x - raw_angular_rate_calibration.i16bit[0]);
+			imuSample.gyro[1] = (int16_t)(y - raw_angular_rate_calibration.i16bit[1]);
+			imuSample.gyro[2] = (int16_t)(z - raw_angular_rate_calibration.i16bit[2]);
+			sensor_fusion_update(&sensorFusion, &imuSample);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (sensor_fusion_orientation_changed(&sensorFusion)) {
+
+		float roll, pitch;
+		sensor_fusion_get_tilt(&sensorFusion, &roll, &pitch);
+		Log_Debug("LSM6DSO: Orientation changed, roll %.1f pitch %.1f\n", roll, pitch);
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+		char eventBuffer[128];
+		snprintf(eventBuffer, sizeof(eventBuffer), "{\"orientationEvent\": \"tilt\", \"roll\": \"%.1f\", \"pitch\": \"%.1f\"}", roll, pitch);
+		AzureIoT_SendMessage(eventBuffer);
+#endif
+	}
 }
 
 /// <summary>
@@ -495,6 +649,35 @@ int initI2c(void) {
 
 	Log_Debug("LSM6DSO: Calibrating angular rate complete!\n");
 
+	// Timestamp the accelerometer and gyro samples batched into the FIFO for the sensor fusion filter.  The
+	// batch rates follow the power profile.  Stream mode keeps the newest samples if we fall behind.
+	lsm6dso_fifo_timestamp_decimation_set(&dev_ctx, LSM6DSO_DEC_1);
+	lsm6dso_timestamp_set(&dev_ctx, PROPERTY_ENABLE);
+	lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_STREAM_MODE);
+
+	sensor_fusion_init(&sensorFusion);
+
+	// Collect pressure in the mode selected in build_options.h
+	if (pressure_acq_init(&pressure_ctx) != 0) {
+		return -1;
+	}
+
+	// From here on the power governor owns the output data rates and power modes
+	power_governor_init(&dev_ctx, &pressure_ctx, PowerProfileChanged);
+
+	// Hand motion and tamper detection to the sensor's embedded engines
+	if (motion_detect_init(&dev_ctx) != 0) {
+		return -1;
+	}
+
+#ifdef SENSOR_FUSION_BENCHMARK
+	Log_Debug("Sensor fusion: %u ns per update\n", sensor_fusion_benchmark(10000));
+#endif
+
+
+	// Open the first statistics window
+	sensor_window_init(&sensorWindow);
+	baro_trend_init(&baroTrend);
 
 	// Init the epoll interface to periodically run the AccelTimerEventHandler routine where we read the sensors
 
@@ -507,9 +690,48 @@ int initI2c(void) {
 		return -1;
 	}
 
+	// The FIFO is drained at the pace of the running power profile, see PowerProfileChanged()
+	uint32_t drainMs = power_governor_fifo_drain_ms();
+	struct timespec imuFifoPeriod = { .tv_sec = drainMs / 1000, .tv_nsec = (drainMs % 1000) * 1000000 };
+	static EventData imuFifoEventData = { .eventHandler = &ImuFifoTimerEventHandler };
+	imuFifoTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &imuFifoPeriod, &imuFifoEventData, EPOLLIN);
+	if (imuFifoTimerFd < 0) {
+		return -1;
+	}
+
 	return 0;
 }
 
+/// <summary>
+///     Runs the orientation filter over everything the IMU batched since the last pass.
+/// </summary>
+static void ImuFifoTimerEventHandler(EventData* eventData)
+{
+	if (ConsumeTimerFdEvent(imuFifoTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	DrainImuFifo();
+}
+
+/// <summary>
+///     Power governor callback: a burst batches the FIFO faster, so it must be drained more often, and
+///     idle batches nothing.  What is queued at the old rate is drained first.
+/// </summary>
+static void PowerProfileChanged(power_profile_t profile)
+{
+	if (imuFifoTimerFd < 0) {
+		return;
+	}
+
+	DrainImuFifo();
+
+	uint32_t drainMs = power_governor_fifo_drain_ms();
+	struct timespec imuFifoPeriod = { .tv_sec = drainMs / 1000, .tv_nsec = (drainMs % 1000) * 1000000 };
+	SetTimerFdToPeriod(imuFifoTimerFd, &imuFifoPeriod);
+}
+
 /// <summary>
 ///     Closes the I2C interface File Descriptors.
 /// </summary>
@@ -517,6 +739,9 @@ void closeI2c(void) {
 
 	CloseFdAndPrintError(i2cFd, "i2c");
 	CloseFdAndPrintError(accelTimerFd, "accelTimer");
+	CloseFdAndPrintError(imuFifoTimerFd, "imuFifoTimer");
+	motion_detect_close();
+	pressure_acq_close();
 }
 
 /// <summary>
@@ -670,6 +895,75 @@ static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data,
 	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
 	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
 
+	/* Put the accelerometer back at the rate the power governor selected */
+	lsm6dso_xl_data_rate_set(&dev_ctx, power_governor_xl_odr());
+
+	return ret;
+}
+
+/// <summary>
+///     Runs one sensor hub operation reading up to LSM6DSO_SH_FIFO_SLAVES slaves, and copies what
+///     they read, in slave order, to data.  Leaves the accelerometer off.
+/// </summary>
+static int32_t SensorHubRead(const lsm6dso_sh_cfg_read_t* slaves, uint8_t slaveCount, uint8_t* data)
+{
+	static int32_t(* const slaveConfig[LSM6DSO_SH_FIFO_SLAVES])(lsm6dso_ctx_t*, lsm6dso_sh_cfg_read_t*) = {
+		lsm6dso_sh_slv0_cfg_read, lsm6dso_sh_slv1_cfg_read, lsm6dso_sh_slv2_cfg_read
+	};
+	axis3bit16_t data_raw_acceleration;
+	int32_t ret = 0;
+	uint8_t drdy;
+	lsm6dso_status_master_t master_status;
+	uint8_t total = 0;
+
+	/* Configure Sensor Hub to read LPS22HH. */
+	for (uint8_t slave = 0; (slave < slaveCount) && (ret == 0); slave++) {
+		lsm6dso_sh_cfg_read_t config = slaves[slave];
+		ret = slaveConfig[slave](&dev_ctx, &config);
+		total += slaves[slave].slv_len;
+	}
+	if (ret != 0) {
+		return ret;
+	}
+	lsm6dso_sh_slave_connected_set(&dev_ctx, (lsm6dso_aux_sens_on_t)(LSM6DSO_SLV_0 + slaveCount - 1));
+
+	/* Enable I2C Master and I2C master. */
+	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
+
+	/* Enable accelerometer to trigger Sensor Hub operation. */
+	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
+
+	/* Wait Sensor Hub operation flag set. */
+	lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
+	do {
+		HAL_Delay(20);
+		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
+	} while (!drdy);
+
+	do {
+		HAL_Delay(20);
+		lsm6dso_sh_status_get(&dev_ctx, &master_status);
+	} while (!master_status.sens_hub_endop);
+
+	/* Disable I2C master and XL(trigger). */
+	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
+	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
+
+	// Back to one slave, or the next register write would also pop FIFO slots
+	if (slaveCount > 1) {
+		lsm6dso_sh_slave_connected_set(&dev_ctx, LSM6DSO_SLV_0);
+	}
+
+	// Read the data from the device.  The call below reads
+	// all 18 sensor hub data.  Our block starts at the data
+	// from sensor hub 1, so copy that into our data array.
+	// Each slave's data follow the previous slave's.
+	uint8_t buffer[18];
+	lsm6dso_sh_read_data_raw_get(&dev_ctx, (lsm6dso_emb_sh_read_t*)buffer);
+	for (int j = 0; j < total; j++) {
+		data[j] = buffer[1 + j];
+	}
+
 	return ret;
 }
 
@@ -685,69 +979,54 @@ static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data,
  */
 static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len)
 {
-	lsm6dso_sh_cfg_read_t sh_cfg_read;
-	axis3bit16_t data_raw_acceleration;
-	int32_t ret;
-	uint8_t drdy;
-	lsm6dso_status_master_t master_status;
+	lsm6dso_sh_cfg_read_t slaves[LSM6DSO_SH_FIFO_SLAVES];
+	int32_t ret = 0;
 
 	/* Disable accelerometer. */
 	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
 
-	// For each byte we need to read from the lps22hh
-	for (int i = 0; i < len; i++) {
+	for (uint16_t i = 0; (i < len) && (ret == 0); ) {
 
-		/* Configure Sensor Hub to read LPS22HH. */
-		sh_cfg_read.slv_add = (LPS22HH_I2C_ADD_L &0xFEU) >> 1; /* 7bit I2C address */
-		sh_cfg_read.slv_subadd = reg+i;
-		sh_cfg_read.slv_len = 1;
-
-		// Call the command to read the data from the sensor hub.
-		// This data will be read from the device connected to the
-		// sensor hub, and saved into a register for us to read.
-		ret = lsm6dso_sh_slv0_cfg_read(&dev_ctx, &sh_cfg_read);
-		lsm6dso_sh_slave_connected_set(&dev_ctx, LSM6DSO_SLV_0);
+		uint8_t slaveCount = 1;
 
-		/* Enable I2C Master and I2C master. */
-		lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
+		slaves[0].slv_add = (LPS22HH_I2C_ADD_L & 0xFEU) >> 1; /* 7bit I2C address */
 
-		/* Enable accelerometer to trigger Sensor Hub operation. */
-		lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
+		if ((reg == LPS22HH_FIFO_DATA_OUT_PRESS_XL) && ((len - i) >= LPS22HH_FIFO_SLOT_SIZE)) {
 
-		/* Wait Sensor Hub operation flag set. */
-		lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
-		do {
-			HAL_Delay(20);
-			lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
-		} while (!drdy);
-
-		do {
-			HAL_Delay(20);
-			lsm6dso_sh_status_get(&dev_ctx, &master_status);
-		} while (!master_status.sens_hub_endop);
-
-		/* Disable I2C master and XL(trigger). */
-		lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
-		lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
+			// Each read of a whole slot pops it from the LPS22HH FIFO, so every slave reads the same
+			// registers and one sensor hub operation brings back up to LSM6DSO_SH_FIFO_SLAVES slots
+			slaveCount = (uint8_t)((len - i) / LPS22HH_FIFO_SLOT_SIZE);
+			if (slaveCount > LSM6DSO_SH_FIFO_SLAVES) {
+				slaveCount = LSM6DSO_SH_FIFO_SLAVES;
+			}
+			for (uint8_t slave = 0; slave < slaveCount; slave++) {
+				slaves[slave].slv_add = slaves[0].slv_add;
+				slaves[slave].slv_subadd = reg;
+				slaves[slave].slv_len = LPS22HH_FIFO_SLOT_SIZE;
+			}
+		}
+		else {
+			// Up to LSM6DSO_SH_MAX_READ consecutive registers per sensor hub operation
+			slaves[0].slv_subadd = (uint8_t)(reg + i);
+			slaves[0].slv_len = (uint8_t)(((len - i) < LSM6DSO_SH_MAX_READ) ? (len - i) : LSM6DSO_SH_MAX_READ);
+		}
 
-		// Read the data from the device.  The call below reads
-		// all 18 sensor hub data.  We just need the data from
-		// sensor hub 1, so copy that into our data array.
-		uint8_t buffer[18];
-		lsm6dso_sh_read_data_raw_get(&dev_ctx, buffer);
-		data[i] = buffer[1];
+		ret = SensorHubRead(slaves, slaveCount, &data[i]);
+		for (uint8_t slave = 0; slave < slaveCount; slave++) {
+			i += slaves[slave].slv_len;
+		}
+	}
 
 #ifdef ENABLE_READ_WRITE_DEBUG
-		Log_Debug("Read %d bytes: ", len);
-		for (int i = 0; i < len; i++) {
-			Log_Debug("[%0x] ", data[i]);
-		}
-		Log_Debug("\n", len);
-#endif
+	Log_Debug("Read %d bytes: ", len);
+	for (int i = 0; i < len; i++) {
+		Log_Debug("[%0x] ", data[i]);
 	}
+	Log_Debug("\n", len);
+#endif
 
-	/* Re-enable accelerometer */
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
+	/* Re-enable accelerometer at the rate the power governor selected */
+	lsm6dso_xl_data_rate_set(&dev_ctx, power_governor_xl_odr());
 
 	return ret;
 }
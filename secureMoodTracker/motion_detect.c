@@ -0,0 +1,204 @@
+/***************************************************************************************************
+   Name: motion_detect.c
+
+   Motion and tamper detection using the LSM6DSO embedded engines.  Wake-up, activity/inactivity,
+   single/double tap, free-fall and 6D orientation are all evaluated inside the sensor and routed
+   to INT1.  The application only samples the INT1 GPIO, and reads the interrupt sources over I2C
+   when the line is asserted, so an idle device costs no per-sample bus traffic.
+****************************************************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+
+#include <applibs/log.h>
+#include <applibs/gpio.h>
+
+#include "mt3620_avnet_dev.h"
+#include "epoll_timerfd_utilities.h"
+#include "azure_iot_utilities.h"
+#include "build_options.h"
+#include "motion_detect.h"
+#include "power_governor.h"
+
+static lsm6dso_ctx_t* motionCtx = NULL;
+static int motionIntGpioFd = -1;
+static int motionPollTimerFd = -1;
+static bool motionActive = true;
+
+extern int epollFd;
+extern volatile sig_atomic_t terminationRequired;
+
+static const char cstrMotionEventJson[] = "{\"motionEvent\": \"%s\"%s}";
+
+// 6D position names, indexed by the bit set in D6D_SRC (XL, XH, YL, YH, ZL, ZH)
+static const char* const sixDPositions[6] = { "x_down", "x_up", "y_down", "y_up", "z_down", "z_up" };
+
+/// <summary>
+///     Sends one motion event to Azure, with optional extra key/value pairs already formatted as JSON.
+/// </summary>
+static void SendMotionEvent(const char* eventName, const char* extra)
+{
+	char eventBuffer[128];
+
+	snprintf(eventBuffer, sizeof(eventBuffer), cstrMotionEventJson, eventName, extra);
+	Log_Debug("LSM6DSO: %s\n", eventBuffer);
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	AzureIoT_SendMessage(eventBuffer);
+#endif
+}
+
+/// <summary>
+///     Reads the latched interrupt sources and turns each one into an event.
+/// </summary>
+static void ReadMotionSources(void)
+{
+	lsm6dso_all_sources_t sources;
+	char extra[64];
+
+	if (lsm6dso_all_sources_get(motionCtx, &sources) != 0) {
+		return;
+	}
+
+	if (sources.wake_up_src.sleep_change_ia) {
+		motionActive = (sources.wake_up_src.sleep_state == 0);
+		SendMotionEvent(motionActive ? "activity" : "inactivity", "");
+
+		// Let the power governor follow the activity state right away
+		power_governor_update();
+	}
+
+	if (sources.all_int_src.wu_ia) {
+		snprintf(extra, sizeof(extra), ", \"x\": \"%d\", \"y\": \"%d\", \"z\": \"%d\"",
+			sources.wake_up_src.x_wu, sources.wake_up_src.y_wu, sources.wake_up_src.z_wu);
+		SendMotionEvent("wakeup", extra);
+	}
+
+	if (sources.all_int_src.single_tap || sources.all_int_src.double_tap) {
+		const char* axis = sources.tap_src.x_tap ? "x" : (sources.tap_src.y_tap ? "y" : "z");
+		snprintf(extra, sizeof(extra), ", \"axis\": \"%s\", \"sign\": \"%s\"", axis, sources.tap_src.tap_sign ? "-" : "+");
+		SendMotionEvent(sources.all_int_src.double_tap ? "double_tap" : "single_tap", extra);
+
+		// Capture what happens after a knock at full rate
+		power_governor_request(GOVERNOR_CONSUMER_MOTION, POWER_PROFILE_BURST, POWER_GOVERNOR_DEFAULT_BURST_SECONDS);
+	}
+
+	if (sources.all_int_src.ff_ia) {
+		SendMotionEvent("free_fall", "");
+		power_governor_request(GOVERNOR_CONSUMER_MOTION, POWER_PROFILE_BURST, POWER_GOVERNOR_DEFAULT_BURST_SECONDS);
+	}
+
+	if (sources.all_int_src.d6d_ia) {
+		uint8_t positions = *(uint8_t*)&sources.d6d_src & 0x3F;
+		for (int i = 0; i < 6; i++) {
+			if (positions & (1 << i)) {
+				snprintf(extra, sizeof(extra), ", \"position\": \"%s\"", sixDPositions[i]);
+				SendMotionEvent("orientation", extra);
+				break;
+			}
+		}
+	}
+}
+
+/// <summary>
+///     Samples the INT1 line and reads the sources only when the sensor has something to report.
+/// </summary>
+static void MotionPollTimerEventHandler(EventData* eventData)
+{
+	GPIO_Value_Type intState;
+
+	if (ConsumeTimerFdEvent(motionPollTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	if (GPIO_GetValue(motionIntGpioFd, &intState) != 0) {
+		Log_Debug("ERROR: Could not read LSM6DSO INT1 GPIO: %s (%d).\n", strerror(errno), errno);
+		return;
+	}
+
+	if (intState == GPIO_Value_High) {
+		ReadMotionSources();
+	}
+}
+
+static EventData motionPollEventData = { .eventHandler = &MotionPollTimerEventHandler };
+
+int motion_detect_init(lsm6dso_ctx_t* ctx)
+{
+	lsm6dso_pin_int1_route_t int1Route;
+
+	motionCtx = ctx;
+
+	// Wake-up and activity/inactivity share the wake-up threshold
+	lsm6dso_wkup_ths_weight_set(ctx, LSM6DSO_LSb_FS_DIV_64);
+	lsm6dso_wkup_threshold_set(ctx, MOTION_WAKEUP_THRESHOLD);
+	lsm6dso_wkup_dur_set(ctx, MOTION_WAKEUP_DURATION);
+	lsm6dso_act_sleep_dur_set(ctx, MOTION_SLEEP_DURATION);
+	lsm6dso_act_mode_set(ctx, LSM6DSO_XL_AND_GY_NOT_AFFECTED);
+
+	// Single and double tap on all axes
+	lsm6dso_tap_detection_on_x_set(ctx, PROPERTY_ENABLE);
+	lsm6dso_tap_detection_on_y_set(ctx, PROPERTY_ENABLE);
+	lsm6dso_tap_detection_on_z_set(ctx, PROPERTY_ENABLE);
+	lsm6dso_tap_threshold_x_set(ctx, MOTION_TAP_THRESHOLD);
+	lsm6dso_tap_threshold_y_set(ctx, MOTION_TAP_THRESHOLD);
+	lsm6dso_tap_threshold_z_set(ctx, MOTION_TAP_THRESHOLD);
+	lsm6dso_tap_axis_priority_set(ctx, LSM6DSO_XYZ);
+	lsm6dso_tap_shock_set(ctx, MOTION_TAP_SHOCK);
+	lsm6dso_tap_quiet_set(ctx, MOTION_TAP_QUIET);
+	lsm6dso_tap_dur_set(ctx, MOTION_TAP_DURATION);
+	lsm6dso_tap_mode_set(ctx, LSM6DSO_BOTH_SINGLE_DOUBLE);
+
+	// Free-fall and 6D orientation
+	lsm6dso_ff_threshold_set(ctx, MOTION_FREE_FALL_THRESHOLD);
+	lsm6dso_ff_dur_set(ctx, MOTION_FREE_FALL_DURATION);
+	lsm6dso_6d_threshold_set(ctx, MOTION_6D_THRESHOLD);
+
+	// Latch the sources so the line stays asserted until we have read them
+	lsm6dso_int_notification_set(ctx, LSM6DSO_ALL_INT_LATCHED);
+
+	lsm6dso_pin_int1_route_get(ctx, &int1Route);
+	int1Route.md1_cfg.int1_wu = PROPERTY_ENABLE;
+	int1Route.md1_cfg.int1_single_tap = PROPERTY_ENABLE;
+	int1Route.md1_cfg.int1_double_tap = PROPERTY_ENABLE;
+	int1Route.md1_cfg.int1_ff = PROPERTY_ENABLE;
+	int1Route.md1_cfg.int1_6d = PROPERTY_ENABLE;
+	int1Route.md1_cfg.int1_sleep_change = PROPERTY_ENABLE;
+	lsm6dso_pin_int1_route_set(ctx, &int1Route);
+
+	// Clear anything latched while configuring
+	lsm6dso_all_sources_t sources;
+	lsm6dso_all_sources_get(ctx, &sources);
+
+	Log_Debug("Opening LSM6DSO INT1 as input.\n");
+	motionIntGpioFd = GPIO_OpenAsInput(AVT_SK_LSM6DSOTR_INT);
+	if (motionIntGpioFd < 0) {
+		Log_Debug("ERROR: Could not open LSM6DSO INT1 GPIO: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+
+	struct timespec motionPollPeriod = { .tv_sec = 0,.tv_nsec = MOTION_INT_POLL_PERIOD_NANO_SECONDS };
+	motionPollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &motionPollPeriod, &motionPollEventData, EPOLLIN);
+	if (motionPollTimerFd < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void motion_detect_close(void)
+{
+	CloseFdAndPrintError(motionPollTimerFd, "motionPollTimer");
+	CloseFdAndPrintError(motionIntGpioFd, "motionIntGpio");
+}
+
+bool motion_detect_is_active(void)
+{
+	return motionActive;
+}
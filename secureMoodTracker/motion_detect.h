@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lsm6dso_reg.h"
+
+// Engine thresholds.  The accelerometer runs at the 4g full scale set in initI2c().
+#define MOTION_WAKEUP_THRESHOLD		2				// FS/64 per LSB: 125mg
+#define MOTION_WAKEUP_DURATION		0				// 1/ODR per LSB
+// 512/ODR per LSB, with ODR the accelerometer rate the power governor has set, so the time to
+// inactivity stretches as the rate drops: ~10s at 104Hz, ~82s at 12.5Hz
+#define MOTION_SLEEP_DURATION		2
+#define MOTION_TAP_THRESHOLD		8				// FS/32 per LSB: 1g
+#define MOTION_TAP_SHOCK			2
+#define MOTION_TAP_QUIET			1
+#define MOTION_TAP_DURATION			7				// window for the second tap of a double tap
+#define MOTION_FREE_FALL_THRESHOLD	LSM6DSO_FF_TSH_312mg
+#define MOTION_FREE_FALL_DURATION	6				// 1/ODR per LSB
+#define MOTION_6D_THRESHOLD			LSM6DSO_DEG_60
+
+// How often the INT1 line is sampled.  Sources are latched in the sensor, so nothing is lost between
+// samples, and no I2C traffic happens unless the line is asserted.
+#define MOTION_INT_POLL_PERIOD_NANO_SECONDS 20000000
+
+/// <summary>
+///     Configures the LSM6DSO wake-up, activity/inactivity, tap, free-fall and 6D engines, routes them
+///     to INT1 and starts watching the INT1 line.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int motion_detect_init(lsm6dso_ctx_t* ctx);
+void motion_detect_close(void);
+
+/// <summary>
+///     true while the activity/inactivity engine reports the device as moving.
+/// </summary>
+bool motion_detect_is_active(void);
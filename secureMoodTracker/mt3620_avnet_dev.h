@@ -181,6 +181,9 @@
 /// <summary>LSM6DSOTR SLA is GPIO 38.</summary>
 #define AVT_SK_I2C_LSM6DSOTR_SDA2 AVT_MODULE_GPIO38_MISO2_RXD2_SDA2
 
+/// <summary>LSM6DSOTR INT1 is GPIO6.</summary>
+#define AVT_SK_LSM6DSOTR_INT AVT_MODULE_GPIO6_PWM6
+
 
 // Uart defines
 
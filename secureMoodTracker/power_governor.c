@@ -0,0 +1,167 @@
+/***************************************************************************************************
+   Name: power_governor.c
+
+   Chooses the output data rates and power modes of the LSM6DSO and LPS22HH at runtime.  While the
+   device is stationary only the accelerometer runs, in low power mode, so the wake-up engine can
+   still see the next bump.  Motion, the device twin or a consumer asking for a burst capture raise
+   the profile.  The sensors are only reprogrammed when the chosen profile changes.
+****************************************************************************************************/
+
+#include <time.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "power_governor.h"
+#include "motion_detect.h"
+
+int sensorPowerProfile = POWER_PROFILE_IDLE;
+
+// The FIFO batch rates may not exceed the ODRs.  Idle has the gyro off, so the fusion filter has
+// nothing to run on and nothing is batched.  A burst batches at 104Hz, eight times the active
+// rate, and is drained often enough that the FIFO never holds more than about 60 words.
+static const power_profile_settings_t profileSettings[POWER_PROFILE_COUNT] = {
+	// LSM6DSO_XL_ODR_6Hz5 selects 1.6Hz in low power mode
+	[POWER_PROFILE_IDLE] = { LSM6DSO_XL_ODR_6Hz5, LSM6DSO_LOW_NORMAL_POWER_MD, LSM6DSO_GY_ODR_OFF, LSM6DSO_GY_NORMAL, LPS22HH_1_Hz_LOW_NOISE,
+		LSM6DSO_XL_NOT_BATCHED, LSM6DSO_GY_NOT_BATCHED, 0 },
+	[POWER_PROFILE_ACTIVE] = { LSM6DSO_XL_ODR_104Hz, LSM6DSO_LOW_NORMAL_POWER_MD, LSM6DSO_GY_ODR_12Hz5, LSM6DSO_GY_NORMAL, LPS22HH_10_Hz_LOW_NOISE,
+		LSM6DSO_XL_BATCHED_AT_12Hz5, LSM6DSO_GY_BATCHED_AT_12Hz5, 1000 },
+	[POWER_PROFILE_BURST] = { LSM6DSO_XL_ODR_417Hz, LSM6DSO_HIGH_PERFORMANCE_MD, LSM6DSO_GY_ODR_417Hz, LSM6DSO_GY_HIGH_PERFORMANCE, LPS22HH_10_Hz_LOW_NOISE,
+		LSM6DSO_XL_BATCHED_AT_104Hz, LSM6DSO_GY_BATCHED_AT_104Hz, 200 }
+};
+
+static const char* const profileNames[POWER_PROFILE_COUNT] = { "idle", "active", "burst" };
+
+typedef struct {
+	power_profile_t profile;
+	time_t expires;			// 0 if the request does not expire
+} consumer_request_t;
+
+static consumer_request_t consumerRequests[GOVERNOR_CONSUMER_COUNT];
+
+static lsm6dso_ctx_t* governorImuCtx = NULL;
+static lps22hh_ctx_t* governorPressureCtx = NULL;
+static power_governor_changed_t profileChanged = NULL;
+
+// Programmed by power_governor_init()
+static power_profile_t currentProfile = POWER_PROFILE_ACTIVE;
+
+static time_t MonotonicSeconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/// <summary>
+///     Programs the sensors for a profile.
+/// </summary>
+static void ApplyProfile(power_profile_t profile)
+{
+	const power_profile_settings_t* settings = &profileSettings[profile];
+
+	// Switch first, so the sensor hub transfer below restores the new accelerometer ODR
+	currentProfile = profile;
+
+#if (PRESSURE_ACQUISITION_MODE != PRESSURE_MODE_ONE_SHOT)
+	// In one-shot mode the LPS22HH stays powered down and converts on demand
+	lps22hh_data_rate_set(governorPressureCtx, settings->pressureOdr);
+#endif
+
+	lsm6dso_xl_power_mode_set(governorImuCtx, settings->xlPowerMode);
+	lsm6dso_xl_data_rate_set(governorImuCtx, settings->xlOdr);
+	lsm6dso_gy_power_mode_set(governorImuCtx, settings->gyPowerMode);
+	lsm6dso_gy_data_rate_set(governorImuCtx, settings->gyOdr);
+	lsm6dso_fifo_xl_batch_set(governorImuCtx, settings->fifoXlBatch);
+	lsm6dso_fifo_gy_batch_set(governorImuCtx, settings->fifoGyBatch);
+
+	if (profileChanged != NULL) {
+		profileChanged(profile);
+	}
+}
+
+void power_governor_init(lsm6dso_ctx_t* imuCtx, lps22hh_ctx_t* pressureCtx, power_governor_changed_t changed)
+{
+	governorImuCtx = imuCtx;
+	governorPressureCtx = pressureCtx;
+	profileChanged = changed;
+
+	for (int i = 0; i < GOVERNOR_CONSUMER_COUNT; i++) {
+		consumerRequests[i].profile = POWER_PROFILE_IDLE;
+		consumerRequests[i].expires = 0;
+	}
+
+	ApplyProfile(POWER_PROFILE_ACTIVE);
+}
+
+void power_governor_request(governor_consumer_t consumer, power_profile_t profile, uint32_t seconds)
+{
+	if ((consumer >= GOVERNOR_CONSUMER_COUNT) || (profile >= POWER_PROFILE_COUNT)) {
+		return;
+	}
+
+	consumerRequests[consumer].profile = profile;
+	consumerRequests[consumer].expires = (seconds == 0) ? 0 : MonotonicSeconds() + (time_t)seconds;
+
+	power_governor_update();
+}
+
+/// <summary>
+///     Highest profile asked for by anything right now.
+/// </summary>
+static power_profile_t SelectProfile(void)
+{
+	power_profile_t profile = motion_detect_is_active() ? POWER_PROFILE_ACTIVE : POWER_PROFILE_IDLE;
+	time_t now = MonotonicSeconds();
+
+	if ((sensorPowerProfile > (int)profile) && (sensorPowerProfile < POWER_PROFILE_COUNT)) {
+		profile = (power_profile_t)sensorPowerProfile;
+	}
+
+	for (int i = 0; i < GOVERNOR_CONSUMER_COUNT; i++) {
+
+		if ((consumerRequests[i].expires != 0) && (now >= consumerRequests[i].expires)) {
+			consumerRequests[i].profile = POWER_PROFILE_IDLE;
+			consumerRequests[i].expires = 0;
+		}
+
+		if (consumerRequests[i].profile > profile) {
+			profile = consumerRequests[i].profile;
+		}
+	}
+
+	return profile;
+}
+
+void power_governor_update(void)
+{
+	if ((governorImuCtx == NULL) || (governorPressureCtx == NULL)) {
+		return;
+	}
+
+	power_profile_t profile = SelectProfile();
+	if (profile == currentProfile) {
+		return;
+	}
+
+	Log_Debug("Power governor: %s -> %s\n", profileNames[currentProfile], profileNames[profile]);
+	ApplyProfile(profile);
+}
+
+power_profile_t power_governor_profile(void)
+{
+	return currentProfile;
+}
+
+lsm6dso_odr_xl_t power_governor_xl_odr(void)
+{
+	return profileSettings[currentProfile].xlOdr;
+}
+
+uint32_t power_governor_fifo_drain_ms(void)
+{
+	return profileSettings[currentProfile].fifoDrainMs;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lsm6dso_reg.h"
+#include "lps22hh_reg.h"
+
+// How long a burst capture requested by a consumer lasts unless it asks for something else
+#define POWER_GOVERNOR_DEFAULT_BURST_SECONDS 5
+
+/// <summary>
+///     Sensor power profiles, ordered from lowest to highest power.  The governor always runs the
+///     highest profile asked for by the activity state, the device twin or any consumer.
+/// </summary>
+typedef enum {
+	POWER_PROFILE_IDLE = 0,		// accelerometer only, low power; gyro off
+	POWER_PROFILE_ACTIVE,		// accelerometer and gyro at the normal telemetry rate
+	POWER_PROFILE_BURST,		// both at high ODR in high performance mode
+	POWER_PROFILE_COUNT
+} power_profile_t;
+
+typedef enum {
+	GOVERNOR_CONSUMER_MOTION = 0,	// motion events asking for a short high rate capture
+	GOVERNOR_CONSUMER_COUNT
+} governor_consumer_t;
+
+typedef struct {
+	lsm6dso_odr_xl_t xlOdr;
+	lsm6dso_xl_hm_mode_t xlPowerMode;
+	lsm6dso_odr_g_t gyOdr;
+	lsm6dso_g_hm_mode_t gyPowerMode;
+	lps22hh_odr_t pressureOdr;
+	lsm6dso_bdr_xl_t fifoXlBatch;	// rates the sensor fusion samples are batched into the FIFO at
+	lsm6dso_bdr_gy_t fifoGyBatch;
+	uint32_t fifoDrainMs;			// how often the FIFO is drained, 0 when nothing is batched
+} power_profile_settings_t;
+
+/// <summary>
+///     Called after the sensors have been switched to a new profile, so the FIFO drain can follow.
+/// </summary>
+typedef void (*power_governor_changed_t)(power_profile_t profile);
+
+// Lowest profile requested through the "sensorPowerProfile" device twin property.  0 lets the
+// activity state decide.
+extern int sensorPowerProfile;
+
+/// <summary>
+///     Takes over the sensor rates and programs the active profile, the one the device starts in.
+/// </summary>
+void power_governor_init(lsm6dso_ctx_t* imuCtx, lps22hh_ctx_t* pressureCtx, power_governor_changed_t changed);
+
+/// <summary>
+///     Asks for at least the given profile on behalf of a consumer.  A non zero duration makes the
+///     request expire on its own; POWER_PROFILE_IDLE releases it.
+/// </summary>
+void power_governor_request(governor_consumer_t consumer, power_profile_t profile, uint32_t seconds);
+
+/// <summary>
+///     Works out the profile that should be running and reprograms the sensors if it changed.
+/// </summary>
+void power_governor_update(void);
+
+power_profile_t power_governor_profile(void);
+
+/// <summary>
+///     Accelerometer ODR of the running profile.  Code that has to stop the accelerometer (sensor hub
+///     transfers) restores this value afterward.
+/// </summary>
+lsm6dso_odr_xl_t power_governor_xl_odr(void);
+
+/// <summary>
+///     FIFO drain period of the running profile, in milliseconds; 0 when nothing is batched.
+/// </summary>
+uint32_t power_governor_fifo_drain_ms(void);
@@ -0,0 +1,246 @@
+/***************************************************************************************************
+   Name: pressure_acq.c
+
+   LPS22HH pressure acquisition.  Every LPS22HH access goes through the LSM6DSO sensor hub, and each
+   hub operation costs several I2C transactions on the main bus and a wait for an accelerometer
+   sample to trigger it.  In FIFO mode the LPS22HH keeps every conversion in its own FIFO and we
+   drain it every few ticks with one read of the whole level, which the hub turns into operations
+   of three slots each: at 10Hz and a drain every 5 ticks, 18 operations bring back 50 samples,
+   where the polled mode spends 2 operations on each sample it keeps.  In one-shot mode the
+   LPS22HH stays powered down and converts once per accel period, timed to finish just before the
+   next tick consumes the value.
+****************************************************************************************************/
+
+#include <signal.h>
+#include <string.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "build_options.h"
+#include "pressure_acq.h"
+
+// One FIFO slot: 3 bytes of pressure followed by 2 bytes of temperature
+#define PRESSURE_FIFO_SLOT_SIZE 5
+
+static lps22hh_ctx_t* pressureCtx = NULL;
+
+#if (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_FIFO)
+static uint8_t fifoSlots[PRESSURE_FIFO_DEPTH * PRESSURE_FIFO_SLOT_SIZE];
+#endif
+
+/// <summary>
+///     Converts one 5 byte pressure/temperature record, as laid out in both the output registers and
+///     the FIFO, and appends it to the block.
+/// </summary>
+static void AppendSample(pressure_block_t* block, const uint8_t* raw)
+{
+	uint32_t pressure = (uint32_t)raw[0] | ((uint32_t)raw[1] << 8) | ((uint32_t)raw[2] << 16);
+	int16_t temperature = (int16_t)(raw[3] | (raw[4] << 8));
+
+	block->pressure_hPa[block->count] = lps22hh_from_lsb_to_hpa(pressure);
+	block->temperature_degC[block->count] = lps22hh_from_lsb_to_celsius(temperature);
+	block->count++;
+}
+
+#if (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_ONE_SHOT)
+
+extern int epollFd;
+extern volatile sig_atomic_t terminationRequired;
+
+typedef enum {
+	ONE_SHOT_TRIGGER,		// next expiry starts a conversion
+	ONE_SHOT_READOUT		// next expiry reads the finished conversion
+} one_shot_phase_t;
+
+static int oneShotTimerFd = -1;
+static one_shot_phase_t oneShotPhase = ONE_SHOT_TRIGGER;
+static lps22hh_ctrl_reg2_t oneShotCtrlReg2;
+
+// Conversion finished by the timer, waiting for the next accel tick
+static uint8_t oneShotSample[PRESSURE_FIFO_SLOT_SIZE];
+static bool oneShotSampleReady = false;
+
+static const struct timespec oneShotDisarmed = { 0, 0 };
+
+/// <summary>
+///     Arms the timer to start the next conversion PRESSURE_ONE_SHOT_LEAD_MS before the next accel tick.
+///     Called from the accel tick, so the accel period is the time to the next tick.
+/// </summary>
+static void ScheduleOneShot(void)
+{
+	int64_t delay_ns = (int64_t)ACCEL_READ_PERIOD_SECONDS * 1000000000LL + ACCEL_READ_PERIOD_NANO_SECONDS
+		- (int64_t)PRESSURE_ONE_SHOT_LEAD_MS * 1000000LL;
+
+	if (delay_ns <= 0) {
+		delay_ns = 1;
+	}
+
+	struct timespec expiry = { .tv_sec = (time_t)(delay_ns / 1000000000LL),.tv_nsec = (long)(delay_ns % 1000000000LL) };
+	oneShotPhase = ONE_SHOT_TRIGGER;
+	SetTimerFdToSingleExpiry(oneShotTimerFd, &expiry);
+}
+
+/// <summary>
+///     Starts a conversion, then comes back once it is done to read the result.  Runs on the event loop
+///     so the accel tick never waits for a conversion.
+/// </summary>
+static void OneShotTimerEventHandler(EventData* eventData)
+{
+	if (ConsumeTimerFdEvent(oneShotTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	if (oneShotPhase == ONE_SHOT_TRIGGER) {
+
+		lps22hh_ctrl_reg2_t trigger = oneShotCtrlReg2;
+		trigger.one_shot = 1;
+		lps22hh_write_reg(pressureCtx, LPS22HH_CTRL_REG2, (uint8_t*)&trigger, 1);
+
+		struct timespec conversionTime = { .tv_sec = 0,.tv_nsec = PRESSURE_ONE_SHOT_CONVERSION_MS * 1000000L };
+		oneShotPhase = ONE_SHOT_READOUT;
+		SetTimerFdToSingleExpiry(oneShotTimerFd, &conversionTime);
+		return;
+	}
+
+	// STATUS is followed by PRESS_OUT_XL through TEMP_OUT_H, so one hub operation reads everything
+	uint8_t raw[1 + PRESSURE_FIFO_SLOT_SIZE];
+	if (lps22hh_read_reg(pressureCtx, LPS22HH_STATUS, raw, sizeof(raw)) != 0) {
+		return;
+	}
+
+	lps22hh_status_t status;
+	memcpy(&status, &raw[0], 1);
+	if (status.p_da && status.t_da) {
+		memcpy(oneShotSample, &raw[1], sizeof(oneShotSample));
+		oneShotSampleReady = true;
+	}
+}
+
+static EventData oneShotEventData = { .eventHandler = &OneShotTimerEventHandler };
+
+#endif
+
+int pressure_acq_init(lps22hh_ctx_t* ctx)
+{
+	pressureCtx = ctx;
+
+#if (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_FIFO)
+	// Stream mode keeps the newest samples if a drain is late
+	lps22hh_fifo_watermark_set(ctx, PRESSURE_FIFO_DEPTH - 1);
+	lps22hh_fifo_mode_set(ctx, LPS22HH_STREAM_MODE);
+#elif (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_ONE_SHOT)
+	// Stay powered down between conversions, and keep a copy of CTRL_REG2 so a trigger is a single write
+	lps22hh_data_rate_set(ctx, LPS22HH_POWER_DOWN);
+	lps22hh_read_reg(ctx, LPS22HH_CTRL_REG2, (uint8_t*)&oneShotCtrlReg2, 1);
+	oneShotCtrlReg2.one_shot = 0;
+
+	oneShotTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &oneShotDisarmed, &oneShotEventData, EPOLLIN);
+	if (oneShotTimerFd < 0) {
+		return -1;
+	}
+	ScheduleOneShot();
+#endif
+
+	return 0;
+}
+
+void pressure_acq_close(void)
+{
+#if (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_ONE_SHOT)
+	CloseFdAndPrintError(oneShotTimerFd, "pressureOneShotTimer");
+#endif
+}
+
+#if (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_FIFO)
+
+uint32_t pressure_acq_read(pressure_block_t* block)
+{
+	static uint32_t ticks = 0;
+	lps22hh_fifo_status2_t status;
+	uint8_t level = 0;
+
+	block->count = 0;
+
+	if (++ticks < PRESSURE_FIFO_DRAIN_TICKS) {
+		return 0;
+	}
+	ticks = 0;
+
+	// FIFO_STATUS1 holds the level and FIFO_STATUS2 the flags, so one hub operation reads both
+	uint8_t fifoStatus[2];
+	if (lps22hh_read_reg(pressureCtx, LPS22HH_FIFO_STATUS1, fifoStatus, sizeof(fifoStatus)) != 0) {
+		return 0;
+	}
+	level = fifoStatus[0];
+	memcpy(&status, &fifoStatus[1], 1);
+
+	if (status.fifo_ovr_ia) {
+		block->overruns++;
+		Log_Debug("LPS22HH: FIFO overrun, pressure samples lost (%u overruns)\n", block->overruns);
+	}
+
+	if (level > PRESSURE_FIFO_DEPTH) {
+		level = PRESSURE_FIFO_DEPTH;
+	}
+	if (level == 0) {
+		return 0;
+	}
+
+	// Reading the output registers pops a slot at a time, so the whole level is one read
+	if (lps22hh_read_reg(pressureCtx, LPS22HH_FIFO_DATA_OUT_PRESS_XL, fifoSlots,
+		(uint16_t)(level * PRESSURE_FIFO_SLOT_SIZE)) != 0) {
+		return 0;
+	}
+	for (uint8_t i = 0; i < level; i++) {
+		AppendSample(block, &fifoSlots[i * PRESSURE_FIFO_SLOT_SIZE]);
+	}
+
+	return block->count;
+}
+
+#elif (PRESSURE_ACQUISITION_MODE == PRESSURE_MODE_ONE_SHOT)
+
+uint32_t pressure_acq_read(pressure_block_t* block)
+{
+	block->count = 0;
+
+	if (oneShotSampleReady) {
+		AppendSample(block, oneShotSample);
+		oneShotSampleReady = false;
+	}
+
+	// Time the next conversion from this tick
+	ScheduleOneShot();
+
+	return block->count;
+}
+
+#else // PRESSURE_MODE_POLLED
+
+uint32_t pressure_acq_read(pressure_block_t* block)
+{
+	lps22hh_reg_t lps22hhReg;
+	uint8_t raw[PRESSURE_FIFO_SLOT_SIZE];
+
+	block->count = 0;
+
+	lps22hh_read_reg(pressureCtx, LPS22HH_STATUS, (uint8_t *)&lps22hhReg, 1);
+
+	//Read output only if new value is available
+	if ((lps22hhReg.status.p_da == 1) && (lps22hhReg.status.t_da == 1)) {
+
+		// PRESS_OUT_XL through TEMP_OUT_H are consecutive, so read them in one hub operation
+		if (lps22hh_read_reg(pressureCtx, LPS22HH_PRESS_OUT_XL, raw, sizeof(raw)) == 0) {
+			AppendSample(block, raw);
+		}
+	}
+
+	return block->count;
+}
+
+#endif
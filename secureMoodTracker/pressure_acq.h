@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lps22hh_reg.h"
+
+// Depth of the LPS22HH FIFO
+#define PRESSURE_FIFO_DEPTH 128
+
+/// <summary>
+///     Pressure and temperature samples returned by one read, oldest first.
+/// </summary>
+typedef struct {
+	float pressure_hPa[PRESSURE_FIFO_DEPTH];
+	float temperature_degC[PRESSURE_FIFO_DEPTH];
+	uint32_t count;
+	uint32_t overruns;		// FIFO drains that found the FIFO full, so samples were lost; sent with the telemetry
+} pressure_block_t;
+
+/// <summary>
+///     Sets up the LPS22HH for the mode selected by PRESSURE_ACQUISITION_MODE in build_options.h.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int pressure_acq_init(lps22hh_ctx_t* ctx);
+void pressure_acq_close(void);
+
+/// <summary>
+///     Called once per accel tick.  Collects whatever new samples the selected mode has ready.
+/// </summary>
+/// <returns>Number of samples in the block, 0 if nothing new is available</returns>
+uint32_t pressure_acq_read(pressure_block_t* block);
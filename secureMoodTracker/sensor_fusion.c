@@ -0,0 +1,375 @@
+/***************************************************************************************************
+   Name: sensor_fusion.c
+
+   Mahony complementary filter that turns the LSM6DSO accelerometer and gyro stream into an
+   orientation quaternion.  The gyro is integrated between samples and the accelerometer gravity
+   vector slowly corrects the drift.  Define SENSOR_FUSION_FIXED_POINT in build_options.h to use the
+   integer implementation (Q2.30 quaternion, 64 bit intermediates).
+****************************************************************************************************/
+
+#include <math.h>
+#include <time.h>
+
+#include "sensor_fusion.h"
+
+#define RAD_TO_DEG 57.29577951f
+#define DEG_TO_RAD 0.01745329252f
+
+#ifdef SENSOR_FUSION_FIXED_POINT
+
+#define Q30_ONE (1LL << 30)
+
+// Gyro sensitivity in Q30 rad/s per LSB
+#define GYRO_Q30_PER_LSB ((int64_t)(SENSOR_FUSION_GYRO_RAD_PER_LSB * (float)Q30_ONE + 0.5f))
+
+// Feedback gains (already doubled, as in the reference implementation) in Q16
+#define TWO_KP_Q16 ((int64_t)(2.0f * SENSOR_FUSION_KP * 65536.0f + 0.5f))
+#define TWO_KI_Q16 ((int64_t)(2.0f * SENSOR_FUSION_KI * 65536.0f + 0.5f))
+
+/// <summary>
+///     Integer square root of a 64 bit value.
+/// </summary>
+static uint64_t isqrt64(uint64_t value)
+{
+	uint64_t result = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+
+	while (bit != 0) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return result;
+}
+
+static void normalize_quaternion(int32_t q[4])
+{
+	int64_t norm2 = 0;
+	for (int i = 0; i < 4; i++) {
+		norm2 += (int64_t)q[i] * q[i];
+	}
+
+	int64_t norm = (int64_t)isqrt64((uint64_t)norm2);
+	if (norm == 0) {
+		return;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		q[i] = (int32_t)(((int64_t)q[i] << 30) / norm);
+	}
+}
+
+static void fusion_step(sensor_fusion_t* fusion, const imu_sample_t* sample, uint32_t dt_us)
+{
+	int32_t* q = fusion->q;
+
+	// Angular rate in Q30 rad/s
+	int64_t gx = sample->gyro[0] * GYRO_Q30_PER_LSB;
+	int64_t gy = sample->gyro[1] * GYRO_Q30_PER_LSB;
+	int64_t gz = sample->gyro[2] * GYRO_Q30_PER_LSB;
+
+	int64_t ax = sample->accel[0];
+	int64_t ay = sample->accel[1];
+	int64_t az = sample->accel[2];
+	int64_t anorm = (int64_t)isqrt64((uint64_t)(ax * ax + ay * ay + az * az));
+
+	// Only use the accelerometer when it measured something
+	if (anorm != 0) {
+
+		ax = (ax << 30) / anorm;
+		ay = (ay << 30) / anorm;
+		az = (az << 30) / anorm;
+
+		// Half of the gravity direction predicted by the current orientation
+		int64_t vx = ((int64_t)q[1] * q[3] - (int64_t)q[0] * q[2]) >> 30;
+		int64_t vy = ((int64_t)q[0] * q[1] + (int64_t)q[2] * q[3]) >> 30;
+		int64_t vz = (((int64_t)q[0] * q[0] + (int64_t)q[3] * q[3]) >> 30) - (Q30_ONE >> 1);
+
+		// Error is the cross product between measured and predicted gravity
+		int64_t ex = (ay * vz - az * vy) >> 30;
+		int64_t ey = (az * vx - ax * vz) >> 30;
+		int64_t ez = (ax * vy - ay * vx) >> 30;
+
+		if (TWO_KI_Q16 > 0) {
+			fusion->integral[0] += ((ex * TWO_KI_Q16) >> 16) * dt_us / 1000000;
+			fusion->integral[1] += ((ey * TWO_KI_Q16) >> 16) * dt_us / 1000000;
+			fusion->integral[2] += ((ez * TWO_KI_Q16) >> 16) * dt_us / 1000000;
+			gx += fusion->integral[0];
+			gy += fusion->integral[1];
+			gz += fusion->integral[2];
+		}
+
+		gx += (ex * TWO_KP_Q16) >> 16;
+		gy += (ey * TWO_KP_Q16) >> 16;
+		gz += (ez * TWO_KP_Q16) >> 16;
+	}
+
+	// Half of the rotation over this step
+	gx = gx * dt_us / 2000000;
+	gy = gy * dt_us / 2000000;
+	gz = gz * dt_us / 2000000;
+
+	int64_t qa = q[0];
+	int64_t qb = q[1];
+	int64_t qc = q[2];
+	int64_t qd = q[3];
+
+	q[0] = (int32_t)(qa + ((-qb * gx - qc * gy - qd * gz) >> 30));
+	q[1] = (int32_t)(qb + ((qa * gx + qc * gz - qd * gy) >> 30));
+	q[2] = (int32_t)(qc + ((qa * gy - qb * gz + qd * gx) >> 30));
+	q[3] = (int32_t)(qd + ((qa * gz + qb * gy - qc * gx) >> 30));
+
+	normalize_quaternion(q);
+}
+
+static void set_quaternion(sensor_fusion_t* fusion, const float q[4])
+{
+	for (int i = 0; i < 4; i++) {
+		fusion->q[i] = (int32_t)(q[i] * (float)Q30_ONE);
+	}
+	for (int i = 0; i < 3; i++) {
+		fusion->integral[i] = 0;
+	}
+}
+
+void sensor_fusion_get_quaternion(const sensor_fusion_t* fusion, float q[4])
+{
+	for (int i = 0; i < 4; i++) {
+		q[i] = (float)fusion->q[i] / (float)Q30_ONE;
+	}
+}
+
+#else // !SENSOR_FUSION_FIXED_POINT
+
+static void fusion_step(sensor_fusion_t* fusion, const imu_sample_t* sample, uint32_t dt_us)
+{
+	float* q = fusion->q;
+	float dt = (float)dt_us * 1.0e-6f;
+
+	float gx = (float)sample->gyro[0] * SENSOR_FUSION_GYRO_RAD_PER_LSB;
+	float gy = (float)sample->gyro[1] * SENSOR_FUSION_GYRO_RAD_PER_LSB;
+	float gz = (float)sample->gyro[2] * SENSOR_FUSION_GYRO_RAD_PER_LSB;
+
+	float ax = (float)sample->accel[0];
+	float ay = (float)sample->accel[1];
+	float az = (float)sample->accel[2];
+	float anorm2 = ax * ax + ay * ay + az * az;
+
+	// Only use the accelerometer when it measured something
+	if (anorm2 > 0.0f) {
+
+		float recipNorm = 1.0f / sqrtf(anorm2);
+		ax *= recipNorm;
+		ay *= recipNorm;
+		az *= recipNorm;
+
+		// Half of the gravity direction predicted by the current orientation
+		float vx = q[1] * q[3] - q[0] * q[2];
+		float vy = q[0] * q[1] + q[2] * q[3];
+		float vz = q[0] * q[0] - 0.5f + q[3] * q[3];
+
+		// Error is the cross product between measured and predicted gravity
+		float ex = ay * vz - az * vy;
+		float ey = az * vx - ax * vz;
+		float ez = ax * vy - ay * vx;
+
+		if (SENSOR_FUSION_KI > 0.0f) {
+			fusion->integral[0] += 2.0f * SENSOR_FUSION_KI * ex * dt;
+			fusion->integral[1] += 2.0f * SENSOR_FUSION_KI * ey * dt;
+			fusion->integral[2] += 2.0f * SENSOR_FUSION_KI * ez * dt;
+			gx += fusion->integral[0];
+			gy += fusion->integral[1];
+			gz += fusion->integral[2];
+		}
+
+		gx += 2.0f * SENSOR_FUSION_KP * ex;
+		gy += 2.0f * SENSOR_FUSION_KP * ey;
+		gz += 2.0f * SENSOR_FUSION_KP * ez;
+	}
+
+	// Half of the rotation over this step
+	gx *= 0.5f * dt;
+	gy *= 0.5f * dt;
+	gz *= 0.5f * dt;
+
+	float qa = q[0];
+	float qb = q[1];
+	float qc = q[2];
+
+	q[0] += -qb * gx - qc * gy - q[3] * gz;
+	q[1] += qa * gx + qc * gz - q[3] * gy;
+	q[2] += qa * gy - qb * gz + q[3] * gx;
+	q[3] += qa * gz + qb * gy - qc * gx;
+
+	float recipNorm = 1.0f / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	for (int i = 0; i < 4; i++) {
+		q[i] *= recipNorm;
+	}
+}
+
+static void set_quaternion(sensor_fusion_t* fusion, const float q[4])
+{
+	for (int i = 0; i < 4; i++) {
+		fusion->q[i] = q[i];
+	}
+	for (int i = 0; i < 3; i++) {
+		fusion->integral[i] = 0.0f;
+	}
+}
+
+void sensor_fusion_get_quaternion(const sensor_fusion_t* fusion, float q[4])
+{
+	for (int i = 0; i < 4; i++) {
+		q[i] = fusion->q[i];
+	}
+}
+
+#endif // SENSOR_FUSION_FIXED_POINT
+
+/// <summary>
+///     Gravity direction in the sensor frame for the current orientation.
+/// </summary>
+static void get_gravity(const sensor_fusion_t* fusion, float g[3])
+{
+	float q[4];
+	sensor_fusion_get_quaternion(fusion, q);
+
+	g[0] = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+	g[1] = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+	g[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+/// <summary>
+///     Starts the filter from the tilt measured by the accelerometer so there is no settling time.
+/// </summary>
+static void initialize_from_accel(sensor_fusion_t* fusion, const imu_sample_t* sample)
+{
+	float ax = (float)sample->accel[0];
+	float ay = (float)sample->accel[1];
+	float az = (float)sample->accel[2];
+
+	float roll = atan2f(ay, az);
+	float pitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+
+	float cr = cosf(roll * 0.5f);
+	float sr = sinf(roll * 0.5f);
+	float cp = cosf(pitch * 0.5f);
+	float sp = sinf(pitch * 0.5f);
+
+	const float q[4] = { cr * cp, sr * cp, cr * sp, -sr * sp };
+	set_quaternion(fusion, q);
+
+	get_gravity(fusion, fusion->referenceGravity);
+}
+
+void sensor_fusion_init(sensor_fusion_t* fusion)
+{
+	const float identity[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+
+	set_quaternion(fusion, identity);
+	fusion->lastTimestamp_us = 0;
+	fusion->initialized = false;
+	fusion->referenceGravity[0] = 0.0f;
+	fusion->referenceGravity[1] = 0.0f;
+	fusion->referenceGravity[2] = 1.0f;
+	fusion->updates = 0;
+}
+
+/// <summary>
+///     Advances the orientation estimate to the time of the sample.
+/// </summary>
+void sensor_fusion_update(sensor_fusion_t* fusion, const imu_sample_t* sample)
+{
+	if (!fusion->initialized) {
+		if ((sample->accel[0] == 0) && (sample->accel[1] == 0) && (sample->accel[2] == 0)) {
+			return;
+		}
+		initialize_from_accel(fusion, sample);
+		fusion->lastTimestamp_us = sample->timestamp_us;
+		fusion->initialized = true;
+		return;
+	}
+
+	// Unsigned subtraction keeps the step right across a timestamp wrap
+	uint32_t dt_us = sample->timestamp_us - fusion->lastTimestamp_us;
+	fusion->lastTimestamp_us = sample->timestamp_us;
+
+	if (dt_us > SENSOR_FUSION_MAX_DT_US) {
+		dt_us = SENSOR_FUSION_MAX_DT_US;
+	}
+
+	fusion_step(fusion, sample, dt_us);
+	fusion->updates++;
+}
+
+void sensor_fusion_get_tilt(const sensor_fusion_t* fusion, float* roll_deg, float* pitch_deg)
+{
+	float g[3];
+	get_gravity(fusion, g);
+
+	*roll_deg = atan2f(g[1], g[2]) * RAD_TO_DEG;
+	*pitch_deg = atan2f(-g[0], sqrtf(g[1] * g[1] + g[2] * g[2])) * RAD_TO_DEG;
+}
+
+bool sensor_fusion_orientation_changed(sensor_fusion_t* fusion)
+{
+	static float cosThreshold = 0.0f;
+	float g[3];
+
+	if (!fusion->initialized) {
+		return false;
+	}
+
+	if (cosThreshold == 0.0f) {
+		cosThreshold = cosf(SENSOR_FUSION_TILT_EVENT_DEG * DEG_TO_RAD);
+	}
+
+	// Both vectors are unit length, so the dot product is the cosine of the tilt between them
+	get_gravity(fusion, g);
+	float cosTilt = g[0] * fusion->referenceGravity[0] + g[1] * fusion->referenceGravity[1] + g[2] * fusion->referenceGravity[2];
+
+	if (cosTilt >= cosThreshold) {
+		return false;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		fusion->referenceGravity[i] = g[i];
+	}
+	return true;
+}
+
+uint32_t sensor_fusion_benchmark(uint32_t iterations)
+{
+	sensor_fusion_t fusion;
+	imu_sample_t sample = { .accel = { 120, -340, 8150 }, .gyro = { 14, -9, 3 }, .timestamp_us = 0 };
+	struct timespec start, end;
+
+	if (iterations == 0) {
+		return 0;
+	}
+
+	sensor_fusion_init(&fusion);
+	sensor_fusion_update(&fusion, &sample);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32_t i = 0; i < iterations; i++) {
+		// 416 Hz sample spacing with a slowly changing rotation
+		sample.timestamp_us += 2404;
+		sample.gyro[0] = (int16_t)((i & 0xFF) - 128);
+		sensor_fusion_update(&fusion, &sample);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	int64_t elapsed_ns = (int64_t)(end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	return (uint32_t)(elapsed_ns / iterations);
+}
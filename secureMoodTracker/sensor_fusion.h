@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "build_options.h"
+
+// Gyro sensitivity for the LSM6DSO_2000dps full scale set in initI2c: 70 mdps/LSB in rad/s.
+// Must be kept in step with lsm6dso_gy_full_scale_set().
+#define SENSOR_FUSION_GYRO_RAD_PER_LSB 1.2217305e-3f
+
+// Mahony filter gains.  Kp pulls the estimate toward the measured gravity, Ki removes gyro bias.
+#define SENSOR_FUSION_KP 1.0f
+#define SENSOR_FUSION_KI 0.01f
+
+// Longest step integrated in one update.  Longer gaps (FIFO overrun, sensor hub access) are
+// clamped so a stale gyro reading can not spin the estimate.
+#define SENSOR_FUSION_MAX_DT_US 100000U
+
+// Tilt from the last reported orientation that raises a new orientation event.
+#define SENSOR_FUSION_TILT_EVENT_DEG 15.0f
+
+/// <summary>
+///     One timestamped IMU reading.  Values are raw LSM6DSO counts with the gyro calibration
+///     offset already removed.
+/// </summary>
+typedef struct {
+	int16_t accel[3];
+	int16_t gyro[3];
+	uint32_t timestamp_us;
+} imu_sample_t;
+
+typedef struct {
+#ifdef SENSOR_FUSION_FIXED_POINT
+	int32_t q[4];			// orientation quaternion, Q2.30
+	int64_t integral[3];	// integral feedback, rad/s in Q30
+#else
+	float q[4];				// orientation quaternion w, x, y, z
+	float integral[3];		// integral feedback, rad/s
+#endif
+	uint32_t lastTimestamp_us;
+	bool initialized;
+	float referenceGravity[3];	// gravity direction at the last orientation event
+	uint32_t updates;
+} sensor_fusion_t;
+
+void sensor_fusion_init(sensor_fusion_t* fusion);
+void sensor_fusion_update(sensor_fusion_t* fusion, const imu_sample_t* sample);
+
+void sensor_fusion_get_quaternion(const sensor_fusion_t* fusion, float q[4]);
+void sensor_fusion_get_tilt(const sensor_fusion_t* fusion, float* roll_deg, float* pitch_deg);
+
+/// <summary>
+///     Checks whether the device has tilted by more than SENSOR_FUSION_TILT_EVENT_DEG since the last
+///     event.  When it has, the current orientation becomes the new reference.
+/// </summary>
+/// <returns>true if an orientation event should be published</returns>
+bool sensor_fusion_orientation_changed(sensor_fusion_t* fusion);
+
+/// <summary>
+///     Runs the filter on synthetic data and measures the average cost of one update.
+/// </summary>
+/// <returns>Nanoseconds per update</returns>
+uint32_t sensor_fusion_benchmark(uint32_t iterations);
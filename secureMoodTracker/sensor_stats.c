@@ -0,0 +1,171 @@
+/***************************************************************************************************
+   Name: sensor_stats.c
+
+   Windowed statistics for the on-board sensors.  Every sensor read is folded into a running
+   min/max/mean/variance per channel, and only the summary of the window is sent to Azure.  This
+   keeps the upload cost fixed no matter how often the sensors are read.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+
+#include "sensor_stats.h"
+
+int statsWindowSamples = SENSOR_STATS_DEFAULT_WINDOW;
+
+// Telemetry keys for each channel.  The plain key carries the window mean so the existing
+// dashboards keep working.
+static const char* const channelKeys[STATS_NUM_CHANNELS] = {
+	"aX", "aY", "aZ", "gX", "gY", "gZ", "pressure", "temp"
+};
+
+static const char cstrChannelSummaryJson[] =
+	"%s\"%s\": \"%.2f\", \"%s_min\": \"%.2f\", \"%s_max\": \"%.2f\", \"%s_rms\": \"%.2f\", \"%s_var\": \"%.4f\", \"%s_p2p\": \"%.2f\"";
+
+/// <summary>
+///     Clears the running statistics for one channel.
+/// </summary>
+void sensor_stats_reset(sensor_stats_t* stats)
+{
+	stats->count = 0;
+	stats->min = FLT_MAX;
+	stats->max = -FLT_MAX;
+	stats->mean = 0.0f;
+	stats->m2 = 0.0f;
+}
+
+/// <summary>
+///     Folds one sample into the running statistics (Welford's online algorithm).
+/// </summary>
+void sensor_stats_add(sensor_stats_t* stats, float sample)
+{
+	stats->count++;
+
+	if (sample < stats->min) {
+		stats->min = sample;
+	}
+	if (sample > stats->max) {
+		stats->max = sample;
+	}
+
+	float delta = sample - stats->mean;
+	stats->mean += delta / (float)stats->count;
+	stats->m2 += delta * (sample - stats->mean);
+}
+
+/// <summary>
+///     Folds a block of samples, for example a FIFO drain, into the running statistics.
+/// </summary>
+void sensor_stats_add_block(sensor_stats_t* stats, const float* samples, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		sensor_stats_add(stats, samples[i]);
+	}
+}
+
+/// <summary>
+///     Derives the reported values from the running statistics.  The RMS comes from the identity
+///     E[x^2] = mean^2 + variance, so no separate sum of squares is needed.
+/// </summary>
+void sensor_stats_summary(const sensor_stats_t* stats, sensor_stats_summary_t* summary)
+{
+	summary->count = stats->count;
+
+	if (stats->count == 0) {
+		summary->min = 0.0f;
+		summary->max = 0.0f;
+		summary->mean = 0.0f;
+		summary->rms = 0.0f;
+		summary->variance = 0.0f;
+		summary->peakToPeak = 0.0f;
+		return;
+	}
+
+	summary->min = stats->min;
+	summary->max = stats->max;
+	summary->mean = stats->mean;
+	summary->variance = stats->m2 / (float)stats->count;
+	summary->rms = sqrtf(stats->mean * stats->mean + summary->variance);
+	summary->peakToPeak = stats->max - stats->min;
+}
+
+/// <summary>
+///     Initializes a window using the length currently requested through the device twin.
+/// </summary>
+void sensor_window_init(sensor_window_t* window)
+{
+	sensor_window_restart(window);
+}
+
+/// <summary>
+///     Adds a sample for a channel to the open window.
+/// </summary>
+void sensor_window_add(sensor_window_t* window, sensor_stats_channel_t channel, float sample)
+{
+	if (channel >= STATS_NUM_CHANNELS) {
+		return;
+	}
+
+	sensor_stats_add(&window->channel[channel], sample);
+}
+
+/// <summary>
+///     Marks the end of one sensor read.
+/// </summary>
+/// <returns>true when the window is complete and should be reported</returns>
+bool sensor_window_tick(sensor_window_t* window)
+{
+	window->ticks++;
+	return window->ticks >= window->length;
+}
+
+/// <summary>
+///     Clears all channels and opens a new window.  A window length changed through the device twin
+///     takes effect here so that a window is never reported with a mix of lengths.
+/// </summary>
+void sensor_window_restart(sensor_window_t* window)
+{
+	int length = statsWindowSamples;
+
+	if (length < SENSOR_STATS_MIN_WINDOW) {
+		length = SENSOR_STATS_MIN_WINDOW;
+	}
+	else if (length > SENSOR_STATS_MAX_WINDOW) {
+		length = SENSOR_STATS_MAX_WINDOW;
+	}
+
+	for (int i = 0; i < STATS_NUM_CHANNELS; i++) {
+		sensor_stats_reset(&window->channel[i]);
+	}
+
+	window->ticks = 0;
+	window->length = (uint32_t)length;
+}
+
+int sensor_window_to_json(const sensor_window_t* window, char* buffer, size_t size)
+{
+	size_t used = 0;
+	sensor_stats_summary_t summary;
+
+	for (int i = 0; i < STATS_NUM_CHANNELS; i++) {
+
+		// A channel that was not read in this window has nothing to report; zeros would look real
+		if (window->channel[i].count == 0) {
+			continue;
+		}
+
+		const char* key = channelKeys[i];
+		sensor_stats_summary(&window->channel[i], &summary);
+
+		int len = snprintf(buffer + used, size - used, cstrChannelSummaryJson, (used == 0) ? "" : ", ",
+			key, summary.mean, key, summary.min, key, summary.max, key, summary.rms, key, summary.variance, key, summary.peakToPeak);
+
+		if ((len < 0) || ((size_t)len >= size - used)) {
+			return -1;
+		}
+		used += (size_t)len;
+	}
+
+	return (int)used;
+}
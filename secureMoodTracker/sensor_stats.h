@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default number of sensor reads folded into one telemetry summary.  Can be changed at runtime
+// with the "statsWindow" device twin property.
+#define SENSOR_STATS_DEFAULT_WINDOW 10
+#define SENSOR_STATS_MIN_WINDOW 1
+#define SENSOR_STATS_MAX_WINDOW 3600
+
+// Large enough for every channel summary plus the instantaneous fields sent with it.
+#define SENSOR_STATS_JSON_BUFFER_SIZE 2048
+
+typedef enum {
+	STATS_ACCEL_X = 0,
+	STATS_ACCEL_Y,
+	STATS_ACCEL_Z,
+	STATS_GYRO_X,
+	STATS_GYRO_Y,
+	STATS_GYRO_Z,
+	STATS_PRESSURE,
+	STATS_TEMPERATURE,
+	STATS_NUM_CHANNELS
+} sensor_stats_channel_t;
+
+/// <summary>
+///     Running statistics for one channel.  Mean and variance use Welford's update so that every
+///     sample is O(1) and the footprint does not depend on the window length.
+/// </summary>
+typedef struct {
+	uint32_t count;
+	float min;
+	float max;
+	float mean;
+	float m2;		// sum of squared distances from the mean
+} sensor_stats_t;
+
+typedef struct {
+	uint32_t count;
+	float min;
+	float max;
+	float mean;
+	float rms;
+	float variance;
+	float peakToPeak;
+} sensor_stats_summary_t;
+
+typedef struct {
+	sensor_stats_t channel[STATS_NUM_CHANNELS];
+	uint32_t ticks;			// number of sensor reads in the current window
+	uint32_t length;		// number of sensor reads that close the window
+} sensor_window_t;
+
+// Window length requested through the device twin.  Applied when the next window opens.
+extern int statsWindowSamples;
+
+void sensor_stats_reset(sensor_stats_t* stats);
+void sensor_stats_add(sensor_stats_t* stats, float sample);
+void sensor_stats_add_block(sensor_stats_t* stats, const float* samples, size_t count);
+void sensor_stats_summary(const sensor_stats_t* stats, sensor_stats_summary_t* summary);
+
+void sensor_window_init(sensor_window_t* window);
+void sensor_window_add(sensor_window_t* window, sensor_stats_channel_t channel, float sample);
+bool sensor_window_tick(sensor_window_t* window);
+void sensor_window_restart(sensor_window_t* window);
+
+/// <summary>
+///     Appends the per-channel summary of the window as JSON key/value pairs (no braces).  Channels
+///     without samples in the window are left out.
+/// </summary>
+/// <returns>Number of characters written, or -1 if the buffer is too small</returns>
+int sensor_window_to_json(const sensor_window_t* window, char* buffer, size_t size);
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Writes data/imu_trace.csv: an IMU trace in the form the LSM6DSO FIFO drain hands to the
+sensor fusion filter (raw counts, 25 us timestamp ticks converted to us), with the true roll and
+pitch alongside.  The kiosk is tilted about one axis at a time, as when it is knocked or moved,
+with sensor noise and a residual gyro bias.  Seeded, so the file is reproducible."""
+
+import math
+import random
+
+RATE_HZ = 12.5                  # FIFO batch rate of the active power profile
+ACCEL_LSB_PER_G = 1.0 / 0.122e-3   # LSM6DSO_4g
+GYRO_DPS_PER_LSB = 0.070        # LSM6DSO_2000dps
+ACCEL_NOISE_G = 0.004
+GYRO_NOISE_DPS = 0.15
+GYRO_BIAS_DPS = (0.35, -0.25, 0.20)
+
+# (seconds, roll target deg, pitch target deg): ramp linearly to the target over the segment
+SEGMENTS = [
+    (10, 0, 0),
+    (3, 30, 0), (10, 30, 0),
+    (3, 30, -20), (10, 30, -20),
+    (4, 0, -20), (8, 0, -20),
+    (4, 0, 0), (10, 0, 0),
+    (2, -45, 0), (12, -45, 0),
+    (5, 0, 0), (15, 0, 0),
+    (6, 0, 35), (10, 0, 35),
+    (4, 0, 0), (10, 0, 0),
+]
+
+
+def main():
+    random.seed(20190317)
+    dt = 1.0 / RATE_HZ
+    roll = pitch = 0.0
+    t = 0.0
+    rows = []
+    for duration, rollTarget, pitchTarget in SEGMENTS:
+        steps = int(round(duration * RATE_HZ))
+        dRoll = (rollTarget - roll) / steps
+        dPitch = (pitchTarget - pitch) / steps
+        for _ in range(steps):
+            roll += dRoll
+            pitch += dPitch
+            t += dt
+            r, p = math.radians(roll), math.radians(pitch)
+            g = (-math.sin(p), math.sin(r) * math.cos(p), math.cos(r) * math.cos(p))
+            # Body rates for roll/pitch Euler angles with no yaw
+            rateRoll, ratePitch = dRoll / dt, dPitch / dt
+            w = (rateRoll, ratePitch * math.cos(r), -ratePitch * math.sin(r))
+            accel = [round((g[i] + random.gauss(0, ACCEL_NOISE_G)) * ACCEL_LSB_PER_G) for i in range(3)]
+            gyro = [round((w[i] + GYRO_BIAS_DPS[i] + random.gauss(0, GYRO_NOISE_DPS)) / GYRO_DPS_PER_LSB)
+                    for i in range(3)]
+            rows.append((int(t * 1e6) // 25 * 25, *accel, *gyro, roll, pitch))
+
+    with open("data/imu_trace.csv", "w") as out:
+        out.write("# timestamp_us,ax,ay,az,gx,gy,gz,roll_deg,pitch_deg\n")
+        for row in rows:
+            out.write("%d,%d,%d,%d,%d,%d,%d,%.3f,%.3f\n" % row)
+
+
+if __name__ == "__main__":
+    main()
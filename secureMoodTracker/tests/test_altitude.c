@@ -0,0 +1,134 @@
+/***************************************************************************************************
+   Name: test_altitude.c
+
+   Checks the polynomial altitude against the exact formula in double precision over the whole
+   fitted range, and times it against the powf it replaced.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "altitude.h"
+
+// Error bounds documented in altitude.h, against the standard sea level pressure and any other
+#define MAX_ERROR_M 0.0073
+#define MAX_ERROR_ANY_REFERENCE_M 0.013
+
+#define STEP_HPA 0.01f
+#define REFERENCE_STEP_HPA 5.0f
+#define REFERENCE_PRESSURE_STEP_HPA 0.05f
+#define BENCHMARK_SAMPLES 4096
+#define BENCHMARK_ROUNDS 200
+
+static double ExactAltitude(double pressure_hPa, double seaLevel_hPa)
+{
+	return 44330.0 * (1.0 - pow(pressure_hPa / seaLevel_hPa, 1.0 / 5.255));
+}
+
+/// <summary>
+///     Worst error against the exact formula over the fitted range, for the current reference.
+/// </summary>
+static double MaxError(float step_hPa, float* worstPressure)
+{
+	double maxError = 0.0;
+
+	for (int i = 0; ; i++) {
+		float pressure = ALTITUDE_MIN_PRESSURE_HPA + step_hPa * (float)i;
+		if (pressure > ALTITUDE_MAX_PRESSURE_HPA) {
+			break;
+		}
+
+		double error = fabs(altitude_from_pressure(pressure) - ExactAltitude(pressure, seaLevelPressure_hPa));
+		if (error > maxError) {
+			maxError = error;
+			*worstPressure = pressure;
+		}
+	}
+	return maxError;
+}
+
+static double Seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+	static float pressures[BENCHMARK_SAMPLES];
+	static float altitudes[BENCHMARK_SAMPLES];
+	float worstPressure = 0.0f;
+	float worstReference = 0.0f;
+	double anyReferenceError = 0.0;
+	int failures = 0;
+
+	seaLevelPressure_hPa = ALTITUDE_STANDARD_SEA_LEVEL_HPA;
+	double maxError = MaxError(STEP_HPA, &worstPressure);
+
+	for (float reference = ALTITUDE_MIN_PRESSURE_HPA; reference <= ALTITUDE_MAX_PRESSURE_HPA; reference += REFERENCE_STEP_HPA) {
+		float pressure;
+
+		seaLevelPressure_hPa = reference;
+		double error = MaxError(REFERENCE_PRESSURE_STEP_HPA, &pressure);
+		if (error > anyReferenceError) {
+			anyReferenceError = error;
+			worstReference = reference;
+		}
+	}
+
+	// The twin handler must turn away references outside the fit
+	float reference = 5000.0f;
+	if (altitude_validate_sea_level(&reference) || reference != ALTITUDE_STANDARD_SEA_LEVEL_HPA) {
+		printf("FAIL: sea level reference of 5000 hPa accepted\n");
+		failures++;
+	}
+	reference = NAN;
+	if (altitude_validate_sea_level(&reference)) {
+		printf("FAIL: NaN sea level reference accepted\n");
+		failures++;
+	}
+	reference = 990.0f;
+	if (!altitude_validate_sea_level(&reference) || reference != 990.0f) {
+		printf("FAIL: sea level reference of 990 hPa refused\n");
+		failures++;
+	}
+
+	// Benchmark a block conversion, as a FIFO drain does, against powf per sample
+	seaLevelPressure_hPa = ALTITUDE_STANDARD_SEA_LEVEL_HPA;
+	for (int i = 0; i < BENCHMARK_SAMPLES; i++) {
+		pressures[i] = 950.0f + 100.0f * (float)i / BENCHMARK_SAMPLES;
+	}
+
+	double start = Seconds();
+	for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+		altitude_from_pressure_block(pressures, altitudes, BENCHMARK_SAMPLES);
+		__asm__ volatile("" : : "r"(altitudes) : "memory");
+	}
+	double polynomialNs = (Seconds() - start) * 1e9 / (BENCHMARK_SAMPLES * BENCHMARK_ROUNDS);
+
+	start = Seconds();
+	for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+		for (int i = 0; i < BENCHMARK_SAMPLES; i++) {
+			altitudes[i] = 44330.0f * (1.0f - powf(pressures[i] / seaLevelPressure_hPa, 1.0f / 5.255f));
+		}
+		__asm__ volatile("" : : "r"(altitudes) : "memory");
+	}
+	double powfNs = (Seconds() - start) * 1e9 / (BENCHMARK_SAMPLES * BENCHMARK_ROUNDS);
+
+	printf("altitude: max error %.4f m at %.2f hPa, %.4f m with a %.0f hPa reference, %.1f ns/sample polynomial, %.1f ns/sample powf\n",
+		maxError, worstPressure, anyReferenceError, worstReference, polynomialNs, powfNs);
+
+	if (maxError > MAX_ERROR_M) {
+		printf("FAIL: altitude error %.4f m over %.4f\n", maxError, MAX_ERROR_M);
+		failures++;
+	}
+	if (anyReferenceError > MAX_ERROR_ANY_REFERENCE_M) {
+		printf("FAIL: altitude error %.4f m over %.4f with a %.0f hPa reference\n", anyReferenceError,
+			MAX_ERROR_ANY_REFERENCE_M, worstReference);
+		failures++;
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/***************************************************************************************************
+   Name: test_baro_trend.c
+
+   Replays a generated pressure trace through the barometric trend in the 5 second, 50 sample
+   blocks a FIFO drain delivers: two steady hours, four falling at 1.5 hPa/h, a half hour gap with
+   the device suspended, then steady again.  The trend must fall once, hold its class while the
+   windows warm up after the gap, and only then settle back to steady.
+****************************************************************************************************/
+
+#include <stdio.h>
+
+#include "baro_trend.h"
+
+#define BLOCK_SECONDS 5
+#define BLOCK_SAMPLES 50
+
+#define STEADY_SECONDS (2 * 3600)
+#define FALLING_SECONDS (4 * 3600)
+#define GAP_SECONDS (30 * 60)
+#define RECOVERY_SECONDS (150 * 60)
+
+#define FALLING_HPA_PER_HOUR -1.5f
+#define NOISE_HPA 0.05f
+
+static uint32_t noiseState = 12345;
+
+static float Noise(void)
+{
+	noiseState = noiseState * 1664525u + 1013904223u;
+	return NOISE_HPA * ((float)(noiseState >> 8) / (float)(1u << 24) * 2.0f - 1.0f);
+}
+
+static float TracePressure(time_t t)
+{
+	if (t < STEADY_SECONDS) {
+		return 1013.0f;
+	}
+	if (t < STEADY_SECONDS + FALLING_SECONDS) {
+		return 1013.0f + FALLING_HPA_PER_HOUR * (float)(t - STEADY_SECONDS) / 3600.0f;
+	}
+	return 1013.0f + FALLING_HPA_PER_HOUR * (float)FALLING_SECONDS / 3600.0f;
+}
+
+int main(void)
+{
+	static baro_trend_t trend;
+	float block[BLOCK_SAMPLES];
+	time_t gapEnd = STEADY_SECONDS + FALLING_SECONDS + GAP_SECONDS;
+	time_t end = gapEnd + RECOVERY_SECONDS;
+	time_t fellAt = 0;
+	time_t settledAt = 0;
+	uint32_t changes = 0;
+	int failures = 0;
+
+	baro_trend_init(&trend);
+
+	for (time_t t = BLOCK_SECONDS; t <= end; t += BLOCK_SECONDS) {
+
+		// Suspended: no drains at all
+		if (t > STEADY_SECONDS + FALLING_SECONDS && t < gapEnd) {
+			continue;
+		}
+
+		for (int i = 0; i < BLOCK_SAMPLES; i++) {
+			block[i] = TracePressure(t) + Noise();
+		}
+
+		if (!baro_trend_add_block(&trend, block, BLOCK_SAMPLES, t)) {
+			continue;
+		}
+
+		changes++;
+		printf("%6.2f h: %s, 3 h slope %.2f hPa/h\n", (double)t / 3600.0, baro_trend_name(trend.trend),
+			baro_trend_long_slope(&trend));
+
+		if (trend.trend == BARO_TREND_FALLING && fellAt == 0) {
+			fellAt = t;
+		}
+		else if (trend.trend == BARO_TREND_STEADY && fellAt != 0 && settledAt == 0) {
+			settledAt = t;
+		}
+		else {
+			printf("FAIL: unexpected change to %s\n", baro_trend_name(trend.trend));
+			failures++;
+		}
+	}
+
+	if (fellAt < STEADY_SECONDS || fellAt > STEADY_SECONDS + FALLING_SECONDS) {
+		printf("FAIL: the fall was not reported while it lasted\n");
+		failures++;
+	}
+	if (settledAt == 0) {
+		printf("FAIL: the trend never settled back to steady\n");
+		failures++;
+	}
+	else if (settledAt < gapEnd + (BARO_TREND_MIN_POINTS - 1) * BARO_TREND_DECIMATION_SECONDS) {
+		printf("FAIL: change reported %.0f min after the gap, before the windows were warm\n",
+			(double)(settledAt - gapEnd) / 60.0);
+		failures++;
+	}
+
+	printf("baro trend: %u changes\n", changes);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/***************************************************************************************************
+   Name: test_sensor_fusion.c
+
+   Replays data/imu_trace.csv through the sensor fusion filter and checks the tilt it reports
+   against the true roll and pitch of the trace.  Built twice by the Makefile, once as the float
+   filter and once with SENSOR_FUSION_FIXED_POINT, against the same bounds.
+****************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "sensor_fusion.h"
+
+#ifdef SENSOR_FUSION_FIXED_POINT
+#define FILTER_NAME "Q30"
+#else
+#define FILTER_NAME "float"
+#endif
+
+// The filter starts from the first accel reading; give the gyro bias integral time to settle
+#define SETTLE_SECONDS 10.0f
+
+// Worst tilt error while the kiosk is held still, and RMS error over the whole trace
+#define MAX_HOLD_ERROR_DEG 2.0f
+#define MAX_RMS_ERROR_DEG 3.0f
+
+// Every tilt in the trace is 20 degrees or more, so each must raise at least one orientation
+// event, and none may come once the kiosk has been still for this long
+#define TRACE_MOVES 8
+#define HOLD_SETTLED_SECONDS 2.0f
+
+int main(int argc, char* argv[])
+{
+	const char* path = (argc > 1) ? argv[1] : "data/imu_trace.csv";
+	FILE* trace = fopen(path, "r");
+	char line[160];
+	sensor_fusion_t fusion;
+	uint32_t samples = 0;
+	uint32_t scored = 0;
+	uint32_t events = 0;
+	uint32_t spuriousEvents = 0;
+	uint32_t holdStart = 0;
+	float holdError = 0.0f;
+	double squaredError = 0.0;
+	float lastRoll = 0.0f;
+	float lastPitch = 0.0f;
+	int failures = 0;
+
+	if (trace == NULL) {
+		printf("FAIL: cannot open %s\n", path);
+		return 1;
+	}
+
+	sensor_fusion_init(&fusion);
+
+	while (fgets(line, sizeof(line), trace) != NULL) {
+		imu_sample_t sample;
+		int ax, ay, az, gx, gy, gz;
+		unsigned long timestamp;
+		float trueRoll, truePitch;
+
+		if (line[0] == '#' || sscanf(line, "%lu,%d,%d,%d,%d,%d,%d,%f,%f", &timestamp, &ax, &ay, &az,
+			&gx, &gy, &gz, &trueRoll, &truePitch) != 9) {
+			continue;
+		}
+
+		sample.timestamp_us = (uint32_t)timestamp;
+		sample.accel[0] = (int16_t)ax;
+		sample.accel[1] = (int16_t)ay;
+		sample.accel[2] = (int16_t)az;
+		sample.gyro[0] = (int16_t)gx;
+		sample.gyro[1] = (int16_t)gy;
+		sample.gyro[2] = (int16_t)gz;
+		sensor_fusion_update(&fusion, &sample);
+		samples++;
+
+		bool holding = (trueRoll == lastRoll && truePitch == lastPitch);
+		lastRoll = trueRoll;
+		lastPitch = truePitch;
+		if (!holding) {
+			holdStart = (uint32_t)timestamp;
+		}
+
+		if (sensor_fusion_orientation_changed(&fusion)) {
+			events++;
+			if (holding && (float)(timestamp - holdStart) > HOLD_SETTLED_SECONDS * 1e6f) {
+				spuriousEvents++;
+			}
+		}
+
+		if ((float)timestamp < SETTLE_SECONDS * 1e6f) {
+			continue;
+		}
+
+		float roll, pitch;
+		sensor_fusion_get_tilt(&fusion, &roll, &pitch);
+
+		float error = fmaxf(fabsf(roll - trueRoll), fabsf(pitch - truePitch));
+		squaredError += (double)error * error;
+		scored++;
+		if (holding && error > holdError) {
+			holdError = error;
+		}
+	}
+	fclose(trace);
+
+	float rmsError = (scored > 0) ? (float)sqrt(squaredError / scored) : 0.0f;
+
+	printf("%s filter: %u samples, max error held %.2f deg, rms %.2f deg, %u orientation events, %u ns/update\n",
+		FILTER_NAME, samples, holdError, rmsError, events, sensor_fusion_benchmark(100000));
+
+	if (scored == 0) {
+		printf("FAIL: no samples scored\n");
+		failures++;
+	}
+	if (holdError > MAX_HOLD_ERROR_DEG) {
+		printf("FAIL: held tilt error %.2f deg over %.2f\n", holdError, MAX_HOLD_ERROR_DEG);
+		failures++;
+	}
+	if (rmsError > MAX_RMS_ERROR_DEG) {
+		printf("FAIL: rms tilt error %.2f deg over %.2f\n", rmsError, MAX_RMS_ERROR_DEG);
+		failures++;
+	}
+	if (events < TRACE_MOVES) {
+		printf("FAIL: %u orientation events for %u moves\n", events, TRACE_MOVES);
+		failures++;
+	}
+	if (spuriousEvents > 0) {
+		printf("FAIL: %u orientation events while the kiosk was still\n", spuriousEvents);
+		failures++;
+	}
+
+	return failures ? 1 : 0;
+}